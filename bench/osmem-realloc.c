@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Realloc benchmark: runs fixed os_realloc patterns against libosmem and
+// reports for each one the calls resized in place, the bytes copied next to
+// those a malloc/copy/free realloc would copy, the syscalls and the time.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <getopt.h>
+
+#include "osmem.h"
+#include "osmem_conf.h"
+#include "block_meta.h"
+
+// Buffers live at once, the most any pattern uses.
+#define MAX_BUFS 4096
+
+struct buf {
+	char *ptr;
+	size_t size;
+};
+
+struct pattern {
+	const char *name;
+	void (*run)(void);
+};
+
+static struct buf bufs[MAX_BUFS];
+static unsigned long rng = 1;
+static unsigned long reps = 1;
+
+// Bytes a realloc that always moves would copy.
+static size_t naive_copied;
+
+static unsigned long rng_next(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+// Resizes buffer (i) to (size) bytes: checks the last byte kept and fills the
+// bytes gained, as the owner of a growing buffer would.
+static void resize(int i, size_t size)
+{
+	struct buf *b = &bufs[i];
+	size_t keep = (b->size < size) ? b->size : size;
+
+	b->ptr = os_realloc(b->ptr, size);
+	DIE(!b->ptr, "os_realloc");
+	if (keep && (b->ptr[keep - 1] != (char)i)) {
+		fprintf(stderr, "buffer %d lost its contents at %zu bytes\n", i, keep);
+		exit(EXIT_FAILURE);
+	}
+	if (size > keep)
+		memset(b->ptr + keep, (char)i, size - keep);
+	naive_copied += keep;
+	b->size = size;
+}
+
+static void release(int n)
+{
+	for (int i = 0; i < n; i++) {
+		os_free(bufs[i].ptr);
+		bufs[i].ptr = NULL;
+		bufs[i].size = 0;
+	}
+}
+
+// Strings built side by side from chunks of 1 to 64 bytes, up to 64 KB each.
+static void pattern_strbuild(void)
+{
+	for (unsigned long r = 0; r < reps; r++) {
+		for (size_t len = 0; len < 64 * 1024;) {
+			size_t chunk = 1 + rng_next() % 64;
+
+			len += chunk;
+			for (int i = 0; i < 32; i++)
+				resize(i, len);
+		}
+		release(32);
+	}
+}
+
+// Vectors doubling side by side from 16 bytes to 1 MB.
+static void pattern_vector(void)
+{
+	for (unsigned long r = 0; r < 32 * reps; r++) {
+		for (size_t size = 16; size <= 1024 * 1024; size *= 2)
+			for (int i = 0; i < 16; i++)
+				resize(i, size);
+		release(16);
+	}
+}
+
+// Buffers filled to 25-100% of a capacity between 256 bytes and 256 KB, then
+// shrunk to fit.
+static void pattern_shrink(void)
+{
+	for (unsigned long r = 0; r < 4 * reps; r++) {
+		for (int i = 0; i < MAX_BUFS; i++) {
+			size_t cap = 256UL << (rng_next() % 11);
+
+			resize(i, cap);
+			resize(i, cap / 4 + rng_next() % (cap - cap / 4) + 1);
+		}
+		release(MAX_BUFS);
+	}
+}
+
+// Buffers alternating between 4 KB and 256 bytes.
+static void pattern_seesaw(void)
+{
+	for (unsigned long r = 0; r < 500 * reps; r++)
+		for (int i = 0; i < 64; i++)
+			resize(i, (r % 2) ? 256 : 4096);
+	release(64);
+}
+
+// Buffers alternating between 3/4 and 3/2 of the mmap threshold, so that
+// every call moves them between the heap and a mapping.
+static void pattern_threshold(void)
+{
+	size_t low = osmem_conf.mmap_threshold / 4 * 3;
+	size_t high = osmem_conf.mmap_threshold / 2 * 3;
+
+	for (unsigned long r = 0; r < 100 * reps; r++)
+		for (int i = 0; i < 16; i++)
+			resize(i, (r % 2) ? low : high);
+	release(16);
+}
+
+static const struct pattern patterns[] = {
+	{"strbuild", pattern_strbuild},
+	{"vector", pattern_vector},
+	{"shrink", pattern_shrink},
+	{"seesaw", pattern_seesaw},
+	{"threshold", pattern_threshold},
+};
+
+#define NR_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+static void run(const struct pattern *p)
+{
+	struct osmem_stats before, after;
+	struct timespec start, stop;
+
+	naive_copied = 0;
+	os_stats_get(&before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	p->run();
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	os_stats_get(&after);
+
+	size_t copied = after.realloc_copied - before.realloc_copied;
+	double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+
+	printf("%-10s %9lu %9lu %8lu %10zu %10zu %10zu %6.1f %6lu %6lu %6lu %9.1f\n", p->name,
+		   after.realloc_calls - before.realloc_calls, after.realloc_in_place - before.realloc_in_place,
+		   after.realloc_moves - before.realloc_moves, copied / 1024,
+		   (after.realloc_remapped - before.realloc_remapped) / 1024, naive_copied / 1024,
+		   naive_copied ? 100.0 * (naive_copied - copied) / naive_copied : 0,
+		   after.sbrk_calls - before.sbrk_calls, after.mmap_calls - before.mmap_calls,
+		   after.munmap_calls - before.munmap_calls, ms);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	// Let the libc heap claim its share of the program break before libosmem does.
+	mallopt(M_TOP_PAD, 1 << 20);
+	free(malloc(1));
+
+	while ((opt = getopt(argc, argv, "r:s:")) != -1) {
+		switch (opt) {
+		case 'r':
+			reps = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			rng = strtoul(optarg, NULL, 0) | 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	// The report is made of the allocator counters.
+	osmem_conf_parse("stats:true");
+
+	printf("%-10s %9s %9s %8s %10s %10s %10s %6s %6s %6s %6s %9s\n", "pattern", "reallocs", "in place",
+		   "moved", "copied kb", "remap kb", "naive kb", "saved%", "sbrk", "mmap", "munmap", "ms");
+
+	for (size_t i = 0; i < NR_PATTERNS; i++) {
+		int selected = (optind == argc);
+
+		for (int j = optind; j < argc; j++)
+			if (!strcmp(argv[j], patterns[i].name))
+				selected = 1;
+		if (selected)
+			run(&patterns[i]);
+	}
+	return EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s [-r reps] [-s seed] [pattern ...]\n", argv[0]);
+	return EXIT_FAILURE;
+}
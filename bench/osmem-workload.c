@@ -0,0 +1,618 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Synthetic workload generator: replays reproducible allocation streams, described
+// by a small config file, against libosmem and reports the throughput.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "osmem.h"
+#include "block_meta.h"
+
+#define MAX_EMPIRICAL 64
+#define MAX_THREADS 256
+
+// Call latency histogram: 8 linear buckets per power of two of nanoseconds.
+#define LAT_SUB 8
+#define LAT_BUCKETS (64 * LAT_SUB)
+
+// Distribution of object sizes(bytes) or lifetimes(allocations of the owner thread).
+struct dist {
+	enum { DIST_FIXED, DIST_UNIFORM, DIST_EXPONENTIAL, DIST_LOGNORMAL, DIST_BIMODAL,
+		   DIST_EMPIRICAL } type;
+	double a, b, p;
+	int n;
+	double values[MAX_EMPIRICAL];
+	double weights[MAX_EMPIRICAL];
+};
+
+struct workload {
+	unsigned long seed;
+	unsigned long ops;
+	int threads;
+	struct dist size;
+	struct dist lifetime;
+	double realloc_ratio;
+	double calloc_ratio;
+	double cross_free;
+	size_t max_size;
+	int touch;
+};
+
+// Live object, kept in a min-heap ordered by its time of death.
+struct object {
+	unsigned long death;
+	void *ptr;
+	size_t size;
+	unsigned long id;
+	int remote;
+};
+
+struct worker {
+	pthread_t thread;
+	int index;
+	unsigned long rng[2];
+	struct object *heap;
+	unsigned long live, cap;
+	unsigned long next_id;
+	_Atomic(void *) inbox;	/* objects freed here by other threads, chained through the payload */
+	unsigned long mallocs, callocs, reallocs, frees, remote_frees;
+	unsigned long *lat;	/* call latency histogram, with -l */
+	unsigned long lat_max;
+};
+
+static struct workload wl = {
+	.seed = 1, .ops = 1000000, .threads = 1,
+	.size = {.type = DIST_LOGNORMAL, .a = 5, .b = 1},
+	.lifetime = {.type = DIST_EXPONENTIAL, .a = 1000},
+	.max_size = 64 << 20,
+};
+
+static struct worker *workers;
+static pthread_barrier_t barrier;
+static FILE *trace;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int latency;
+
+// Runs an allocator call, recording its duration when latencies are measured.
+#define TIMED(w, call)									\
+	do {										\
+		unsigned long start_ns = latency ? now_ns() : 0;			\
+		call;									\
+		if (latency)								\
+			lat_record(w, now_ns() - start_ns);				\
+	} while (0)
+
+// Bookkeeping lives in private mappings: libosmem owns the program break.
+static void *bench_alloc(size_t size)
+{
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	DIE(addr == MAP_FAILED, "mmap");
+	return addr;
+}
+
+// xorshift128+ generator, seeded per thread with splitmix64.
+static unsigned long rng_next(unsigned long *s)
+{
+	unsigned long x = s[0], y = s[1];
+
+	s[0] = y;
+	x ^= x << 23;
+	s[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+	return s[1] + y;
+}
+
+static void rng_seed(unsigned long *s, unsigned long seed)
+{
+	for (int i = 0; i < 2; i++) {
+		unsigned long z = (seed += 0x9e3779b97f4a7c15UL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+		s[i] = z ^ (z >> 31);
+	}
+}
+
+static double rng_double(unsigned long *s)
+{
+	return (rng_next(s) >> 11) * 0x1.0p-53;
+}
+
+static double rng_normal(unsigned long *s)
+{
+	double u = rng_double(s), v = rng_double(s);
+
+	return sqrt(-2 * log(u + 0x1.0p-53)) * cos(2 * M_PI * v);
+}
+
+static double dist_sample(struct dist *d, unsigned long *s)
+{
+	switch (d->type) {
+	case DIST_FIXED:
+		return d->a;
+	case DIST_UNIFORM:
+		return d->a + (d->b - d->a) * rng_double(s);
+	case DIST_EXPONENTIAL:
+		return -d->a * log(1 - rng_double(s));
+	case DIST_LOGNORMAL:
+		return exp(d->a + d->b * rng_normal(s));
+	case DIST_BIMODAL:
+		return rng_double(s) < d->p ? d->a : d->b;
+	case DIST_EMPIRICAL: {
+		double r = rng_double(s) * d->weights[d->n - 1];
+		int i = 0;
+
+		while ((i < d->n - 1) && (d->weights[i] <= r))
+			i++;
+		return d->values[i];
+	}
+	}
+	return 0;
+}
+
+static size_t parse_size(const char *str)
+{
+	char *end;
+	double size = strtod(str, &end);
+
+	switch (*end) {
+	case 'g':
+		size *= 1024;
+		/* fallthrough */
+	case 'm':
+		size *= 1024;
+		/* fallthrough */
+	case 'k':
+		size *= 1024;
+	}
+	return size;
+}
+
+// Parses "<type> <params>"; empirical pairs are "<value>:<weight>".
+static int parse_dist(struct dist *d, char *str)
+{
+	char *type = strtok(str, " \t");
+	char *args[MAX_EMPIRICAL];
+	int n = 0;
+
+	memset(d, 0, sizeof(*d));
+	while ((n < MAX_EMPIRICAL) && (args[n] = strtok(NULL, " \t")))
+		n++;
+	if (!type)
+		return -1;
+
+	if (!strcmp(type, "fixed") && (n == 1)) {
+		d->type = DIST_FIXED;
+		d->a = parse_size(args[0]);
+	} else if (!strcmp(type, "uniform") && (n == 2)) {
+		d->type = DIST_UNIFORM;
+		d->a = parse_size(args[0]);
+		d->b = parse_size(args[1]);
+	} else if (!strcmp(type, "exponential") && (n == 1)) {
+		d->type = DIST_EXPONENTIAL;
+		d->a = parse_size(args[0]);
+	} else if (!strcmp(type, "lognormal") && (n == 2)) {
+		d->type = DIST_LOGNORMAL;
+		d->a = atof(args[0]);
+		d->b = atof(args[1]);
+	} else if (!strcmp(type, "bimodal") && (n == 3)) {
+		d->type = DIST_BIMODAL;
+		d->a = parse_size(args[0]);
+		d->b = parse_size(args[1]);
+		d->p = atof(args[2]);
+	} else if (!strcmp(type, "empirical") && n) {
+		d->type = DIST_EMPIRICAL;
+		d->n = n;
+		for (int i = 0; i < n; i++) {
+			char *weight = strchr(args[i], ':');
+
+			d->values[i] = parse_size(args[i]);
+			d->weights[i] = (weight ? atof(weight + 1) : 1) + (i ? d->weights[i - 1] : 0);
+		}
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_config(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char line[1024];
+	int nr = 0;
+
+	if (!file) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		char *key = line, *value = strchr(line, '=');
+		int ret = 0;
+
+		nr++;
+		line[strcspn(line, "#\n")] = '\0';
+		if (!value) {
+			if (line[strspn(line, " \t")]) {
+				fprintf(stderr, "%s:%d: expected <key> = <value>\n", path, nr);
+				ret = -1;
+			}
+			if (ret)
+				goto err;
+			continue;
+		}
+
+		*value++ = '\0';
+		key[strcspn(key, " \t")] = '\0';
+		value += strspn(value, " \t");
+
+		if (!strcmp(key, "seed"))
+			wl.seed = strtoul(value, NULL, 0);
+		else if (!strcmp(key, "ops"))
+			wl.ops = parse_size(value);
+		else if (!strcmp(key, "threads"))
+			wl.threads = atoi(value);
+		else if (!strcmp(key, "size"))
+			ret = parse_dist(&wl.size, value);
+		else if (!strcmp(key, "lifetime"))
+			ret = parse_dist(&wl.lifetime, value);
+		else if (!strcmp(key, "realloc"))
+			wl.realloc_ratio = atof(value);
+		else if (!strcmp(key, "calloc"))
+			wl.calloc_ratio = atof(value);
+		else if (!strcmp(key, "cross_free"))
+			wl.cross_free = atof(value);
+		else if (!strcmp(key, "max_size"))
+			wl.max_size = parse_size(value);
+		else if (!strcmp(key, "touch"))
+			wl.touch = atoi(value);
+		else
+			ret = -1;
+
+		if (ret) {
+			fprintf(stderr, "%s:%d: invalid setting '%s'\n", path, nr, key);
+			goto err;
+		}
+	}
+	fclose(file);
+
+	if ((wl.threads < 1) || (wl.threads > MAX_THREADS)) {
+		fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+		return -1;
+	}
+	return 0;
+err:
+	fclose(file);
+	return -1;
+}
+
+static void trace_op(const char *fmt, ...)
+{
+	va_list args;
+
+	if (!trace)
+		return;
+
+	va_start(args, fmt);
+	pthread_mutex_lock(&trace_lock);
+	vfprintf(trace, fmt, args);
+	pthread_mutex_unlock(&trace_lock);
+	va_end(args);
+}
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void lat_record(struct worker *w, unsigned long ns)
+{
+	int msb = ns ? 63 - __builtin_clzl(ns) : 0;
+	int bucket = (msb < 3) ? (int)ns : msb * LAT_SUB + (int)((ns >> (msb - 3)) & (LAT_SUB - 1));
+
+	w->lat[bucket]++;
+	if (ns > w->lat_max)
+		w->lat_max = ns;
+}
+
+// Smallest latency of a histogram bucket.
+static unsigned long lat_value(int bucket)
+{
+	if (bucket < LAT_SUB)
+		return bucket;
+	return (unsigned long)(LAT_SUB + bucket % LAT_SUB) << (bucket / LAT_SUB - 3);
+}
+
+static unsigned long lat_percentile(unsigned long *hist, unsigned long total, double p)
+{
+	unsigned long seen = 0;
+
+	for (int i = 0; i < LAT_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen >= p * total)
+			return lat_value(i);
+	}
+	return 0;
+}
+
+static size_t draw_size(struct worker *w)
+{
+	double size = dist_sample(&wl.size, w->rng);
+
+	if (size < 1)
+		return 1;
+	return size > wl.max_size ? wl.max_size : (size_t)size;
+}
+
+static void touch(void *ptr, size_t size)
+{
+	if (wl.touch)
+		memset(ptr, 0xa5, size);
+	else
+		*(volatile char *)ptr = 0;
+}
+
+static void heap_push(struct worker *w, struct object *obj)
+{
+	unsigned long i = w->live++;
+
+	if (w->live > w->cap) {
+		struct object *heap = bench_alloc(2 * w->cap * sizeof(*heap));
+
+		memcpy(heap, w->heap, w->cap * sizeof(*heap));
+		munmap(w->heap, w->cap * sizeof(*heap));
+		w->heap = heap;
+		w->cap *= 2;
+	}
+
+	while (i && (w->heap[(i - 1) / 2].death > obj->death)) {
+		w->heap[i] = w->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	w->heap[i] = *obj;
+}
+
+static struct object heap_pop(struct worker *w)
+{
+	struct object top = w->heap[0], last = w->heap[--w->live];
+	unsigned long i = 0;
+
+	for (;;) {
+		unsigned long child = 2 * i + 1;
+
+		if (child >= w->live)
+			break;
+		if ((child + 1 < w->live) && (w->heap[child + 1].death < w->heap[child].death))
+			child++;
+		if (last.death <= w->heap[child].death)
+			break;
+		w->heap[i] = w->heap[child];
+		i = child;
+	}
+	w->heap[i] = last;
+	return top;
+}
+
+// Hands an object over to another thread, which frees it.
+static void send_remote(struct worker *w, struct object *obj)
+{
+	int target = (w->index + 1 + rng_next(w->rng) % (wl.threads - 1)) % wl.threads;
+	struct worker *t = &workers[target];
+	void *head = atomic_load(&t->inbox);
+
+	*(unsigned long *)obj->ptr = obj->id;
+	do {
+		((void **)obj->ptr)[1] = head;
+	} while (!atomic_compare_exchange_weak(&t->inbox, &head, obj->ptr));
+}
+
+// Objects sent by other threads carry their id in the first word and the link in the second.
+static void drain_inbox(struct worker *w)
+{
+	void *ptr = atomic_exchange(&w->inbox, NULL);
+
+	while (ptr) {
+		void *next = ((void **)ptr)[1];
+
+		trace_op("f %lu\n", *(unsigned long *)ptr);
+		TIMED(w, os_free(ptr));
+		w->remote_frees++;
+		ptr = next;
+	}
+}
+
+static void release(struct worker *w, struct object *obj, int final)
+{
+	if (obj->remote && !final && (obj->size >= 2 * sizeof(void *))) {
+		send_remote(w, obj);
+		return;
+	}
+	trace_op("f %lu\n", obj->id);
+	TIMED(w, os_free(obj->ptr));
+	w->frees++;
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+
+	pthread_barrier_wait(&barrier);
+
+	for (unsigned long tick = 0; tick < wl.ops; tick++) {
+		if (wl.threads > 1)
+			drain_inbox(w);
+
+		while (w->live && (w->heap[0].death <= tick)) {
+			struct object obj = heap_pop(w);
+
+			release(w, &obj, 0);
+		}
+
+		if (w->live && (rng_double(w->rng) < wl.realloc_ratio)) {
+			struct object *obj = &w->heap[rng_next(w->rng) % w->live];
+			size_t size = draw_size(w);
+
+			trace_op("r %lu %zu\n", obj->id, size);
+			TIMED(w, obj->ptr = os_realloc(obj->ptr, size));
+			obj->size = size;
+			touch(obj->ptr, size);
+			w->reallocs++;
+			continue;
+		}
+
+		struct object obj = {
+			.size = draw_size(w),
+			.id = w->next_id++,
+			.death = tick + 1 + (unsigned long)dist_sample(&wl.lifetime, w->rng),
+			.remote = (wl.threads > 1) && (rng_double(w->rng) < wl.cross_free),
+		};
+
+		if (rng_double(w->rng) < wl.calloc_ratio) {
+			trace_op("c %lu 1 %zu\n", obj.id, obj.size);
+			TIMED(w, obj.ptr = os_calloc(1, obj.size));
+			w->callocs++;
+		} else {
+			trace_op("m %lu %zu\n", obj.id, obj.size);
+			TIMED(w, obj.ptr = os_malloc(obj.size));
+			w->mallocs++;
+		}
+		touch(obj.ptr, obj.size);
+		heap_push(w, &obj);
+	}
+
+	while (w->live) {
+		struct object obj = heap_pop(w);
+
+		release(w, &obj, 1);
+	}
+
+	// Wait for the last remote frees.
+	pthread_barrier_wait(&barrier);
+	drain_inbox(w);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *trace_path = NULL;
+	long seed = -1;
+	int opt;
+
+	// Let the libc heap claim its share of the program break before libosmem does.
+	mallopt(M_TOP_PAD, 1 << 20);
+	free(malloc(1));
+
+	while ((opt = getopt(argc, argv, "ls:t:")) != -1) {
+		switch (opt) {
+		case 's':
+			seed = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		case 'l':
+			latency = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1)
+		goto usage;
+	if (parse_config(argv[optind]))
+		return EXIT_FAILURE;
+	if (seed >= 0)
+		wl.seed = seed;
+
+	if (trace_path) {
+		trace = fopen(trace_path, "w");
+		if (!trace) {
+			perror(trace_path);
+			return EXIT_FAILURE;
+		}
+	}
+
+	workers = bench_alloc(wl.threads * sizeof(*workers));
+	pthread_barrier_init(&barrier, NULL, wl.threads + 1);
+	for (int i = 0; i < wl.threads; i++) {
+		struct worker *w = &workers[i];
+
+		w->index = i;
+		w->cap = 1024;
+		w->heap = bench_alloc(w->cap * sizeof(*w->heap));
+		if (latency)
+			w->lat = bench_alloc(LAT_BUCKETS * sizeof(*w->lat));
+		w->next_id = ((unsigned long)i + 1) << 40;
+		rng_seed(w->rng, wl.seed + i);
+		DIE(pthread_create(&w->thread, NULL, run_worker, w), "pthread_create");
+	}
+
+	struct timespec start, stop;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	unsigned long mallocs = 0, callocs = 0, reallocs = 0, frees = 0, remote_frees = 0;
+
+	for (int i = 0; i < wl.threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		mallocs += workers[i].mallocs;
+		callocs += workers[i].callocs;
+		reallocs += workers[i].reallocs;
+		frees += workers[i].frees;
+		remote_frees += workers[i].remote_frees;
+	}
+	if (trace)
+		fclose(trace);
+
+	double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+	unsigned long ops = mallocs + callocs + reallocs + frees + remote_frees;
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("threads      %d\n", wl.threads);
+	printf("malloc       %lu\n", mallocs);
+	printf("calloc       %lu\n", callocs);
+	printf("realloc      %lu\n", reallocs);
+	printf("free         %lu\n", frees);
+	printf("remote free  %lu\n", remote_frees);
+	printf("seconds      %.3f\n", seconds);
+	printf("ops/s        %.0f\n", ops / seconds);
+	printf("ns/op        %.1f\n", seconds * 1e9 * wl.threads / ops);
+	printf("max rss kb   %ld\n", usage.ru_maxrss);
+
+	if (latency) {
+		unsigned long *hist = bench_alloc(LAT_BUCKETS * sizeof(*hist));
+		unsigned long max = 0;
+
+		for (int i = 0; i < wl.threads; i++) {
+			for (int b = 0; b < LAT_BUCKETS; b++)
+				hist[b] += workers[i].lat[b];
+			if (workers[i].lat_max > max)
+				max = workers[i].lat_max;
+		}
+		printf("p50 ns       %lu\n", lat_percentile(hist, ops, 0.5));
+		printf("p99 ns       %lu\n", lat_percentile(hist, ops, 0.99));
+		printf("p99.9 ns     %lu\n", lat_percentile(hist, ops, 0.999));
+		printf("max ns       %lu\n", max);
+	}
+	return EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s [-l] [-s seed] [-t trace] config\n", argv[0]);
+	return EXIT_FAILURE;
+}
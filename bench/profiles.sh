@@ -0,0 +1,35 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Runs every workload under the default configuration and every profile and
+# prints one line per run: throughput, call latency percentiles, peak RSS and
+# the heap size left at exit.
+#
+#   ./bench/profiles.sh [workload.conf ...]
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+export LD_LIBRARY_PATH="$BENCH_DIR/../src${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+
+make -s -C "$BENCH_DIR" || exit 1
+
+[ $# -eq 0 ] && set -- "$BENCH_DIR"/workloads/*.conf
+
+printf "%-12s %-11s %10s %8s %8s %8s %10s %10s\n" \
+	"workload" "profile" "ops/s" "p50 ns" "p99 ns" "p99.9 ns" "rss kb" "heap"
+
+for conf in "$@"; do
+	for profile in default footprint throughput latency; do
+		[ "$profile" = default ] && env_profile= || env_profile=$profile
+		out=$(OSMEM_PROFILE=$env_profile OSMEM_PRINT_STATS=1 \
+			"$BENCH_DIR/osmem-workload" -l "$conf" 2>&1) || {
+			printf "%-12s %-11s failed\n" "$(basename "$conf" .conf)" "$profile"
+			continue
+		}
+		field() { echo "$out" | awk -v key="$1" 'index($0, key) == 1 { print $NF }'; }
+		heap=$(echo "$out" | awk '/^osmem: sbrk/ { for (i = 1; i < NF; i++) if ($i == "heap") print $(i + 1) }')
+
+		printf "%-12s %-11s %10s %8s %8s %8s %10s %10s\n" "$(basename "$conf" .conf)" "$profile" \
+			"$(field "ops/s")" "$(field "p50 ns")" "$(field "p99 ns")" "$(field "p99.9 ns")" \
+			"$(field "max rss kb")" "$heap"
+	done
+done
@@ -0,0 +1,425 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Runtime configuration, read once when the library is loaded from
+// OSMEM_CONF="key:value,key:value" and then from the OSMEM_<KEY> variables,
+// which take precedence.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+// Longest OSMEM_CONF string and single value accepted.
+#define CONF_MAX 4096
+#define VALUE_MAX 512
+
+// Largest size accepted for a size option.
+#define SIZE_MAX_CONF (1UL << 40)
+
+// Largest thread cache depth.
+#define DEPTH_MAX 65536
+
+// Addresses are page aligned and below the top of the user address space.
+#define ADDRESS_ALIGN 4096
+#define ADDRESS_MAX (1UL << 47)
+
+// Largest heap growth percentage.
+#define RATIO_MAX 1000
+
+// Longest duration, an hour in milliseconds.
+#define MSEC_MAX 3600000
+
+enum conf_type {
+	CONF_SIZE,
+	CONF_PAGES,
+	CONF_RATIO,
+	CONF_BOOL,
+	CONF_POLICY,
+	CONF_CLASSES,
+	CONF_DEPTHS,
+	CONF_PATH,
+	CONF_PROFILE,
+	CONF_ADDRESS,
+	CONF_MSEC,
+};
+
+struct conf_key {
+	const char *name;
+	enum conf_type type;
+	size_t offset;
+	size_t min;
+	int before_heap;	/* only accepted until the heap is set up */
+};
+
+#define CONF_FIELD(field) offsetof(struct osmem_conf, field)
+
+static const struct conf_key conf_keys[] = {
+	{"profile",		CONF_PROFILE,	0,				0,	0},
+	{"mmap_threshold",	CONF_SIZE,	CONF_FIELD(mmap_threshold),	ALIGNMENT,	0},
+	{"span_max",		CONF_SIZE,	CONF_FIELD(span_max),		0,	0},
+	{"realloc_remap",	CONF_SIZE,	CONF_FIELD(realloc_remap),	0,	0},
+	{"calloc_threshold",	CONF_SIZE,	CONF_FIELD(calloc_threshold),	ALIGNMENT,	0},
+	{"calloc_heap",		CONF_BOOL,	CONF_FIELD(calloc_heap),	0,	0},
+	{"prealloc_size",	CONF_SIZE,	CONF_FIELD(prealloc_size),	2 * META_DATA_SIZE,	0},
+	{"grow_step",		CONF_SIZE,	CONF_FIELD(grow_step),		0,	0},
+	{"top_chunk",		CONF_SIZE,	CONF_FIELD(top_chunk),		0,	0},
+	{"fit_policy",		CONF_POLICY,	CONF_FIELD(fit_policy),		0,	0},
+	{"grow_ratio",		CONF_RATIO,	CONF_FIELD(grow_ratio),		0,	0},
+	{"trim_threshold",	CONF_SIZE,	CONF_FIELD(trim_threshold),	0,	0},
+	{"top_pad",		CONF_SIZE,	CONF_FIELD(top_pad),		0,	0},
+	{"lazy_coalesce",	CONF_BOOL,	CONF_FIELD(lazy_coalesce),	0,	0},
+	{"prefault",		CONF_BOOL,	CONF_FIELD(prefault),		0,	0},
+	{"deferred_free",	CONF_BOOL,	CONF_FIELD(deferred_free),	0,	0},
+	{"pool_mesh",		CONF_BOOL,	CONF_FIELD(pool_mesh),		0,	0},
+	{"pinned_memlock",	CONF_BOOL,	CONF_FIELD(pinned_memlock),	0,	0},
+	{"site_groups",		CONF_BOOL,	CONF_FIELD(site_groups),	0,	0},
+	{"heap_memfd",		CONF_BOOL,	CONF_FIELD(heap_memfd),		0,	1},
+	{"heap_reserve",	CONF_PAGES,	CONF_FIELD(heap_reserve),	4096,	1},
+	{"fixed_base",		CONF_ADDRESS,	CONF_FIELD(fixed_base),		0,	1},
+	{"size_classes",	CONF_CLASSES,	CONF_FIELD(classes),		0,	0},
+	{"tcache_depths",	CONF_DEPTHS,	CONF_FIELD(tcache_depth),	0,	0},
+	{"tcache_idle_ms",	CONF_MSEC,	CONF_FIELD(tcache_idle_ms),	0,	0},
+	{"tcache_budget",	CONF_SIZE,	CONF_FIELD(tcache_budget),	0,	0},
+	{"stats",		CONF_BOOL,	CONF_FIELD(stats),		0,	0},
+	{"print_stats",		CONF_BOOL,	CONF_FIELD(print_stats),	0,	0},
+	{"print_conf",		CONF_BOOL,	CONF_FIELD(print_conf),		0,	0},
+	{"trace",		CONF_PATH,	CONF_FIELD(trace),		0,	0},
+};
+
+#define NR_CONF_KEYS (sizeof(conf_keys) / sizeof(conf_keys[0]))
+
+static const char * const policy_names[] = {"best", "first", "next"};
+
+// Size classes shared by the profiles that enable the thread cache.
+#define PROFILE_CLASSES "size_classes:16/32/48/64/96/128/192/256/384/512/768/1024/1536/2048/3072/4096"
+
+struct conf_profile {
+	const char *name;
+	const char *conf;
+};
+
+// Trade-offs measured with bench/profiles.sh(see README).
+static const struct conf_profile conf_profiles[] = {
+	// Smallest resident heap: no cached blocks, the free heap top goes back
+	// to the system and medium blocks are mapped so they are unmapped on free.
+	{"footprint", "prealloc_size:16k,mmap_threshold:64k,grow_step:0,grow_ratio:0,"
+		"trim_threshold:64k,top_pad:0,size_classes:none,lazy_coalesce:0,prefault:0,deferred_free:0"},
+	// Fewest instructions per call: deep thread caches, first fit over blocks
+	// merged only when needed and a heap growing with its size.
+	{"throughput", "prealloc_size:1m,mmap_threshold:1m,grow_step:64k,grow_ratio:50,"
+		"trim_threshold:0,fit_policy:first," PROFILE_CLASSES ",tcache_depths:64,"
+		"lazy_coalesce:1,prefault:0,deferred_free:0"},
+	// Bounded call times: a large prefaulted heap grown in big steps, frees never
+	// wait for the heap lock and blocks up to 1 MB never go through mmap/munmap.
+	{"latency", "prealloc_size:8m,mmap_threshold:1m,grow_step:1m,grow_ratio:0,"
+		"trim_threshold:0,fit_policy:first," PROFILE_CLASSES ",tcache_depths:32,"
+		"lazy_coalesce:1,prefault:1,deferred_free:1"},
+};
+
+#define NR_CONF_PROFILES (sizeof(conf_profiles) / sizeof(conf_profiles[0]))
+
+// Parses a size with an optional k, m or g suffix; returns -1 on error.
+static int parse_size(const char *str, size_t *size)
+{
+	char *end;
+	unsigned long long value = strtoull(str, &end, 0);
+	int shift = 0;
+
+	if ((end == str) || (*str == '-'))
+		return -1;
+
+	switch (*end) {
+	case 'g':
+	case 'G':
+		shift += 10;
+		/* fallthrough */
+	case 'm':
+	case 'M':
+		shift += 10;
+		/* fallthrough */
+	case 'k':
+	case 'K':
+		shift += 10;
+		end++;
+	}
+	if (*end || (value > (SIZE_MAX_CONF >> shift)))
+		return -1;
+
+	*size = value << shift;
+	return 0;
+}
+
+// Parses "a/b/c" into at most OSMEM_MAX_CLASSES sizes; returns the count or -1.
+static int parse_list(char *str, size_t *values)
+{
+	char *save = NULL;
+	int n = 0;
+
+	for (char *tok = strtok_r(str, "/", &save); tok; tok = strtok_r(NULL, "/", &save)) {
+		if ((n == OSMEM_MAX_CLASSES) || parse_size(tok, &values[n]))
+			return -1;
+		n++;
+	}
+	return n;
+}
+
+// Validates and stores one option; returns -1 if the value is rejected.
+static int conf_set(const struct conf_key *key, char *value)
+{
+	void *field = (void *)&osmem_conf + key->offset;
+	size_t values[OSMEM_MAX_CLASSES];
+	size_t size;
+	int n;
+
+	// The heap source and the address space reserved are fixed by the first
+	// allocation that needs them.
+	if (key->before_heap && (heap_started() || fixed_reserved()))
+		return -1;
+
+	switch (key->type) {
+	case CONF_SIZE:
+		if (parse_size(value, &size) || (size < key->min))
+			return -1;
+		// Heap extensions keep the 8-byte alignment of the blocks.
+		*(size_t *)field = SIZE_ALIGN(size);
+		return 0;
+
+	case CONF_PAGES:
+		if (parse_size(value, &size) || (size < key->min))
+			return -1;
+		// Reservations are whole pages: the mapping area of the window starts on one.
+		*(size_t *)field = (size + getpagesize() - 1) & ~((size_t)getpagesize() - 1);
+		return 0;
+
+	case CONF_RATIO:
+		if (parse_size(value, &size) || (size > RATIO_MAX))
+			return -1;
+		*(unsigned int *)field = size;
+		return 0;
+
+	case CONF_MSEC:
+		if (parse_size(value, &size) || (size > MSEC_MAX))
+			return -1;
+		*(unsigned int *)field = size;
+		return 0;
+
+	case CONF_BOOL:
+		if (!strcmp(value, "true") || !strcmp(value, "1"))
+			*(int *)field = 1;
+		else if (!strcmp(value, "false") || !strcmp(value, "0"))
+			*(int *)field = 0;
+		else
+			return -1;
+		return 0;
+
+	case CONF_POLICY:
+		for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+			if (!strcmp(value, policy_names[i])) {
+				*(int *)field = i;
+				return 0;
+			}
+		}
+		return -1;
+
+	case CONF_CLASSES:
+		// "none" disables the size classes and the thread cache.
+		n = strcmp(value, "none") ? parse_list(value, values) : 0;
+		if (n < 0)
+			return -1;
+		for (int i = 0; i < n; i++)
+			if (!values[i] || (i && (SIZE_ALIGN(values[i]) <= SIZE_ALIGN(values[i - 1]))))
+				return -1;
+		for (int i = 0; i < n; i++)
+			osmem_conf.classes[i] = SIZE_ALIGN(values[i]);
+		osmem_conf.nr_classes = n;
+		return 0;
+
+	case CONF_DEPTHS:
+		// A single depth applies to every class, a list to the classes in order.
+		n = parse_list(value, values);
+		if (n <= 0)
+			return -1;
+		for (int i = 0; i < n; i++)
+			if (values[i] > DEPTH_MAX)
+				return -1;
+		for (int i = 0; i < OSMEM_MAX_CLASSES; i++)
+			osmem_conf.tcache_depth[i] = values[i < n ? i : n - 1];
+		return 0;
+
+	case CONF_PATH:
+		if (strlen(value) >= OSMEM_PATH_MAX)
+			return -1;
+		strcpy(field, value);
+		return 0;
+
+	case CONF_PROFILE:
+		return osmem_conf_profile(value) ? -1 : 0;
+
+	case CONF_ADDRESS: {
+		char *end;
+		unsigned long long address = strtoull(value, &end, 0);
+
+		if ((end == value) || *end || (*value == '-') || (address % ADDRESS_ALIGN) || (address >= ADDRESS_MAX))
+			return -1;
+		*(unsigned long *)field = address;
+		return 0;
+	}
+	}
+	return -1;
+}
+
+static const struct conf_key *conf_find(const char *name)
+{
+	for (size_t i = 0; i < NR_CONF_KEYS; i++)
+		if (!strcmp(conf_keys[i].name, name))
+			return &conf_keys[i];
+	return NULL;
+}
+
+int osmem_conf_parse(const char *conf)
+{
+	char buf[CONF_MAX];
+	char *save = NULL;
+	int errors = 0;
+
+	if (strlen(conf) >= sizeof(buf)) {
+		osmem_log("osmem: configuration string too long\n");
+		return 1;
+	}
+	strcpy(buf, conf);
+
+	for (char *pair = strtok_r(buf, ",", &save); pair; pair = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(pair, ':');
+		const struct conf_key *key;
+
+		if (value)
+			*value++ = '\0';
+		key = conf_find(pair);
+
+		if (!key || !value || conf_set(key, value)) {
+			osmem_log("osmem: invalid conf pair '%s%s%s'\n", pair, value ? ":" : "", value ? value : "");
+			errors++;
+		}
+	}
+	tcache_index_build();
+	return errors;
+}
+
+int osmem_conf_profile(const char *name)
+{
+	for (size_t i = 0; i < NR_CONF_PROFILES; i++)
+		if (!strcmp(conf_profiles[i].name, name))
+			return osmem_conf_parse(conf_profiles[i].conf) ? -1 : 0;
+	return -1;
+}
+
+// Reads OSMEM_<KEY> for every option but the profile, applied first by osmem_init().
+static void conf_parse_env(void)
+{
+	char name[64], value[VALUE_MAX];
+
+	for (size_t i = 0; i < NR_CONF_KEYS; i++) {
+		size_t len = strlen("OSMEM_");
+
+		strcpy(name, "OSMEM_");
+		for (const char *c = conf_keys[i].name; *c; c++)
+			name[len++] = (*c >= 'a' && *c <= 'z') ? *c - 'a' + 'A' : *c;
+		name[len] = '\0';
+
+		const char *env = getenv(name);
+
+		if (!env || (conf_keys[i].type == CONF_PROFILE))
+			continue;
+		if ((strlen(env) >= sizeof(value)) || (strcpy(value, env), conf_set(&conf_keys[i], value)))
+			osmem_log("osmem: invalid value '%s' for %s\n", env, name);
+	}
+}
+
+// Prints the effective configuration as a reusable OSMEM_CONF string.
+void osmem_conf_print(int fd)
+{
+	char buf[CONF_MAX];
+	int len;
+
+	len = snprintf(buf, sizeof(buf),
+				   "OSMEM_CONF=mmap_threshold:%zu,calloc_threshold:%zu,prealloc_size:%zu,grow_step:%zu,fit_policy:%s",
+				   osmem_conf.mmap_threshold, osmem_conf.calloc_threshold, osmem_conf.prealloc_size,
+				   osmem_conf.grow_step, policy_names[osmem_conf.fit_policy]);
+	len += snprintf(buf + len, sizeof(buf) - len,
+					",grow_ratio:%u,trim_threshold:%zu,top_pad:%zu,lazy_coalesce:%s,prefault:%s,deferred_free:%s",
+					osmem_conf.grow_ratio, osmem_conf.trim_threshold, osmem_conf.top_pad,
+					osmem_conf.lazy_coalesce ? "true" : "false", osmem_conf.prefault ? "true" : "false",
+					osmem_conf.deferred_free ? "true" : "false");
+	if (osmem_conf.top_chunk)
+		len += snprintf(buf + len, sizeof(buf) - len, ",top_chunk:%zu", osmem_conf.top_chunk);
+	if (osmem_conf.span_max)
+		len += snprintf(buf + len, sizeof(buf) - len, ",span_max:%zu", osmem_conf.span_max);
+	if (osmem_conf.realloc_remap)
+		len += snprintf(buf + len, sizeof(buf) - len, ",realloc_remap:%zu", osmem_conf.realloc_remap);
+	if (osmem_conf.calloc_heap)
+		len += snprintf(buf + len, sizeof(buf) - len, ",calloc_heap:true");
+	if (osmem_conf.pool_mesh)
+		len += snprintf(buf + len, sizeof(buf) - len, ",pool_mesh:true");
+	if (osmem_conf.pinned_memlock)
+		len += snprintf(buf + len, sizeof(buf) - len, ",pinned_memlock:true");
+	if (osmem_conf.site_groups)
+		len += snprintf(buf + len, sizeof(buf) - len, ",site_groups:true");
+	if (osmem_conf.heap_memfd)
+		len += snprintf(buf + len, sizeof(buf) - len, ",heap_memfd:true,heap_reserve:%zu",
+						osmem_conf.heap_reserve);
+	else if (osmem_conf.fixed_base)
+		len += snprintf(buf + len, sizeof(buf) - len, ",fixed_base:%#lx,heap_reserve:%zu",
+						osmem_conf.fixed_base, osmem_conf.heap_reserve);
+	if (!osmem_conf.nr_classes)
+		len += snprintf(buf + len, sizeof(buf) - len, ",size_classes:none");
+	else if (osmem_conf.tcache_idle_ms)
+		len += snprintf(buf + len, sizeof(buf) - len, ",tcache_idle_ms:%u", osmem_conf.tcache_idle_ms);
+	if (osmem_conf.nr_classes && osmem_conf.tcache_budget)
+		len += snprintf(buf + len, sizeof(buf) - len, ",tcache_budget:%zu", osmem_conf.tcache_budget);
+
+	for (int i = 0; i < osmem_conf.nr_classes; i++)
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%zu", i ? "/" : ",size_classes:",
+						osmem_conf.classes[i]);
+	for (int i = 0; i < osmem_conf.nr_classes; i++)
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%u", i ? "/" : ",tcache_depths:",
+						osmem_conf.tcache_depth[i]);
+
+	len += snprintf(buf + len, sizeof(buf) - len, ",stats:%s,print_stats:%s,print_conf:%s%s%s\n",
+					osmem_conf.stats ? "true" : "false", osmem_conf.print_stats ? "true" : "false",
+					osmem_conf.print_conf ? "true" : "false", osmem_conf.trace[0] ? ",trace:" : "",
+					osmem_conf.trace);
+
+	if (write(fd, buf, len) < 0)
+		return;
+}
+
+__attribute__((constructor))
+void osmem_init(void)
+{
+	const char *profile = getenv("OSMEM_PROFILE");
+	const char *conf = getenv("OSMEM_CONF");
+
+	if (profile && *profile && osmem_conf_profile(profile))
+		osmem_log("osmem: unknown profile '%s'\n", profile);
+	if (conf)
+		osmem_conf_parse(conf);
+	conf_parse_env();
+	tcache_index_build();
+
+	if (osmem_conf.print_stats)
+		osmem_conf.stats = 1;
+	if (osmem_conf.trace[0])
+		trace_record_open();
+	if (osmem_conf.print_conf)
+		osmem_conf_print(STDERR_FILENO);
+}
+
+__attribute__((destructor))
+void osmem_fini(void)
+{
+	if (osmem_conf.print_stats)
+		os_stats_print();
+	trace_record_flush();
+}
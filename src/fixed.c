@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Deterministic address space.
+//
+// With the "fixed_base" option the allocator reserves a window at that address
+// (MAP_FIXED_NOREPLACE, PROT_NONE) when it first needs memory: the heap grows
+// from the start of the window instead of the program break, and the mappings
+// for blocks and span chunks are placed first fit in the second half, both
+// heap_reserve bytes long. Block addresses then depend only on the sequence of
+// calls, not on ASLR, so benchmarks and trace replays are reproducible.
+//
+// Released pages go back to the reservation. If the window cannot be reserved
+// the allocator runs as usual; if the free ranges table is full, mappings are
+// placed by the kernel.
+//
+// Every function but fixed_reserved() is called with heap_lock held.
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+// Free ranges of the mapping area tracked at once.
+#define FIXED_RANGES 4096
+
+#define RESERVE_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+
+struct fixed_range {
+	void *start;
+	size_t len;
+};
+
+static void *window;		// NULL until reserved
+static int window_failed;
+static size_t heap_len;		// bytes between the window start and the break
+static size_t heap_mapped;	// page aligned prefix of the heap area mapped
+
+// Free ranges of the mapping area, in address order.
+static struct fixed_range ranges[FIXED_RANGES];
+static size_t nr_ranges;
+
+static size_t page_round(size_t len)
+{
+	size_t page_size = (size_t)getpagesize();
+
+	return (len + page_size - 1) & ~(page_size - 1);
+}
+
+// Reserves the window on first use; returns 0 when the window is available.
+int fixed_active(void)
+{
+	size_t len = 2 * osmem_conf.heap_reserve;
+
+	if (window)
+		return 1;
+	if (!osmem_conf.fixed_base || window_failed)
+		return 0;
+
+	void *addr = mmap((void *)osmem_conf.fixed_base, len, PROT_NONE, RESERVE_FLAGS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	// Kernels without MAP_FIXED_NOREPLACE treat the address as a hint.
+	if ((addr != MAP_FAILED) && (addr != (void *)osmem_conf.fixed_base))
+		munmap(addr, len);
+	if (addr != (void *)osmem_conf.fixed_base) {
+		osmem_log("osmem: cannot reserve %zu bytes at %#lx, addresses are not fixed\n", len,
+				  osmem_conf.fixed_base);
+		window_failed = 1;
+		return 0;
+	}
+
+	window = addr;
+	ranges[0].start = window + osmem_conf.heap_reserve;
+	ranges[0].len = osmem_conf.heap_reserve;
+	nr_ranges = 1;
+	return 1;
+}
+
+// Nonzero once the window was reserved, or failed to be.
+int fixed_reserved(void)
+{
+	return window || window_failed;
+}
+
+// sbrk() for the heap area of the window.
+void *fixed_sbrk(intptr_t increment)
+{
+	void *old_brk = window + heap_len;
+
+	if (!increment)
+		return old_brk;
+
+	if ((increment > 0) && (heap_len + increment > osmem_conf.heap_reserve)) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	if ((increment < 0) && ((size_t)-increment > heap_len)) {
+		errno = EINVAL;
+		return (void *)-1;
+	}
+
+	size_t new_len = heap_len + increment;
+	size_t new_mapped = page_round(new_len);
+
+	if (new_mapped > heap_mapped) {
+		if (mmap(window + heap_mapped, new_mapped - heap_mapped, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+			return (void *)-1;
+	} else if (new_mapped < heap_mapped) {
+		if (mmap(window + new_mapped, heap_mapped - new_mapped, PROT_NONE,
+				 RESERVE_FLAGS | MAP_FIXED, -1, 0) == MAP_FAILED)
+			return (void *)-1;
+	}
+
+	heap_len = new_len;
+	heap_mapped = new_mapped;
+	return old_brk;
+}
+
+static int in_map_area(void *addr)
+{
+	return window && (addr >= window + osmem_conf.heap_reserve) &&
+		   (addr < window + 2 * osmem_conf.heap_reserve);
+}
+
+// Takes (len) bytes from the first free range holding them; NULL if none does.
+static void *range_take(size_t len)
+{
+	for (size_t i = 0; i < nr_ranges; i++) {
+		if (ranges[i].len < len)
+			continue;
+
+		void *start = ranges[i].start;
+
+		ranges[i].start += len;
+		ranges[i].len -= len;
+		if (!ranges[i].len) {
+			nr_ranges--;
+			for (size_t j = i; j < nr_ranges; j++)
+				ranges[j] = ranges[j + 1];
+		}
+		return start;
+	}
+	return NULL;
+}
+
+// Gives [start, start + len) back to the free ranges, merged with its neighbours.
+// Returns -1 if the table is full.
+static int range_give(void *start, size_t len)
+{
+	size_t i = 0;
+
+	while ((i < nr_ranges) && (ranges[i].start < start))
+		i++;
+
+	int merge_prev = i && (ranges[i - 1].start + ranges[i - 1].len == start);
+	int merge_next = (i < nr_ranges) && (start + len == ranges[i].start);
+
+	if (merge_prev && merge_next) {
+		ranges[i - 1].len += len + ranges[i].len;
+		nr_ranges--;
+		for (size_t j = i; j < nr_ranges; j++)
+			ranges[j] = ranges[j + 1];
+	} else if (merge_prev) {
+		ranges[i - 1].len += len;
+	} else if (merge_next) {
+		ranges[i].start = start;
+		ranges[i].len += len;
+	} else {
+		if (nr_ranges == FIXED_RANGES)
+			return -1;
+		for (size_t j = nr_ranges; j > i; j--)
+			ranges[j] = ranges[j - 1];
+		ranges[i].start = start;
+		ranges[i].len = len;
+		nr_ranges++;
+	}
+	return 0;
+}
+
+// Puts [start, start + len) of the mapping area back in the reservation.
+static void range_release(void *start, size_t len)
+{
+	DIE(mmap(start, len, PROT_NONE, RESERVE_FLAGS | MAP_FIXED, -1, 0) == MAP_FAILED, "mmap");
+	// A full table leaks the range, which stays reserved.
+	range_give(start, len);
+}
+
+// mmap() of (length) read-write bytes with (flags), in the window when it is active.
+void *map_pages(size_t length, int flags)
+{
+	void *addr = fixed_active() ? range_take(page_round(length)) : NULL;
+
+	if (!addr)
+		return mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+	if (mmap(addr, length, PROT_READ | PROT_WRITE, flags | MAP_FIXED, -1, 0) == MAP_FAILED) {
+		range_give(addr, page_round(length));
+		return MAP_FAILED;
+	}
+	return addr;
+}
+
+// munmap() of pages returned by map_pages() or remap_pages().
+void unmap_pages(void *addr, size_t length)
+{
+	if (in_map_area(addr))
+		range_release(addr, page_round(length));
+	else
+		munmap(addr, length);
+}
+
+// mremap(MREMAP_MAYMOVE) that keeps the pages of the window inside it.
+void *remap_pages(void *addr, size_t old_length, size_t new_length)
+{
+	if (!in_map_area(addr))
+		return mremap(addr, old_length, new_length, MREMAP_MAYMOVE);
+
+	old_length = page_round(old_length);
+	new_length = page_round(new_length);
+
+	// Shrinking never moves: the tail goes back to the reservation.
+	if (new_length <= old_length) {
+		if (new_length < old_length)
+			range_release(addr + new_length, old_length - new_length);
+		return addr;
+	}
+
+	void *target = range_take(new_length);
+
+	if (!target)
+		return MAP_FAILED;
+	if (mremap(addr, old_length, new_length, MREMAP_MAYMOVE | MREMAP_FIXED, target) == MAP_FAILED) {
+		range_give(target, new_length);
+		return MAP_FAILED;
+	}
+	range_release(addr, old_length);
+	return target;
+}
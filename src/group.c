@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Allocation groups: small blocks allocated by os_malloc_group() with the same
+// group id(or, with the "site_groups" option, by os_malloc() from the same call
+// site) are carved from 64 KB regions dedicated to the group, so objects
+// created together sit together in memory instead of being interleaved with
+// unrelated ones by the heap.
+//
+// Group blocks have the heap's header layout with status STATUS_GROUP and prev
+// pointing to their group. A freed group block goes to a per-group list of its
+// size class and is only reused by the same group; regions are never released.
+//
+// group_lock is taken before heap_lock(regions come from the heap), never after.
+
+#include <string.h>
+
+#include "osmem_internal.h"
+
+// Bytes of a group region, below the default mmap threshold.
+#define GROUP_REGION_SIZE (64 * 1024)
+
+// Group blocks are rounded up to a multiple of GROUP_STEP bytes.
+#define GROUP_STEP 16
+#define GROUP_BINS (GROUP_SIZE_MAX / GROUP_STEP)
+#define GROUP_BIN(size) (((size) + GROUP_STEP - 1) / GROUP_STEP - 1)
+
+// Groups in use at once; the requests of further groups are not grouped.
+#define GROUP_MAX 256
+
+struct alloc_group {
+	uintptr_t key;			/* group id + 1, 0 for an unused slot */
+	void *bump;			/* free end of the current region */
+	void *end;
+	TBlock_meta *bins[GROUP_BINS];	/* freed blocks by size class */
+};
+
+static struct alloc_group groups[GROUP_MAX];
+static pthread_mutex_t group_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Open addressing over the group ids(call sites tagged with GROUP_SITE); NULL
+// when every slot is taken.
+static struct alloc_group *group_find(uintptr_t id)
+{
+	uintptr_t key = id + 1;
+	size_t slot = (key * 0x9e3779b97f4a7c15UL) >> 56;
+
+	for (size_t i = 0; i < GROUP_MAX; i++) {
+		struct alloc_group *group = &groups[(slot + i) % GROUP_MAX];
+
+		if (group->key == key)
+			return group;
+		if (!group->key) {
+			group->key = key;
+			return group;
+		}
+	}
+	return NULL;
+}
+
+// Allocates (size) bytes in (group); the caller holds group_lock.
+static void *group_take(struct alloc_group *group, size_t size)
+{
+	size_t bin = GROUP_BIN(size);
+	size_t block_size = (bin + 1) * GROUP_STEP;
+	TBlock_meta *cell = group->bins[bin];
+
+	if (cell) {
+		group->bins[bin] = cell->next;
+	} else {
+		if (group->end - group->bump < (ptrdiff_t)(META_DATA_SIZE + block_size)) {
+			heap_lock_acquire();
+			void *region = malloc_block(GROUP_REGION_SIZE);
+
+			pthread_mutex_unlock(&heap_lock);
+			// Out of memory: the caller falls back to a plain block.
+			if (!region)
+				return NULL;
+			// The tail of the previous region is left unused.
+			group->bump = region;
+			group->end = region + GROUP_REGION_SIZE;
+			STAT_ADD(group_regions, 1);
+		}
+		cell = group->bump;
+		group->bump += META_DATA_SIZE + block_size;
+		cell->prev = (TBlock_meta *)group;
+	}
+	cell->status = STATUS_GROUP;
+	cell->size = block_size;
+	cell->next = NULL;
+	return (void *)cell + META_DATA_SIZE;
+}
+
+void *group_alloc(uintptr_t id, size_t size)
+{
+	void *ptr = NULL;
+
+	pthread_mutex_lock(&group_lock);
+
+	struct alloc_group *group = group_find(id);
+
+	if (group)
+		ptr = group_take(group, size);
+	pthread_mutex_unlock(&group_lock);
+	return ptr;
+}
+
+void *group_alloc_near(TBlock_meta *hint, size_t size)
+{
+	pthread_mutex_lock(&group_lock);
+	void *ptr = group_take((struct alloc_group *)hint->prev, size);
+
+	pthread_mutex_unlock(&group_lock);
+	return ptr;
+}
+
+void group_free(TBlock_meta *cell)
+{
+	struct alloc_group *group = (struct alloc_group *)cell->prev;
+	size_t bin = GROUP_BIN(cell->size);
+
+	pthread_mutex_lock(&group_lock);
+	cell->status = STATUS_FREE;
+	cell->next = group->bins[bin];
+	group->bins[bin] = cell;
+	pthread_mutex_unlock(&group_lock);
+}
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Memory of the meshable pool slabs.
+//
+// With the "pool_mesh" option the slabs of the pools are views of a memfd
+// placed in a reserved address range, each view mapping the file at its own
+// offset at first. Meshing two slabs(pool.c) maps the view of one over the
+// file pages of the other and punches its own pages out of the file: both
+// slabs keep their addresses but share one physical copy.
+//
+// A released view goes back to the reservation and is reused for a slab of the
+// same length; its file pages are holes by then. When the table of released
+// views is full, the view stays reserved and unused.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+// Address space reserved for the views.
+#define MESH_RESERVE (64UL << 30)
+
+// The file is extended by this much at a time; its unused tail takes no memory.
+#define MESH_FILE_STEP (64UL << 20)
+
+// Released views tracked at once.
+#define MESH_FREE_VIEWS 4096
+
+struct mesh_view {
+	void *addr;
+	size_t len;
+};
+
+static int mesh_fd = -1;
+static int mesh_failed;
+static void *mesh_base;		// start of the reserved range
+static size_t mesh_len;		// bytes of the range handed out
+static size_t mesh_file_len;
+
+static struct mesh_view free_views[MESH_FREE_VIEWS];
+static size_t nr_free_views;
+
+static pthread_mutex_t mesh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Creates the file and the reservation on first use; returns -1 if they cannot be.
+int mesh_init(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&mesh_lock);
+	if ((mesh_fd >= 0) || mesh_failed)
+		goto out;
+
+	mesh_fd = memfd_create("osmem-mesh", MFD_CLOEXEC);
+	if (mesh_fd >= 0) {
+		mesh_base = mmap(NULL, MESH_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mesh_base != MAP_FAILED)
+			goto out;
+		close(mesh_fd);
+		mesh_fd = -1;
+	}
+	osmem_log("osmem: cannot set up the mesh arena, pools are not meshable\n");
+	mesh_failed = 1;
+out:
+	ret = (mesh_fd >= 0) ? 0 : -1;
+	pthread_mutex_unlock(&mesh_lock);
+	return ret;
+}
+
+// Offset of the file pages backing (view) until it is meshed.
+size_t mesh_offset(void *view)
+{
+	return view - mesh_base;
+}
+
+// Maps a view of (len) bytes, a multiple of the page size; MAP_FAILED on failure.
+void *mesh_view_map(size_t len)
+{
+	void *view = MAP_FAILED;
+
+	pthread_mutex_lock(&mesh_lock);
+	for (size_t i = 0; i < nr_free_views; i++) {
+		if (free_views[i].len != len)
+			continue;
+		view = free_views[i].addr;
+		free_views[i] = free_views[--nr_free_views];
+		break;
+	}
+
+	if (view == MAP_FAILED) {
+		if (mesh_len + len > MESH_RESERVE) {
+			errno = ENOMEM;
+			goto out;
+		}
+		if (mesh_len + len > mesh_file_len) {
+			size_t file_len = (mesh_len + len + MESH_FILE_STEP - 1) & ~(MESH_FILE_STEP - 1);
+
+			if (ftruncate(mesh_fd, file_len))
+				goto out;
+			mesh_file_len = file_len;
+		}
+		view = mesh_base + mesh_len;
+		mesh_len += len;
+	}
+
+	if (mmap(view, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mesh_fd, mesh_offset(view)) == MAP_FAILED) {
+		if (nr_free_views < MESH_FREE_VIEWS)
+			free_views[nr_free_views++] = (struct mesh_view){view, len};
+		view = MAP_FAILED;
+	}
+out:
+	pthread_mutex_unlock(&mesh_lock);
+	return view;
+}
+
+// Maps (view) over the file pages at (offset).
+void mesh_view_alias(void *view, size_t len, size_t offset)
+{
+	DIE(mmap(view, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mesh_fd, offset) == MAP_FAILED, "mmap");
+}
+
+// Gives the file pages at (offset) back to the system.
+void mesh_pages_release(size_t offset, size_t len)
+{
+	DIE(fallocate(mesh_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len), "fallocate");
+}
+
+// Puts (view) back in the reservation.
+void mesh_view_unmap(void *view, size_t len)
+{
+	DIE(mmap(view, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED,
+		"mmap");
+
+	pthread_mutex_lock(&mesh_lock);
+	if (nr_free_views < MESH_FREE_VIEWS)
+		free_views[nr_free_views++] = (struct mesh_view){view, len};
+	pthread_mutex_unlock(&mesh_lock);
+}
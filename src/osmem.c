@@ -1,31 +1,75 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
+
 // Include helping libraries for syscalls and string operations.
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 
-#include "osmem.h"
-#include "block_meta.h"
-
-// Maximum block size for heap allocation.
-#define BRK_LIMIT (128 * 1024)
+#include "osmem_internal.h"
 
-// Alignment to 8 bytes macro; it returns the smallest multiple of 8 smaller than (size).
-#define ALIGNMENT 8
-#define SIZE_ALIGN(size)  (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+// Build-time tuning(see tools/osmem-advise) overrides the defaults below.
+#ifndef OSMEM_MMAP_THRESHOLD
+#define OSMEM_MMAP_THRESHOLD BRK_LIMIT
+#endif
+#ifndef OSMEM_PREALLOC_SIZE
+#define OSMEM_PREALLOC_SIZE BRK_LIMIT
+#endif
+#ifndef OSMEM_NR_CLASSES
+#define OSMEM_NR_CLASSES 0
+#define OSMEM_SIZE_CLASSES {0}
+#define OSMEM_TCACHE_DEPTHS {0}
+#endif
 
-// Meta_data block size.
-#define META_DATA_SIZE SIZE_ALIGN(sizeof(TBlock_meta))
-
-typedef struct block_meta TBlock_meta;
+// Address space reserved for a memfd heap.
+#define OSMEM_HEAP_RESERVE (64UL << 30)
 
+// Largest heap extension made only to follow the growth ratio.
+#define GROW_RATIO_MAX (64UL << 20)
 
 // Global heads for the block_meta lists.
 // Sentinel lists are used.
 TBlock_meta block_head_brk;
 TBlock_meta block_head_mmap;
 
+pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Tunables used by the allocator.
+struct osmem_conf osmem_conf = {
+	.mmap_threshold = OSMEM_MMAP_THRESHOLD,
+	.calloc_threshold = CALLOC_LIMIT,
+	.prealloc_size = OSMEM_PREALLOC_SIZE,
+	.grow_step = 0,
+	.fit_policy = FIT_BEST,
+	.nr_classes = OSMEM_NR_CLASSES,
+	.classes = OSMEM_SIZE_CLASSES,
+	.tcache_depth = OSMEM_TCACHE_DEPTHS,
+	.heap_reserve = OSMEM_HEAP_RESERVE,
+};
+
+// Cell where the next-fit search resumes(NULL means the first cell).
+TBlock_meta *next_fit_rover;
+
+// Bytes obtained with sbrk and not yet trimmed.
+size_t heap_extent;
+
+// Payloads freed while another thread held heap_lock, chained through their first word.
+void *deferred_frees;
+
+// Heap memory from this address up has never been handed out, so it still holds
+// the zeroes of fresh pages.
+void *heap_dirty_top;
+
+// Top chunk("top_chunk" option): the heap space after the last block, kept out
+// of the block list and carved by moving top_start.
+void *top_start;
+void *top_end;
+
+// Cleared when a walk of the heap finds no free block; while it is, the heap
+// requests the top chunk can hold skip the search.
+int heap_has_free;
+
 
 // HELPFUL FUNCTIONS
 
@@ -50,10 +94,16 @@ void *add_meta_cell_mmap(size_t size)
 
 	size_t total_size = META_DATA_SIZE + SIZE_ALIGN(size);
 
-	void *addr = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | (osmem_conf.prefault ? MAP_POPULATE : 0);
+	void *addr = map_pages(total_size, flags);
 
 	DIE(addr == MAP_FAILED, "mmap");
 
+	STAT_ADD(mmap_calls, 1);
+	STAT_ADD(mapped_size, total_size);
+	if (osmem_conf.stats && (osmem_stats.mapped_size > osmem_stats.peak_mapped_size))
+		osmem_stats.peak_mapped_size = osmem_stats.mapped_size;
+
 	// Initialize the cell.
 	TBlock_meta *cell = (TBlock_meta *)addr;
 
@@ -71,16 +121,113 @@ void *add_meta_cell_mmap(size_t size)
 	return (void *)(addr + META_DATA_SIZE);
 }
 
+// Start of the mapping holding the mapped block (cell); a block moved there by
+// remapping pages(see remap_heap_block) starts inside the first page.
+void *mapping_start(TBlock_meta *cell)
+{
+	return (void *)((uintptr_t)cell & ~((uintptr_t)getpagesize() - 1));
+}
+
 // Deletes the cell from the list and unmap the block.
 void delete_meta_cell_mmap(TBlock_meta *cell)
 {
+	size_t total_size = META_DATA_SIZE + cell->size;
+	void *start = mapping_start(cell);
+
 	cell->prev->next = cell->next;
 	cell->next->prev = cell->prev;
-	munmap((void *)cell, META_DATA_SIZE + cell->size);
+	unmap_pages(start, ((void *)cell - start) + total_size);
+
+	STAT_ADD(munmap_calls, 1);
+	STAT_ADD(mapped_size, -total_size);
+}
+
+// Maps a block of (size) bytes: a span of a super-chunk below span_max, a
+// mapping of its own otherwise.
+void *map_block(size_t size)
+{
+	if (size < osmem_conf.span_max) {
+		void *span = span_alloc(size);
+
+		if (span)
+			return span;
+	}
+	return add_meta_cell_mmap(size);
+}
+
+// Releases a block returned by map_block().
+void unmap_block(TBlock_meta *cell)
+{
+	if (cell->status == STATUS_SPAN)
+		span_free(cell);
+	else
+		delete_meta_cell_mmap(cell);
 }
 
 // HEAP
 
+// Raises heap_dirty_top over the heap block of (payload) and the header of the
+// free block that may follow it.
+void heap_mark_dirty(void *payload)
+{
+	void *end = payload + ((TBlock_meta *)(payload - META_DATA_SIZE))->size + META_DATA_SIZE;
+
+	if (end > heap_dirty_top)
+		heap_dirty_top = end;
+}
+
+// Moves the heap break by (increment) bytes and returns the old break.
+void *heap_sbrk(intptr_t increment)
+{
+	void *old_brk;
+
+	if (osmem_conf.heap_memfd)
+		old_brk = memfd_sbrk(increment);
+	else
+		old_brk = fixed_active() ? fixed_sbrk(increment) : sbrk(increment);
+
+	if (old_brk == (void *)-1)
+		return old_brk;
+
+	heap_extent += increment;
+	// The page the heap starts in may hold data written before it.
+	if (!heap_dirty_top)
+		heap_dirty_top = (void *)(((uintptr_t)old_brk + getpagesize() - 1) & ~(uintptr_t)(getpagesize() - 1));
+	// Whole pages given back come back zeroed, except those a memfd snapshot keeps.
+	if ((increment < 0) && !osmem_conf.heap_memfd) {
+		size_t page_size = (size_t)getpagesize();
+		void *page_end = (void *)(((uintptr_t)old_brk + increment + page_size - 1) & ~(page_size - 1));
+
+		if (heap_dirty_top > page_end)
+			heap_dirty_top = page_end;
+	}
+	STAT_ADD(sbrk_calls, 1);
+	STAT_ADD(heap_size, increment);
+
+	// Fault the new pages in now rather than on their first use.
+	if (osmem_conf.prefault && (increment > 0)) {
+		size_t page_size = (size_t)getpagesize();
+
+		for (size_t off = 0; off < (size_t)increment; off += page_size)
+			*(volatile char *)(old_brk + off) = 0;
+	}
+	return old_brk;
+}
+
+// Returns the current heap break.
+void *heap_top(void)
+{
+	if (osmem_conf.heap_memfd)
+		return memfd_sbrk(0);
+	return fixed_active() ? fixed_sbrk(0) : sbrk(0);
+}
+
+// Nonzero once the heap list exists, i.e. after the first heap allocation.
+int heap_started(void)
+{
+	return block_head_brk.size != 0;
+}
+
 // Initializes the list used to store heap_metadata.
 void init_list_brk(void)
 {
@@ -97,6 +244,8 @@ void *add_meta_cell_brk(TBlock_meta *last_cell, TBlock_meta *cell, size_t size,
 	// Initialize cell fields.
 	cell->status = status;
 	cell->size = SIZE_ALIGN(size);
+	if (status == STATUS_FREE)
+		heap_has_free = 1;
 
 	// Insert the new cell into the list.
 	cell->next = last_cell->next;
@@ -122,13 +271,56 @@ void heap_preallocation(void)
 {
 	// Initialize heap_metadata list.
 	init_list_brk();
+	next_fit_rover = NULL;
 
-	void *heap_start = sbrk(BRK_LIMIT);
+	void *heap_start = heap_sbrk(osmem_conf.prealloc_size);
 
 	DIE(heap_start == (void *)-1, "sbrk");
 
+	// The preallocated space is the first top chunk.
+	if (osmem_conf.top_chunk) {
+		top_start = heap_start;
+		top_end = heap_start + osmem_conf.prealloc_size;
+		return;
+	}
+
 	// Add a free zone that takes the whole prealocate space.
-	add_meta_cell_brk(&block_head_brk, (TBlock_meta *)heap_start, BRK_LIMIT - META_DATA_SIZE, STATUS_FREE);
+	add_meta_cell_brk(&block_head_brk, (TBlock_meta *)heap_start,
+					  osmem_conf.prealloc_size - META_DATA_SIZE, STATUS_FREE);
+}
+
+// Rounds a heap increment up to the configured growth ratio and step.
+size_t grow_size(size_t size)
+{
+	size_t step = osmem_conf.grow_step;
+
+	if (osmem_conf.grow_ratio) {
+		size_t min_size = heap_extent / 100 * osmem_conf.grow_ratio;
+
+		if (min_size > GROW_RATIO_MAX)
+			min_size = GROW_RATIO_MAX;
+		if (size < SIZE_ALIGN(min_size))
+			size = SIZE_ALIGN(min_size);
+	}
+
+	if (!step)
+		return size;
+	return (size + step - 1) / step * step;
+}
+
+// Nonzero when heap extensions may be larger than requested.
+int grow_rounds(void)
+{
+	return osmem_conf.grow_step || osmem_conf.grow_ratio;
+}
+
+// End of the space the heap blocks may take: the break, or the top chunk.
+void *heap_end(void)
+{
+	void *end = osmem_conf.top_chunk ? top_start : heap_top();
+
+	DIE(end == (void *)-1, "sbrk");
+	return end;
 }
 
 // Coalesce all the block from curr_cell upwards.
@@ -140,6 +332,8 @@ void coalesce_block(TBlock_meta *curr_cell)
 	while ((free_curr != &block_head_brk) && (free_curr->status == STATUS_FREE)) {
 		// If the cell is freed, delete it.
 		delete_meta_cell_brk(free_curr);
+		if (free_curr == next_fit_rover)
+			next_fit_rover = curr_cell;
 		free_curr = free_curr->next;
 	}
 	// Update the connection
@@ -149,12 +343,10 @@ void coalesce_block(TBlock_meta *curr_cell)
 	void *start = (void *)curr_cell;
 	void *stop = NULL;
 
-	if (free_curr == &block_head_brk) {
-		stop = sbrk(0); // extend till heap end
-		DIE(stop == (void *)-1, "sbrk");
-	} else {
+	if (free_curr == &block_head_brk)
+		stop = heap_end(); // extend till heap end
+	else
 		stop = (void *)free_curr; // extend till the next block
-	}
 	curr_cell->size = stop - start - META_DATA_SIZE;
 }
 
@@ -163,14 +355,18 @@ void coalesce_blocks(void)
 {
 	// Begin withthe first block.
 	TBlock_meta *curr_cell = block_head_brk.next;
+	int has_free = 0;
 
 	// Search every continuous zones of free blocks.
 	while (curr_cell != &block_head_brk) {
-		if (curr_cell->status == STATUS_FREE)
+		if (curr_cell->status == STATUS_FREE) {
 			coalesce_block(curr_cell);
+			has_free = 1;
+		}
 		// After coalesce the conections are already updated.
 		curr_cell = curr_cell->next;
 	}
+	heap_has_free = has_free;
 }
 
 // Creates free blocks from unused heap space.
@@ -183,8 +379,12 @@ void use_unused_space(void *addr, size_t size_used)
 	// Find the limit of the unused space.
 	if (cell->next != &block_head_brk) {
 		stop = cell->next; // cell bound
+	} else if (osmem_conf.top_chunk) {
+		// The space after the last block goes back to the top chunk.
+		top_start = start;
+		return;
 	} else {
-		stop = sbrk(0); // heap bound
+		stop = heap_top(); // heap bound
 		DIE(stop == (void *)-1, "sbrk");
 	}
 
@@ -195,7 +395,7 @@ void use_unused_space(void *addr, size_t size_used)
 
 // Search for the smallest free block that can hold (size_t size) bytes.
 // If the block doesn't exist, returns NULL.
-void *search_best_fit(size_t size)
+TBlock_meta *find_best_fit(size_t size)
 {
 	// Start with the first block.
 	TBlock_meta *curr_cell = block_head_brk.next;
@@ -213,21 +413,199 @@ void *search_best_fit(size_t size)
 		curr_cell = curr_cell->next;
 	}
 
-	if (best_fit) {
-		// Delete the best_fit old cell.
-		delete_meta_cell_brk(best_fit);
-		// Truncate the block by creating a new smaller block.
-		add_meta_cell_brk(best_fit->prev, best_fit, SIZE_ALIGN(size), STATUS_ALLOC);
-		// Use the remaining space to form a free block(if possible).
-		use_unused_space((void *)best_fit, best_fit->size);
+	return best_fit;
+}
 
-		// Return the payload address.
-		return (void *)((void *)best_fit + META_DATA_SIZE);
+// Search for the first free block between (start) and (stop) that can hold (size_t size) bytes.
+TBlock_meta *find_first_fit(TBlock_meta *start, TBlock_meta *stop, size_t size)
+{
+	TBlock_meta *curr_cell = start;
+
+	while (curr_cell != stop) {
+		if ((curr_cell->status == STATUS_FREE) && (curr_cell->size >= size))
+			return curr_cell;
+		curr_cell = curr_cell->next;
 	}
 
 	return NULL;
 }
 
+// Search for the first fitting free block starting from the last placement
+// and wrapping around the heap end.
+TBlock_meta *find_next_fit(size_t size)
+{
+	TBlock_meta *rover = next_fit_rover ? next_fit_rover : block_head_brk.next;
+	TBlock_meta *fit = find_first_fit(rover, &block_head_brk, size);
+
+	if (!fit)
+		fit = find_first_fit(block_head_brk.next, rover, size);
+	if (fit)
+		next_fit_rover = fit;
+
+	return fit;
+}
+
+// Allocates (size) bytes at the start of the free block (best_fit), whose
+// remaining space forms a free block(if possible). Returns the payload address.
+void *take_free_block(TBlock_meta *best_fit, size_t size)
+{
+	// Delete the best_fit old cell.
+	delete_meta_cell_brk(best_fit);
+	// Truncate the block by creating a new smaller block.
+	add_meta_cell_brk(best_fit->prev, best_fit, SIZE_ALIGN(size), STATUS_ALLOC);
+	// Use the remaining space to form a free block(if possible).
+	use_unused_space((void *)best_fit, best_fit->size);
+
+	// Return the payload address.
+	return (void *)((void *)best_fit + META_DATA_SIZE);
+}
+
+// Search for a free block that can hold (size_t size) bytes using the configured
+// placement policy and split it. If the block doesn't exist, returns NULL.
+void *search_fit(size_t size)
+{
+	TBlock_meta *best_fit = NULL;
+
+	if (osmem_conf.fit_policy == FIT_FIRST)
+		best_fit = find_first_fit(block_head_brk.next, &block_head_brk, size);
+	else if (osmem_conf.fit_policy == FIT_NEXT)
+		best_fit = find_next_fit(size);
+	else
+		best_fit = find_best_fit(size);
+
+	if (best_fit)
+		return take_free_block(best_fit, size);
+
+	return NULL;
+}
+
+// Size of the free block (cell) once merged with the free blocks after it, as
+// coalesce_block() would make it.
+size_t coalesced_size(TBlock_meta *cell)
+{
+	TBlock_meta *next = cell->next;
+
+	while ((next != &block_head_brk) && (next->status == STATUS_FREE))
+		next = next->next;
+	if (next == &block_head_brk)
+		return heap_end() - (void *)cell - META_DATA_SIZE;
+	return (void *)next - (void *)cell - META_DATA_SIZE;
+}
+
+// Places (size) bytes in a free heap block within a page of the live heap block
+// (hint), the closest one first. A block before the hint gives its end, one
+// after it its start. Returns NULL if no such block fits. Only the block taken
+// is coalesced.
+void *search_near(TBlock_meta *hint, size_t size)
+{
+	size_t page_size = (size_t)getpagesize();
+	TBlock_meta *after = NULL, *before = NULL;
+	size_t after_distance = 0, before_distance = 0;
+
+	size = SIZE_ALIGN(size);
+
+	for (TBlock_meta *cell = hint->next; cell != &block_head_brk; cell = cell->next) {
+		after_distance = (void *)cell - ((void *)hint + META_DATA_SIZE + hint->size);
+		if (after_distance > page_size)
+			break;
+		if ((cell->status == STATUS_FREE) && (coalesced_size(cell) >= size)) {
+			after = cell;
+			break;
+		}
+	}
+
+	for (TBlock_meta *cell = hint->prev; cell != &block_head_brk; cell = cell->prev) {
+		before_distance = (void *)hint - ((void *)cell + META_DATA_SIZE + cell->size);
+		if (before_distance > page_size)
+			break;
+		if (cell->status != STATUS_FREE)
+			continue;
+
+		size_t cell_size = coalesced_size(cell);
+
+		if (cell_size >= size) {
+			// Merged with the free blocks after it, the block ends closer to the hint.
+			before_distance = (void *)hint - ((void *)cell + META_DATA_SIZE + cell_size);
+			before = cell;
+			break;
+		}
+	}
+
+	void *payload;
+
+	if (after && (!before || (after_distance <= before_distance))) {
+		coalesce_block(after);
+		payload = take_free_block(after, size);
+	} else if (!before) {
+		return NULL;
+	} else {
+		coalesce_block(before);
+		if (before->size < size + META_DATA_SIZE + ALIGNMENT) {
+			// Too small to leave a free block in front: take it whole.
+			payload = take_free_block(before, size);
+		} else {
+			before->size -= META_DATA_SIZE + size;
+			payload = add_meta_cell_brk(before, (void *)before + META_DATA_SIZE + before->size, size,
+										STATUS_ALLOC);
+		}
+	}
+	heap_mark_dirty(payload);
+	return payload;
+}
+
+// Gives the free blocks ending the heap back to the top chunk.
+void top_absorb(void)
+{
+	TBlock_meta *last_cell = block_head_brk.prev;
+
+	while ((last_cell != &block_head_brk) && (last_cell->status == STATUS_FREE)) {
+		delete_meta_cell_brk(last_cell);
+		if (last_cell == next_fit_rover)
+			next_fit_rover = NULL;
+		top_start = last_cell;
+		last_cell = last_cell->prev;
+	}
+}
+
+// Makes the top chunk hold at least (size) bytes, growing it by top_chunk bytes
+// at least.
+void top_grow(size_t size)
+{
+	size_t avail = top_end - top_start;
+
+	if (avail >= size)
+		return;
+
+	size_t increment = grow_size(size - avail);
+
+	if (increment < osmem_conf.top_chunk)
+		increment = osmem_conf.top_chunk;
+
+	void *ret_sbrk = heap_sbrk(increment);
+
+	DIE(ret_sbrk == (void *)-1, "sbrk");
+	top_end += increment;
+}
+
+// Places a block of (size) bytes at the start of the top chunk, which holds it.
+void *top_carve(size_t size)
+{
+	void *payload = add_meta_cell_brk(block_head_brk.prev, top_start, SIZE_ALIGN(size), STATUS_ALLOC);
+
+	top_start += META_DATA_SIZE + SIZE_ALIGN(size);
+	return payload;
+}
+
+// Grows the last heap block (cell) to (size) bytes out of the top chunk.
+void top_extend(TBlock_meta *cell, size_t size)
+{
+	void *end = (void *)cell + META_DATA_SIZE + SIZE_ALIGN(size);
+
+	top_grow(end - top_start);
+	cell->size = SIZE_ALIGN(size);
+	top_start = end;
+}
+
 // Increases the heap break_point and returns the payload address of
 // the new alloced block.
 void *increase_heap(size_t size)
@@ -235,134 +613,349 @@ void *increase_heap(size_t size)
 	// Find the last cell of the heap.
 	TBlock_meta *last_cell = block_head_brk.prev;
 
+	if (osmem_conf.top_chunk) {
+		top_absorb();
+		top_grow(META_DATA_SIZE + SIZE_ALIGN(size));
+		return top_carve(size);
+	}
+
 	// The last cell is freed.
 	if (last_cell->status == STATUS_FREE) {
 		// Unused space start address.
 		void *last_addr = (void *)last_cell + META_DATA_SIZE + last_cell->size;
 
-		void *stop = sbrk(0); // heap bound
+		void *stop = heap_top(); // heap bound
 
 		DIE(stop == (void *)-1, "sbrk");
 
 		// Increase heap to the smallest necessary size(use the unused space).
 		size_t rem_size = SIZE_ALIGN(size) - last_cell->size - (stop - last_addr);
 
-		void *ret_sbrk = sbrk(rem_size);
+		void *ret_sbrk = heap_sbrk(grow_size(rem_size));
 
 		DIE(ret_sbrk == (void *)-1, "sbrk");
 
 		// Delete the last free cell and create a new alloced cell.
 		delete_meta_cell_brk(last_cell);
-		return add_meta_cell_brk(last_cell->prev, last_cell, SIZE_ALIGN(size), STATUS_ALLOC);
+		void *payload = add_meta_cell_brk(last_cell->prev, last_cell, SIZE_ALIGN(size), STATUS_ALLOC);
+
+		// The growth step may leave room for a trailing free block.
+		if (grow_rounds())
+			use_unused_space(last_cell, SIZE_ALIGN(size));
+		return payload;
 
 	} else {
 		// The last cell is alloced.
 		// Ignore the unused space while allocating new heap space.
 		size_t total_size = META_DATA_SIZE + SIZE_ALIGN(size);
 
-		void *start = sbrk(total_size);
+		void *start = heap_sbrk(grow_size(total_size));
 
 		DIE(start == (void *)-1, "sbrk");
-		return add_meta_cell_brk(last_cell, (TBlock_meta *)start, SIZE_ALIGN(size), STATUS_ALLOC);
+		void *payload = add_meta_cell_brk(last_cell, (TBlock_meta *)start, SIZE_ALIGN(size), STATUS_ALLOC);
+
+		if (grow_rounds())
+			use_unused_space(start, SIZE_ALIGN(size));
+		return payload;
 	}
 }
 
-// OS FUNCTIONS
+// heap_trim() for the top chunk.
+void top_trim(void)
+{
+	top_absorb();
 
+	size_t size = top_end - top_start;
 
-void *os_malloc(size_t size)
+	if ((size < osmem_conf.trim_threshold) || (size <= osmem_conf.top_pad))
+		return;
+
+	size_t page_size = (size_t)getpagesize();
+	size_t release = (size - osmem_conf.top_pad) & ~(page_size - 1);
+
+	if (!release)
+		return;
+
+	void *ret_sbrk = heap_sbrk(-(intptr_t)release);
+
+	DIE(ret_sbrk == (void *)-1, "sbrk");
+	top_end -= release;
+	STAT_ADD(heap_trims, 1);
+}
+
+// Returns the free heap top to the system once it reaches the trim threshold.
+void heap_trim(void)
+{
+	TBlock_meta *top = block_head_brk.prev;
+
+	if (osmem_conf.top_chunk) {
+		top_trim();
+		return;
+	}
+
+	if ((top == &block_head_brk) || (top->status != STATUS_FREE))
+		return;
+
+	// Merge the free blocks ending the heap.
+	while ((top->prev != &block_head_brk) && (top->prev->status == STATUS_FREE))
+		top = top->prev;
+	coalesce_block(top);
+
+	if ((top->size < osmem_conf.trim_threshold) || (top->size <= osmem_conf.top_pad))
+		return;
+
+	// Release whole pages, keeping top_pad bytes for the next extension.
+	size_t page_size = (size_t)getpagesize();
+	size_t release = (top->size - osmem_conf.top_pad) & ~(page_size - 1);
+
+	if (!release)
+		return;
+
+	void *ret_sbrk = heap_sbrk(-(intptr_t)release);
+
+	DIE(ret_sbrk == (void *)-1, "sbrk");
+	top->size -= release;
+	STAT_ADD(heap_trims, 1);
+}
+
+// Places (size) bytes on the heap.
+void *heap_malloc(size_t size)
 {
 	void *return_addr = NULL;
 
-	if (!size)
-		return NULL;
+	// Use preallocation.
+	if (!block_head_brk.size)
+		heap_preallocation();
 
-	// Malloc on map segment.
-	if (size >= BRK_LIMIT) {
-		return_addr = add_meta_cell_mmap(size);
-	} else {
-		// Malloc on heap(use preallocation).
-		if (!block_head_brk.size)
-			heap_preallocation();
+	// Empty the caches of the threads that stopped allocating.
+	if (osmem_conf.tcache_idle_ms && osmem_conf.nr_classes && tcache_scavenge_due() && tcache_scavenge())
+		heap_has_free = 1;
+
+	// Nothing to reuse yet: a compare and an add.
+	if (osmem_conf.top_chunk && !heap_has_free &&
+		((size_t)(top_end - top_start) >= META_DATA_SIZE + SIZE_ALIGN(size))) {
+		return_addr = top_carve(size);
+		heap_mark_dirty(return_addr);
+		return return_addr;
+	}
 
-		// Coalesce free blocks for consistency.
+	// Coalesce free blocks for consistency(or only once nothing fits).
+	if (!osmem_conf.lazy_coalesce)
 		coalesce_blocks();
 
-		// Search for a fitting free block.
-		return_addr = search_best_fit(size);
+	// Search for a fitting free block.
+	return_addr = search_fit(size);
+
+	if (!return_addr && osmem_conf.lazy_coalesce) {
+		coalesce_blocks();
+		return_addr = search_fit(size);
+	}
 
-		// If a fitting block isn't found, increase the heap.
-		if (!return_addr)
-			return_addr = increase_heap(size);
+	// Take back blocks parked in the thread caches before growing the heap.
+	if (!return_addr && osmem_conf.nr_classes && tcache_reclaim()) {
+		coalesce_blocks();
+		return_addr = search_fit(size);
 	}
+
+	// If a fitting block isn't found, increase the heap.
+	if (!return_addr)
+		return_addr = increase_heap(size);
+	heap_mark_dirty(return_addr);
 	return return_addr;
 }
 
-void os_free(void *ptr)
+// Allocates (size) bytes on the heap or on the map segment.
+void *malloc_block(size_t size)
 {
-	if (!ptr)
-		return;
+	// Malloc on map segment.
+	if (size >= osmem_conf.mmap_threshold)
+		return map_block(size);
+
+	// Malloc on heap.
+	return heap_malloc(size);
+}
 
+// Releases a heap or map segment block.
+void free_block(void *ptr)
+{
 	TBlock_meta *cell_addr = (TBlock_meta *)(ptr - META_DATA_SIZE);
 
-	if (cell_addr->status == STATUS_ALLOC)
+	if (cell_addr->status == STATUS_ALLOC) {
 		// Just change the status.
 		cell_addr->status = STATUS_FREE;
-	if (cell_addr->status == STATUS_MAPPED)
-		delete_meta_cell_mmap(cell_addr);
+		heap_has_free = 1;
+		if (osmem_conf.top_chunk)
+			top_absorb();
+		// The trim may release the cell itself.
+		if (osmem_conf.trim_threshold)
+			heap_trim();
+	} else if ((cell_addr->status == STATUS_MAPPED) || (cell_addr->status == STATUS_SPAN)) {
+		unmap_block(cell_addr);
+	}
 }
 
-// Similar to malloc.
-void *os_calloc(size_t nmemb, size_t size)
+// Queues a free for the next holder of heap_lock.
+void defer_free(void *ptr)
 {
-	// Max size for heap calloc allocation.
-	size_t page_size = (size_t)getpagesize();
+	void *head = __atomic_load_n(&deferred_frees, __ATOMIC_RELAXED);
 
-	if ((size_t)getpagesize() > 4080)
-		page_size = 4080;
+	do {
+		*(void **)ptr = head;
+	} while (!__atomic_compare_exchange_n(&deferred_frees, &head, ptr, 1,
+										  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	STAT_ADD(deferred_frees, 1);
+}
 
-	void *return_addr = NULL;
+// Performs the queued frees; the caller holds heap_lock.
+void drain_deferred_frees(void)
+{
+	if (!__atomic_load_n(&deferred_frees, __ATOMIC_RELAXED))
+		return;
 
-	size_t total_size = nmemb * size;
+	void *ptr = __atomic_exchange_n(&deferred_frees, NULL, __ATOMIC_ACQUIRE);
 
-	if (!total_size)
-		return NULL;
+	while (ptr) {
+		void *next = *(void **)ptr;
 
-	// Calloc on map segment.
-	if (total_size >= page_size) {
-		return_addr = add_meta_cell_mmap(total_size);
-	} else {
-		// Calloc on heap.
-		if (!block_head_brk.size)
-			heap_preallocation();
+		free_block(ptr);
+		ptr = next;
+	}
+}
 
-		coalesce_blocks();
+// Takes heap_lock and performs the frees queued while it was held.
+void heap_lock_acquire(void)
+{
+	pthread_mutex_lock(&heap_lock);
+	drain_deferred_frees();
+}
 
-		return_addr = search_best_fit(total_size);
+// Resizes a group block: it stays in place while its size class holds (size)
+// bytes and moves to a plain block otherwise. Takes the locks it needs.
+void *realloc_group_block(void *ptr, size_t size)
+{
+	TBlock_meta *cell_addr = (TBlock_meta *)(ptr - META_DATA_SIZE);
 
-		if (!return_addr)
-			return_addr = increase_heap(total_size);
+	if (SIZE_ALIGN(size) <= cell_addr->size) {
+		STAT_ADD(realloc_in_place, 1);
+		return ptr;
 	}
-	// Set the zone to 0.
-	memset(return_addr, 0, SIZE_ALIGN(total_size));
+
+	heap_lock_acquire();
+	void *return_addr = malloc_block(size);
+
+	pthread_mutex_unlock(&heap_lock);
+
+	memcpy(return_addr, ptr, cell_addr->size);
+	STAT_ADD(realloc_moves, 1);
+	STAT_ADD(realloc_copied, cell_addr->size);
+	group_free(cell_addr);
 	return return_addr;
 }
 
-void *os_realloc(void *ptr, size_t size)
+// Bytes of the mapping holding the mapped block (cell) once it holds (size) bytes.
+size_t mapped_length(TBlock_meta *cell, size_t size)
 {
-	// Edge cases.
-	if (!ptr) {
-		if (size >= BRK_LIMIT)
-			return add_meta_cell_mmap(size);
-		else
-			return os_malloc(size);
-	}
+	size_t page_size = (size_t)getpagesize();
+	size_t offset = (void *)cell - mapping_start(cell);
 
-	if (!size) {
-		os_free(ptr);
+	return (offset + META_DATA_SIZE + size + page_size - 1) & ~(page_size - 1);
+}
+
+// Inserts (cell) in the map segment list as a mapped block of (size) bytes.
+void insert_meta_cell_mmap(TBlock_meta *cell, size_t size)
+{
+	if (!block_head_mmap.size)
+		init_list_mmap();
+
+	cell->status = STATUS_MAPPED;
+	cell->size = size;
+	cell->next = &block_head_mmap;
+	cell->prev = block_head_mmap.prev;
+	block_head_mmap.prev->next = cell;
+	block_head_mmap.prev = cell;
+}
+
+// Moves the mapped block (cell) to (size) bytes with mremap: the kernel moves
+// the page table entries, no byte is copied. Returns NULL if it cannot.
+void *remap_mapped_block(TBlock_meta *cell, size_t size)
+{
+	size_t old_size = cell->size;
+	void *start = mapping_start(cell);
+	size_t offset = (void *)cell - start;
+
+	// A block moved out of the heap(see remap_heap_block) spans two mappings,
+	// which mremap cannot move as one.
+	if (offset)
+		return NULL;
+
+	size = SIZE_ALIGN(size);
+	void *new_start = remap_pages(start, mapped_length(cell, old_size), mapped_length(cell, size));
+
+	if (new_start == MAP_FAILED)
+		return NULL;
+
+	// The list neighbours still point to the old address.
+	TBlock_meta *moved = new_start + offset;
+
+	moved->size = size;
+	moved->prev->next = moved;
+	moved->next->prev = moved;
+
+	STAT_ADD(realloc_remapped, (old_size < size) ? old_size : size);
+	STAT_ADD(mapped_size, size - old_size);
+	if (osmem_conf.stats && (osmem_stats.mapped_size > osmem_stats.peak_mapped_size))
+		osmem_stats.peak_mapped_size = osmem_stats.mapped_size;
+	return (void *)moved + META_DATA_SIZE;
+}
+
+// Moves the heap block (cell) to a new mapping of (size) bytes: the pages fully
+// inside its payload are moved with mremap and replaced in the heap by fresh
+// ones, only the partial pages at both ends are copied. The new block has the
+// page offset of the old one. Returns NULL if it cannot; the caller frees (cell).
+void *remap_heap_block(TBlock_meta *cell, size_t size)
+{
+	uintptr_t page_mask = (uintptr_t)getpagesize() - 1;
+	void *payload = (void *)cell + META_DATA_SIZE;
+	void *first = (void *)(((uintptr_t)payload + page_mask) & ~page_mask);
+	void *last = (void *)(((uintptr_t)payload + cell->size) & ~page_mask);
+
+	// The pages of a memfd heap belong to its file.
+	if (osmem_conf.heap_memfd || (last <= first))
+		return NULL;
+
+	size_t offset = (uintptr_t)cell & page_mask;
+	size_t length = (offset + META_DATA_SIZE + SIZE_ALIGN(size) + page_mask) & ~page_mask;
+	void *start = map_pages(length, MAP_PRIVATE | MAP_ANONYMOUS);
+
+	DIE(start == MAP_FAILED, "mmap");
+
+	TBlock_meta *moved = start + offset;
+	void *moved_payload = (void *)moved + META_DATA_SIZE;
+
+	if (mremap(first, last - first, last - first, MREMAP_MAYMOVE | MREMAP_FIXED,
+			   moved_payload + (first - payload)) == MAP_FAILED) {
+		unmap_pages(start, length);
 		return NULL;
 	}
+	DIE(mmap(first, last - first, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+			 -1, 0) == MAP_FAILED, "mmap");
+
+	memcpy(moved_payload, payload, first - payload);
+	memcpy(moved_payload + (last - payload), last, payload + cell->size - last);
+	insert_meta_cell_mmap(moved, SIZE_ALIGN(size));
+
+	STAT_ADD(mmap_calls, 2);
+	STAT_ADD(realloc_remapped, last - first);
+	STAT_ADD(realloc_copied, cell->size - (last - first));
+	STAT_ADD(mapped_size, META_DATA_SIZE + SIZE_ALIGN(size));
+	if (osmem_conf.stats && (osmem_stats.mapped_size > osmem_stats.peak_mapped_size))
+		osmem_stats.peak_mapped_size = osmem_stats.mapped_size;
+	return moved_payload;
+}
 
+// Resizes a live block(see os_realloc).
+void *realloc_block(void *ptr, size_t size)
+{
 	TBlock_meta *cell_addr = (TBlock_meta *)(ptr - META_DATA_SIZE);
 
 	if (cell_addr->status == STATUS_FREE)
@@ -373,12 +966,26 @@ void *os_realloc(void *ptr, size_t size)
 	// The cell is on heap.
 	if (cell_addr->status == STATUS_ALLOC) {
 		// Reallocation on map segment.
-		if (size >= BRK_LIMIT) {
+		if (size >= osmem_conf.mmap_threshold) {
+			// Large blocks move their pages instead of their bytes.
+			if (osmem_conf.realloc_remap && (cell_addr->size >= osmem_conf.realloc_remap) &&
+				(size >= osmem_conf.span_max)) {
+				return_addr = remap_heap_block(cell_addr, size);
+				if (return_addr) {
+					cell_addr->status = STATUS_FREE;
+					heap_has_free = 1;
+					STAT_ADD(realloc_moves, 1);
+					return return_addr;
+				}
+			}
 			// Mark the cell as freed.
 			cell_addr->status = STATUS_FREE;
-			return_addr = add_meta_cell_mmap(size);
+			heap_has_free = 1;
+			return_addr = map_block(size);
 			// Copy everything.
 			memcpy(return_addr, (void *)cell_addr + META_DATA_SIZE, cell_addr->size);
+			STAT_ADD(realloc_moves, 1);
+			STAT_ADD(realloc_copied, cell_addr->size);
 			return return_addr;
 		}
 
@@ -387,6 +994,7 @@ void *os_realloc(void *ptr, size_t size)
 			cell_addr->size = SIZE_ALIGN(size);
 			use_unused_space(cell_addr, SIZE_ALIGN(size));
 			return_addr = ptr;
+			STAT_ADD(realloc_in_place, 1);
 		} else {
 			// Extend case.
 			size_t old_size = cell_addr->size;
@@ -401,42 +1009,507 @@ void *os_realloc(void *ptr, size_t size)
 				use_unused_space(cell_addr, SIZE_ALIGN(cell_addr->size));
 
 				return_addr = ptr;
+				STAT_ADD(realloc_in_place, 1);
 			} else {
 				// The block is not big enough.
-				if ((cell_addr->next == &block_head_brk) && (old_size == cell_addr->size)) {
+				if ((cell_addr->next == &block_head_brk) && osmem_conf.top_chunk) {
+					top_extend(cell_addr, size);
+					return_addr = (void *)cell_addr + META_DATA_SIZE;
+					STAT_ADD(realloc_in_place, 1);
+				} else if ((cell_addr->next == &block_head_brk) && (old_size == cell_addr->size)) {
 					// Manual extend of the block by heap increase(when the block is at the end oh heap).
 					size_t total_size = SIZE_ALIGN(size) - cell_addr->size;
 
-					void *sbrk_addr = sbrk(total_size);
+					void *sbrk_addr = heap_sbrk(grow_size(total_size));
 
 					DIE(sbrk_addr == (void *)-1, "sbrk");
 					cell_addr->size = SIZE_ALIGN(size);
+					if (grow_rounds())
+						use_unused_space(cell_addr, SIZE_ALIGN(size));
 					return_addr = (void *)cell_addr + META_DATA_SIZE;
+					STAT_ADD(realloc_in_place, 1);
 				} else {
 					// The block is not at the end oh heap.
 					// Search another good block(or create one) using malloc.
-					return_addr = os_malloc(size);
+					return_addr = malloc_block(size);
 					cell_addr->status = STATUS_FREE;
+					heap_has_free = 1;
 					// Copy everything.
 					memcpy(return_addr, (void *)cell_addr + META_DATA_SIZE, cell_addr->size);
+					STAT_ADD(realloc_moves, 1);
+					STAT_ADD(realloc_copied, cell_addr->size);
 				}
 			}
 		}
 	}
 
+	// A span still in the span range resizes within its chunk if it can.
+	if ((cell_addr->status == STATUS_SPAN) && (size >= osmem_conf.mmap_threshold) &&
+		(size < osmem_conf.span_max) && !span_resize(cell_addr, size)) {
+		STAT_ADD(realloc_in_place, 1);
+		return ptr;
+	}
+
+	if ((cell_addr->status == STATUS_MAPPED) && osmem_conf.realloc_remap &&
+		(cell_addr->size >= osmem_conf.realloc_remap) && (size >= osmem_conf.mmap_threshold)) {
+		return_addr = remap_mapped_block(cell_addr, size);
+		if (return_addr) {
+			STAT_ADD(realloc_moves, 1);
+			return return_addr;
+		}
+	}
+
 	// The block is on map segment.
-	if (cell_addr->status == STATUS_MAPPED) {
+	if ((cell_addr->status == STATUS_MAPPED) || (cell_addr->status == STATUS_SPAN)) {
+		// Only the bytes both blocks hold are copied.
+		size_t copy_size = (size < cell_addr->size) ? size : cell_addr->size;
+
+		STAT_ADD(realloc_moves, 1);
+		STAT_ADD(realloc_copied, copy_size);
 		// Delete and reallocate a new block
-		if (size >= BRK_LIMIT) {
-			return_addr = add_meta_cell_mmap(size);
-			memcpy(return_addr, (void *)cell_addr + META_DATA_SIZE, size);
-			delete_meta_cell_mmap(cell_addr);
+		if (size >= osmem_conf.mmap_threshold) {
+			return_addr = map_block(size);
+			memcpy(return_addr, (void *)cell_addr + META_DATA_SIZE, copy_size);
+			unmap_block(cell_addr);
 		} else {
 			// Search for a heap block.
-			return_addr = os_malloc(size);
-			memcpy(return_addr, (void *)cell_addr + META_DATA_SIZE, size);
-			delete_meta_cell_mmap(cell_addr);
+			return_addr = malloc_block(size);
+			memcpy(return_addr, (void *)cell_addr + META_DATA_SIZE, copy_size);
+			unmap_block(cell_addr);
 		}
 	}
+	if (return_addr && (((TBlock_meta *)(return_addr - META_DATA_SIZE))->status == STATUS_ALLOC))
+		heap_mark_dirty(return_addr);
 	return return_addr;
 }
+
+// Grows a live block to at least (size) bytes without moving it(see os_expand).
+// Returns 0 on success.
+int expand_block(void *ptr, size_t size)
+{
+	TBlock_meta *cell_addr = (TBlock_meta *)(ptr - META_DATA_SIZE);
+	size = SIZE_ALIGN(size);
+
+	// A mapped block takes its page slack, then the pages right after it.
+	if (cell_addr->status == STATUS_MAPPED) {
+		size_t old_length = mapped_length(cell_addr, cell_addr->size);
+		size_t new_length = mapped_length(cell_addr, size);
+
+		if (new_length > old_length) {
+			if (mremap(mapping_start(cell_addr), old_length, new_length, 0) == MAP_FAILED)
+				return -1;
+		}
+		if (size > cell_addr->size) {
+			STAT_ADD(mapped_size, size - cell_addr->size);
+			cell_addr->size = size;
+		}
+		return 0;
+	}
+
+	// A group block is limited to its size class.
+	if (cell_addr->status == STATUS_GROUP)
+		return (size <= cell_addr->size) ? 0 : -1;
+
+	// A span takes the free pages that follow it in its chunk.
+	if (cell_addr->status == STATUS_SPAN)
+		return (size <= cell_addr->size) ? 0 : span_resize(cell_addr, size);
+
+	if (cell_addr->status != STATUS_ALLOC)
+		return -1;
+	if (size <= cell_addr->size)
+		return 0;
+	// Such a block would have been mapped.
+	if (size >= osmem_conf.mmap_threshold)
+		return -1;
+
+	size_t old_size = cell_addr->size;
+
+	// Take the free blocks that follow.
+	coalesce_block(cell_addr);
+	if (cell_addr->size >= size) {
+		cell_addr->size = size;
+		use_unused_space(cell_addr, size);
+		return 0;
+	}
+
+	// The last block grows with the heap.
+	if ((cell_addr->next == &block_head_brk) && osmem_conf.top_chunk) {
+		top_extend(cell_addr, size);
+		return 0;
+	}
+	if (cell_addr->next == &block_head_brk) {
+		void *sbrk_addr = heap_sbrk(grow_size(size - cell_addr->size));
+
+		DIE(sbrk_addr == (void *)-1, "sbrk");
+		cell_addr->size = size;
+		if (grow_rounds())
+			use_unused_space(cell_addr, size);
+		return 0;
+	}
+
+	// Give the merged blocks back.
+	cell_addr->size = old_size;
+	use_unused_space(cell_addr, old_size);
+	return -1;
+}
+
+// Frees a block under heap_lock, or queues the free if deferred frees are
+// enabled and the lock is taken.
+void locked_free(void *ptr)
+{
+	if (!osmem_conf.deferred_free) {
+		pthread_mutex_lock(&heap_lock);
+	} else if (pthread_mutex_trylock(&heap_lock)) {
+		defer_free(ptr);
+		return;
+	}
+	free_block(ptr);
+	drain_deferred_frees();
+	pthread_mutex_unlock(&heap_lock);
+}
+
+// OS FUNCTIONS
+
+
+// os_malloc() on behalf of the call site (site): the entry points falling back
+// to it pass their caller's return address, which groups the request.
+static void *malloc_site(size_t size, void *site)
+{
+	void *return_addr = NULL;
+
+	if (!size)
+		return NULL;
+
+	STAT_ADD(malloc_calls, 1);
+
+	// Small requests of a call site are grouped together.
+	if (osmem_conf.site_groups && (size <= GROUP_SIZE_MAX)) {
+		return_addr = group_alloc((uintptr_t)site | GROUP_SITE, size);
+		if (return_addr) {
+			TRACE("m %lu %zu\n", (uintptr_t)return_addr, size);
+			return return_addr;
+		}
+	}
+
+	// Small requests are rounded up to a size class and served by the thread cache.
+	size_t alloc_size = size;
+	size_t class_size = tcache_class_size(size);
+
+	if (class_size) {
+		return_addr = tcache_get(class_size);
+		alloc_size = class_size;
+	}
+
+	if (return_addr) {
+		STAT_ADD(tcache_hits, 1);
+	} else {
+		heap_lock_acquire();
+		return_addr = malloc_block(alloc_size);
+		pthread_mutex_unlock(&heap_lock);
+	}
+
+	TRACE("m %lu %zu\n", (uintptr_t)return_addr, size);
+	return return_addr;
+}
+
+void *os_malloc(size_t size)
+{
+	return malloc_site(size, __builtin_return_address(0));
+}
+
+void *os_malloc_near(void *hint, size_t size)
+{
+	void *return_addr = NULL;
+
+	if (!hint || !size)
+		return malloc_site(size, __builtin_return_address(0));
+
+	TBlock_meta *hint_cell = (TBlock_meta *)(hint - META_DATA_SIZE);
+	int status = -1;
+
+	heap_lock_acquire();
+	// The hint may be a mapped block, a block of a pinned pool or another
+	// allocator's: its header is read only if it lies in the heap.
+	if (block_head_brk.size && ((void *)hint_cell >= (void *)block_head_brk.next) &&
+		((void *)hint_cell < heap_top()))
+		status = hint_cell->status;
+	if ((status == STATUS_ALLOC) && (size < osmem_conf.mmap_threshold))
+		return_addr = search_near(hint_cell, size);
+	pthread_mutex_unlock(&heap_lock);
+
+	// A group block's neighbours are its group's(group regions are heap blocks).
+	if ((status == STATUS_GROUP) && (size <= GROUP_SIZE_MAX))
+		return_addr = group_alloc_near(hint_cell, size);
+
+	if (!return_addr)
+		return malloc_site(size, __builtin_return_address(0));
+
+	STAT_ADD(malloc_calls, 1);
+	STAT_ADD(near_hits, 1);
+	TRACE("m %lu %zu\n", (uintptr_t)return_addr, size);
+	return return_addr;
+}
+
+void *os_malloc_group(unsigned long group, size_t size)
+{
+	void *return_addr = NULL;
+
+	if (!size)
+		return NULL;
+
+	if ((size <= GROUP_SIZE_MAX) && !(group & GROUP_SITE))
+		return_addr = group_alloc(group, size);
+	// Large requests, reserved ids and groups over the limit get a plain block.
+	if (!return_addr)
+		return malloc_site(size, __builtin_return_address(0));
+
+	STAT_ADD(malloc_calls, 1);
+	TRACE("m %lu %zu\n", (uintptr_t)return_addr, size);
+	return return_addr;
+}
+
+void os_free(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	STAT_ADD(free_calls, 1);
+	// Record the free before the block can be handed out again.
+	TRACE("f %lu\n", (uintptr_t)ptr);
+
+	TBlock_meta *cell_addr = (TBlock_meta *)(ptr - META_DATA_SIZE);
+
+	// Group blocks go back to their group, without the heap lock.
+	if (cell_addr->status == STATUS_GROUP) {
+		group_free(cell_addr);
+		return;
+	}
+
+	// Keep the block in the thread cache if its class has room.
+	if ((cell_addr->status == STATUS_ALLOC) && tcache_put(cell_addr))
+		return;
+
+	locked_free(ptr);
+}
+
+void *os_malloc_small(size_t index)
+{
+	int class = tcache_index[index];
+	size_t size = index * ALIGNMENT;
+
+	// The configuration changed without the table being rebuilt.
+	if ((class < 0) || (class >= osmem_conf.nr_classes) || (osmem_conf.classes[class] < size))
+		return malloc_site(size, __builtin_return_address(0));
+
+	STAT_ADD(malloc_calls, 1);
+
+	void *return_addr = tcache_get_class(class);
+
+	if (return_addr) {
+		STAT_ADD(tcache_hits, 1);
+	} else {
+		heap_lock_acquire();
+		return_addr = malloc_block(osmem_conf.classes[class]);
+		pthread_mutex_unlock(&heap_lock);
+	}
+
+	TRACE("m %lu %zu\n", (uintptr_t)return_addr, size);
+	return return_addr;
+}
+
+void os_free_small(void *ptr, size_t index)
+{
+	int class = tcache_index[index];
+
+	if (!ptr)
+		return;
+
+	TBlock_meta *cell_addr = (TBlock_meta *)(ptr - META_DATA_SIZE);
+
+	if ((class < 0) || (class >= osmem_conf.nr_classes) || (cell_addr->status != STATUS_ALLOC) ||
+		(cell_addr->size != osmem_conf.classes[class])) {
+		os_free(ptr);
+		return;
+	}
+
+	STAT_ADD(free_calls, 1);
+	TRACE("f %lu\n", (uintptr_t)ptr);
+
+	if (!tcache_put_class(cell_addr, class))
+		locked_free(ptr);
+}
+
+// Allocates (size) zeroed bytes for os_calloc() with the "calloc_heap" option:
+// below the mmap threshold on the heap, where the blocks above heap_dirty_top
+// are still zero; above it in a fresh mapping or a span(see span_calloc).
+void *calloc_block(size_t size)
+{
+	void *return_addr = NULL;
+	int zeroed = 0;
+
+	if (size >= osmem_conf.mmap_threshold) {
+		heap_lock_acquire();
+		if (size < osmem_conf.span_max)
+			return_addr = span_calloc(size);
+		if (!return_addr) {
+			return_addr = add_meta_cell_mmap(size);
+			STAT_ADD(calloc_zero_skipped, SIZE_ALIGN(size));
+		}
+		pthread_mutex_unlock(&heap_lock);
+		return return_addr;
+	}
+
+	size_t alloc_size = size;
+	size_t class_size = tcache_class_size(size);
+
+	if (class_size) {
+		return_addr = tcache_get(class_size);
+		alloc_size = class_size;
+		if (return_addr)
+			STAT_ADD(tcache_hits, 1);
+	}
+
+	if (!return_addr) {
+		heap_lock_acquire();
+		void *dirty_top = heap_dirty_top;
+
+		return_addr = heap_malloc(alloc_size);
+		zeroed = (return_addr >= dirty_top);
+		pthread_mutex_unlock(&heap_lock);
+	}
+
+	// glibc's memset clears with the widest stores the CPU has.
+	if (zeroed)
+		STAT_ADD(calloc_zero_skipped, SIZE_ALIGN(size));
+	else
+		memset(return_addr, 0, SIZE_ALIGN(size));
+	return return_addr;
+}
+
+// Similar to malloc.
+void *os_calloc(size_t nmemb, size_t size)
+{
+	// Max size for heap calloc allocation.
+	size_t page_size = (size_t)getpagesize();
+
+	if (page_size > osmem_conf.calloc_threshold)
+		page_size = osmem_conf.calloc_threshold;
+
+	void *return_addr = NULL;
+
+	size_t total_size = nmemb * size;
+
+	if (!total_size)
+		return NULL;
+
+	STAT_ADD(calloc_calls, 1);
+
+	// Medium requests stay on the heap, and memory known to be zero is not cleared.
+	if (osmem_conf.calloc_heap) {
+		return_addr = calloc_block(total_size);
+		TRACE("c %lu %zu %zu\n", (uintptr_t)return_addr, nmemb, size);
+		return return_addr;
+	}
+
+	// Calloc on map segment.
+	if (total_size >= page_size) {
+		heap_lock_acquire();
+		return_addr = map_block(total_size);
+		pthread_mutex_unlock(&heap_lock);
+	} else {
+		size_t alloc_size = total_size;
+		size_t class_size = tcache_class_size(total_size);
+
+		if (class_size) {
+			return_addr = tcache_get(class_size);
+			alloc_size = class_size;
+			if (return_addr)
+				STAT_ADD(tcache_hits, 1);
+		}
+
+		// Calloc on heap.
+		if (!return_addr) {
+			heap_lock_acquire();
+			return_addr = heap_malloc(alloc_size);
+			pthread_mutex_unlock(&heap_lock);
+		}
+	}
+	// Set the zone to 0.
+	memset(return_addr, 0, SIZE_ALIGN(total_size));
+
+	TRACE("c %lu %zu %zu\n", (uintptr_t)return_addr, nmemb, size);
+	return return_addr;
+}
+
+void *os_realloc(void *ptr, size_t size)
+{
+	// Edge cases.
+	if (!ptr)
+		return malloc_site(size, __builtin_return_address(0));
+
+	if (!size) {
+		os_free(ptr);
+		return NULL;
+	}
+
+	STAT_ADD(realloc_calls, 1);
+
+	// The old block must not be recorded as reused before the realloc itself.
+	if (trace_fd >= 0)
+		pthread_mutex_lock(&trace_lock);
+
+	void *return_addr;
+
+	if (((TBlock_meta *)(ptr - META_DATA_SIZE))->status == STATUS_GROUP) {
+		return_addr = realloc_group_block(ptr, size);
+	} else {
+		heap_lock_acquire();
+		return_addr = realloc_block(ptr, size);
+		pthread_mutex_unlock(&heap_lock);
+	}
+
+	if (trace_fd >= 0) {
+		if (return_addr)
+			trace_record("r %lu %zu %lu\n", (uintptr_t)ptr, size, (uintptr_t)return_addr);
+		pthread_mutex_unlock(&trace_lock);
+	}
+	return return_addr;
+}
+
+size_t os_expand(void *ptr, size_t size)
+{
+	if (!ptr || !size)
+		return 0;
+
+	heap_lock_acquire();
+	int ret = expand_block(ptr, size);
+
+	if (!ret && (((TBlock_meta *)(ptr - META_DATA_SIZE))->status == STATUS_ALLOC))
+		heap_mark_dirty(ptr);
+	pthread_mutex_unlock(&heap_lock);
+
+	if (ret)
+		return 0;
+	TRACE("r %lu %zu %lu\n", (uintptr_t)ptr, size, (uintptr_t)ptr);
+	return os_malloc_usable_size(ptr);
+}
+
+size_t os_malloc_usable_size(void *ptr)
+{
+	if (!ptr)
+		return 0;
+
+	// The page slack of a mapped block is only handed out by os_expand().
+	return ((TBlock_meta *)(ptr - META_DATA_SIZE))->size;
+}
+
+unsigned long os_tcache_scavenge(void)
+{
+	heap_lock_acquire();
+	unsigned long released = tcache_scavenge();
+
+	if (released)
+		heap_has_free = 1;
+	pthread_mutex_unlock(&heap_lock);
+	return released;
+}
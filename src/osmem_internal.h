@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "osmem.h"
+#include "block_meta.h"
+#include "osmem_conf.h"
+
+// Maximum block size for heap allocation.
+#define BRK_LIMIT (128 * 1024)
+
+// Maximum block size for heap calloc allocation(further capped to the page size).
+#define CALLOC_LIMIT 4080
+
+// Alignment to 8 bytes macro; it returns the smallest multiple of 8 smaller than (size).
+#define ALIGNMENT 8
+#define SIZE_ALIGN(size)  (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+
+// Meta_data block size.
+#define META_DATA_SIZE SIZE_ALIGN(sizeof(TBlock_meta))
+
+typedef struct block_meta TBlock_meta;
+
+// Serializes every heap and map segment list operation.
+extern pthread_mutex_t heap_lock;
+
+// Counters reported by os_stats_get().
+extern struct osmem_stats osmem_stats;
+
+#define STAT_ADD(field, n)									\
+	do {											\
+		if (osmem_conf.stats)								\
+			__atomic_fetch_add(&osmem_stats.field, (n), __ATOMIC_RELAXED);		\
+	} while (0)
+
+// Records a call in the trace file when tracing is enabled.
+#define TRACE(...)										\
+	do {											\
+		if (trace_fd >= 0)								\
+			trace_record(__VA_ARGS__);						\
+	} while (0)
+
+extern int trace_fd;
+extern pthread_mutex_t trace_lock;
+
+void trace_record_open(void);
+void trace_record(const char *format, ...);
+void trace_record_flush(void);
+void osmem_log(const char *format, ...);
+
+// Heap operations; the caller holds heap_lock.
+void *malloc_block(size_t size);
+void free_block(void *ptr);
+
+// Mapped blocks: own mappings, or spans of super-chunks(span.c).
+void *map_block(size_t size);
+void unmap_block(TBlock_meta *cell);
+void *span_alloc(size_t size);
+void *span_calloc(size_t size);
+void span_free(TBlock_meta *cell);
+int span_resize(TBlock_meta *cell, size_t size);
+
+// Allocation groups(group.c); requests up to GROUP_SIZE_MAX bytes are grouped.
+#define GROUP_SIZE_MAX 1024
+
+// Tag of the call site groups' ids: the os_malloc_group() ids are below it.
+#define GROUP_SITE (1UL << 63)
+
+void *group_alloc(uintptr_t id, size_t size);
+void *group_alloc_near(TBlock_meta *hint, size_t size);
+void group_free(TBlock_meta *cell);
+void heap_lock_acquire(void);
+
+// Heap break; the memfd heap(snapshot.c) replaces the program break.
+void *heap_sbrk(intptr_t increment);
+void *heap_top(void);
+int heap_started(void);
+void *memfd_sbrk(intptr_t increment);
+
+// Fixed address window(fixed.c); the map_pages() family falls back to the
+// plain syscalls when it is not active.
+int fixed_active(void);
+int fixed_reserved(void);
+void *fixed_sbrk(intptr_t increment);
+void *map_pages(size_t length, int flags);
+void unmap_pages(void *addr, size_t length);
+void *remap_pages(void *addr, size_t old_length, size_t new_length);
+
+// Arena of the meshable pool slabs(mesh.c).
+int mesh_init(void);
+size_t mesh_offset(void *view);
+void *mesh_view_map(size_t len);
+void mesh_view_alias(void *view, size_t len, size_t offset);
+void mesh_pages_release(size_t offset, size_t len);
+void mesh_view_unmap(void *view, size_t len);
+
+// Thread cache(tcache.c).
+size_t tcache_class_size(size_t size);
+void *tcache_get(size_t size);
+void *tcache_get_class(int class);
+int tcache_put(TBlock_meta *cell);
+int tcache_put_class(TBlock_meta *cell, int class);
+void tcache_index_build(void);
+
+extern signed char tcache_index[];
+unsigned long tcache_reclaim(void);
+unsigned long tcache_scavenge(void);
+int tcache_scavenge_due(void);
+size_t tcache_capacity(unsigned long *capacity);
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Pinned pools: a private mapping faulted in and locked in RAM when the pool is
+// created, carved into blocks with the heap's metadata layout. Allocations never
+// page fault or get swapped out, and the pool only holds its users' buffers.
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+// Payloads are aligned to a cache line: block headers sit right before a cache
+// line boundary and every block(header included) spans whole cache lines.
+#define PINNED_ALIGN 64
+#define PINNED_ROUND(size) (((size) + (PINNED_ALIGN - 1)) & ~((size_t)PINNED_ALIGN - 1))
+#define PINNED_BLOCK_SIZE(size) (PINNED_ROUND((size) + META_DATA_SIZE) - META_DATA_SIZE)
+
+struct os_pinned_pool {
+	pthread_mutex_t lock;
+	void *base;		/* start of the mapping, which begins with this structure */
+	size_t map_size;
+	int locked;		/* the mapping is mlock'd */
+	TBlock_meta head;	/* address ordered list of the pool blocks */
+};
+
+// Offset of the first block header: the first payload starts on a cache line.
+#define PINNED_FIRST_BLOCK (PINNED_ROUND(sizeof(struct os_pinned_pool) + META_DATA_SIZE) - META_DATA_SIZE)
+
+// Locks the mapping. With pinned_memlock, the RLIMIT_MEMLOCK soft limit is
+// raised up to the hard limit if needed. Returns 0 on success.
+static int pinned_mlock(void *addr, size_t size)
+{
+	struct rlimit limit;
+
+	if (!mlock(addr, size))
+		return 0;
+
+	// The soft limit is the whole process's, so it is only raised on request.
+	if (!osmem_conf.pinned_memlock)
+		return -1;
+	if ((errno != ENOMEM) && (errno != EPERM) && (errno != EAGAIN))
+		return -1;
+	if (getrlimit(RLIMIT_MEMLOCK, &limit) || (limit.rlim_cur == limit.rlim_max))
+		return -1;
+
+	limit.rlim_cur = limit.rlim_max;
+	if (setrlimit(RLIMIT_MEMLOCK, &limit))
+		return -1;
+	return mlock(addr, size);
+}
+
+struct os_pinned_pool *os_pinned_pool_create(size_t bytes)
+{
+	size_t page_size = (size_t)getpagesize();
+
+	if (!bytes)
+		return NULL;
+	// The header, the block rounding and the page rounding must not overflow.
+	if (bytes > SIZE_MAX - PINNED_FIRST_BLOCK - 2 * META_DATA_SIZE - PINNED_ALIGN - page_size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	size_t map_size = (PINNED_FIRST_BLOCK + META_DATA_SIZE + PINNED_BLOCK_SIZE(bytes) + page_size - 1)
+					  & ~(page_size - 1);
+	void *addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+	if (addr == MAP_FAILED)
+		return NULL;
+	STAT_ADD(mmap_calls, 1);
+	STAT_ADD(mapped_size, map_size);
+	if (osmem_conf.stats && (osmem_stats.mapped_size > osmem_stats.peak_mapped_size))
+		osmem_stats.peak_mapped_size = osmem_stats.mapped_size;
+
+	struct os_pinned_pool *pool = addr;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->base = addr;
+	pool->map_size = map_size;
+	pool->locked = !pinned_mlock(addr, map_size);
+
+	// Over RLIMIT_MEMLOCK the pool still works, prefaulted but swappable.
+	if (!pool->locked)
+		osmem_log("osmem: pinned pool of %zu bytes not locked in memory(RLIMIT_MEMLOCK)\n", map_size);
+
+	// One free block spans the whole pool.
+	TBlock_meta *cell = addr + PINNED_FIRST_BLOCK;
+
+	cell->status = STATUS_FREE;
+	cell->size = map_size - PINNED_FIRST_BLOCK - META_DATA_SIZE;
+	cell->prev = &pool->head;
+	cell->next = &pool->head;
+	pool->head.status = -1;
+	pool->head.size = 0;
+	pool->head.prev = cell;
+	pool->head.next = cell;
+
+	return pool;
+}
+
+int os_pinned_pool_locked(struct os_pinned_pool *pool)
+{
+	return pool->locked;
+}
+
+// First fit; the remainder of the block becomes a new free block.
+void *os_pinned_alloc(struct os_pinned_pool *pool, size_t size)
+{
+	void *payload = NULL;
+
+	if (!size || (size > pool->map_size))
+		return NULL;
+	size = PINNED_BLOCK_SIZE(size);
+
+	pthread_mutex_lock(&pool->lock);
+	for (TBlock_meta *cell = pool->head.next; cell != &pool->head; cell = cell->next) {
+		if ((cell->status != STATUS_FREE) || (cell->size < size))
+			continue;
+
+		if (cell->size >= size + PINNED_ALIGN) {
+			TBlock_meta *rest = (void *)cell + META_DATA_SIZE + size;
+
+			rest->status = STATUS_FREE;
+			rest->size = cell->size - size - META_DATA_SIZE;
+			rest->prev = cell;
+			rest->next = cell->next;
+			cell->next->prev = rest;
+			cell->next = rest;
+			cell->size = size;
+		}
+		cell->status = STATUS_ALLOC;
+		payload = (void *)cell + META_DATA_SIZE;
+		break;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return payload;
+}
+
+// Merges (cell) with the free block following it.
+static void pinned_merge_next(struct os_pinned_pool *pool, TBlock_meta *cell)
+{
+	TBlock_meta *next = cell->next;
+
+	if ((next == &pool->head) || (next->status != STATUS_FREE))
+		return;
+
+	cell->size += META_DATA_SIZE + next->size;
+	cell->next = next->next;
+	next->next->prev = cell;
+}
+
+void os_pinned_free(struct os_pinned_pool *pool, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	TBlock_meta *cell = ptr - META_DATA_SIZE;
+	int valid = ((void *)cell >= pool->base) && ((void *)cell < pool->base + pool->map_size) &&
+				(cell->status == STATUS_ALLOC);
+
+	if (!valid)
+		errno = EINVAL;
+	DIE(!valid, "os_pinned_free");
+
+	// Free blocks are merged right away, the pool never has two adjacent ones.
+	pthread_mutex_lock(&pool->lock);
+	cell->status = STATUS_FREE;
+	pinned_merge_next(pool, cell);
+	if ((cell->prev != &pool->head) && (cell->prev->status == STATUS_FREE))
+		pinned_merge_next(pool, cell->prev);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void os_pinned_pool_destroy(struct os_pinned_pool *pool)
+{
+	if (!pool)
+		return;
+
+	size_t map_size = pool->map_size;
+
+	pthread_mutex_destroy(&pool->lock);
+	if (pool->locked)
+		munlock(pool->base, map_size);
+	munmap(pool->base, map_size);
+	STAT_ADD(munmap_calls, 1);
+	STAT_ADD(mapped_size, -map_size);
+}
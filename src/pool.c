@@ -0,0 +1,616 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Object pools: fixed-size objects carved from slabs allocated with os_malloc.
+// Every slab keeps its own free list, chained through the first word of the
+// objects, and objects are handed out from one slab until it is exhausted, so
+// objects allocated together stay within a slab even after heavy churn. The
+// slabs with free objects form a LIFO list: the slab freed into last(the one
+// most likely in cache) is used first. Slabs are given back when the pool is
+// destroyed, or when they are entirely free and the pool is shrunk.
+//
+// Object caches(os_cache_create) are pools whose objects are constructed when
+// their slab is added and destroyed when it is released: an object keeps its
+// constructed state between a free and the next allocation, so the free list
+// link is kept after the object instead of in its first word.
+//
+// Pools created with the "pool_mesh" option take their slabs from the mesh
+// arena(mesh.c), one or a few pages each, and track their objects with a bitmap
+// kept in a header of their own. Meshing(os_pool_mesh) looks for pairs of
+// slabs whose allocated objects sit at different offsets, copies the objects of
+// one slab to the same offsets of the other and maps both slabs over the pages
+// of the latter: the pair shares one physical copy and the objects keep their
+// addresses. A meshed slab is an alias of its owner, whose header holds the
+// objects of both.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+// Objects are aligned like the result of operator new, slabs to a cache line.
+#define POOL_ALIGN 16
+#define POOL_SLAB_ALIGN 64
+
+// Largest object alignment of a cache.
+#define CACHE_ALIGN_MAX 4096
+
+// Length of the name of a cache, terminator included.
+#define CACHE_NAME_MAX 32
+
+#define POOL_ROUND(size, align) (((size) + ((align) - 1)) & ~((size_t)(align) - 1))
+
+// Slab size, kept below the mmap threshold so slabs come from the heap.
+#define POOL_SLAB_SIZE (64 * 1024)
+
+// Objects carved from a slab, at least.
+#define POOL_SLAB_MIN_OBJS 8
+
+// Slabs a slab is compared with while meshing.
+#define POOL_MESH_PROBES 64
+
+// Slab header, alone in the first cache line of the slab, or allocated apart
+// for the slabs of a meshable pool.
+struct pool_slab {
+	void *free;		/* free objects of the slab */
+	size_t nr_free;
+	struct pool_slab *next;	/* list of the slabs with free objects */
+	int partial;		/* on that list */
+	void *mem;		/* first byte of the slab */
+	struct pool_slab *owner;	/* slab holding the objects, itself unless meshed */
+	struct pool_slab *alias;	/* next slab meshed into the owner */
+	uint64_t used[];	/* allocated objects of a meshable slab */
+};
+
+struct os_pool {
+	pthread_mutex_t lock;
+	size_t obj_size;
+	size_t link;			/* offset of the free list link in an object */
+	size_t slab_align;		/* alignment of the first object of a slab */
+	size_t slab_objs;		/* objects per slab */
+	size_t slab_size;		/* bytes allocated for a slab */
+	struct pool_slab *partial;	/* slabs with free objects */
+	struct pool_slab **slabs;	/* every slab, sorted by address */
+	size_t nr_slabs;
+	size_t max_slabs;
+	void (*ctor)(void *obj);
+	void (*dtor)(void *obj);
+	unsigned long ctor_calls;
+	unsigned long dtor_calls;
+	int mesh;			/* slabs come from the mesh arena */
+	size_t nr_aliases;		/* slabs meshed into another one */
+	unsigned long meshes;
+};
+
+struct os_cache {
+	struct os_pool *pool;
+	char name[CACHE_NAME_MAX];
+	size_t size;
+	unsigned long allocs;
+	unsigned long frees;
+};
+
+#define POOL_LINK(pool, obj) (*(void **)((obj) + (pool)->link))
+
+// Creates a pool of objects of (size) bytes aligned to (align), a power of two.
+static struct os_pool *pool_create(size_t size, size_t align, void (*ctor)(void *), void (*dtor)(void *))
+{
+	struct os_pool *pool;
+
+	if (!size)
+		return NULL;
+
+	pool = os_malloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->mesh = osmem_conf.pool_mesh && !mesh_init();
+	if (pool->mesh) {
+		size_t page_size = (size_t)getpagesize();
+
+		// Page sized slabs, unless objects are large: objects start at the
+		// first byte and the bitmap needs no link.
+		pool->link = 0;
+		pool->obj_size = POOL_ROUND(size, align);
+		pool->slab_align = page_size;
+		pool->slab_size = POOL_ROUND(pool->obj_size * POOL_SLAB_MIN_OBJS, page_size);
+		pool->slab_objs = pool->slab_size / pool->obj_size;
+	} else {
+		// Constructed objects are linked through a word of their own.
+		pool->link = (ctor || dtor) ? POOL_ROUND(size, sizeof(void *)) : 0;
+		pool->obj_size = POOL_ROUND(pool->link + sizeof(void *) > size ? pool->link + sizeof(void *) : size, align);
+		pool->slab_align = (align > POOL_SLAB_ALIGN) ? align : POOL_SLAB_ALIGN;
+		pool->slab_objs = (POOL_SLAB_SIZE - POOL_SLAB_ALIGN) / pool->obj_size;
+		if (pool->slab_objs < POOL_SLAB_MIN_OBJS)
+			pool->slab_objs = POOL_SLAB_MIN_OBJS;
+		pool->slab_size = sizeof(struct pool_slab) + pool->slab_align + pool->slab_objs * pool->obj_size;
+	}
+	pool->partial = NULL;
+	pool->slabs = NULL;
+	pool->nr_slabs = 0;
+	pool->max_slabs = 0;
+	pool->ctor = ctor;
+	pool->dtor = dtor;
+	pool->ctor_calls = 0;
+	pool->dtor_calls = 0;
+	pool->nr_aliases = 0;
+	pool->meshes = 0;
+
+	return pool;
+}
+
+struct os_pool *os_pool_create(size_t size)
+{
+	return pool_create(size, POOL_ALIGN, NULL, NULL);
+}
+
+size_t os_pool_object_size(struct os_pool *pool)
+{
+	return pool->obj_size;
+}
+
+// Index of the first slab placed after (addr).
+static size_t pool_slab_index(struct os_pool *pool, void *addr)
+{
+	size_t low = 0, high = pool->nr_slabs;
+
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+
+		if (pool->slabs[mid]->mem <= addr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+// First object of (slab).
+static void *pool_slab_objs(struct os_pool *pool, struct pool_slab *slab)
+{
+	if (pool->mesh)
+		return slab->mem;
+	return (void *)POOL_ROUND((uintptr_t)slab + sizeof(*slab), pool->slab_align);
+}
+
+// Words of the bitmap of a meshable slab.
+static size_t pool_slab_words(struct os_pool *pool)
+{
+	return (pool->slab_objs + 63) / 64;
+}
+
+// Allocates a slab and its header; NULL if either cannot be.
+static struct pool_slab *pool_slab_alloc(struct os_pool *pool)
+{
+	struct pool_slab *slab;
+
+	if (!pool->mesh) {
+		slab = os_malloc(pool->slab_size);
+		if (slab)
+			slab->mem = slab;
+		return slab;
+	}
+
+	slab = os_malloc(sizeof(*slab) + pool_slab_words(pool) * sizeof(uint64_t));
+	if (!slab)
+		return NULL;
+	slab->mem = mesh_view_map(pool->slab_size);
+	if (slab->mem == MAP_FAILED) {
+		os_free(slab);
+		return NULL;
+	}
+	memset(slab->used, 0, pool_slab_words(pool) * sizeof(uint64_t));
+	return slab;
+}
+
+// Adds a slab to the pool; its objects are constructed and chained in address order.
+// Returns -1 if the slab cannot be allocated.
+static int pool_grow(struct os_pool *pool)
+{
+	if (pool->nr_slabs == pool->max_slabs) {
+		size_t max_slabs = pool->max_slabs ? 2 * pool->max_slabs : 16;
+		struct pool_slab **slabs = os_realloc(pool->slabs, max_slabs * sizeof(*slabs));
+
+		if (!slabs)
+			return -1;
+		pool->slabs = slabs;
+		pool->max_slabs = max_slabs;
+	}
+
+	struct pool_slab *slab = pool_slab_alloc(pool);
+
+	if (!slab)
+		return -1;
+
+	size_t index = pool_slab_index(pool, slab->mem);
+
+	memmove(&pool->slabs[index + 1], &pool->slabs[index], (pool->nr_slabs - index) * sizeof(slab));
+	pool->slabs[index] = slab;
+	pool->nr_slabs++;
+
+	void *obj = pool_slab_objs(pool, slab);
+
+	slab->free = obj;
+	for (size_t i = 0; i < pool->slab_objs; i++) {
+		void *next = obj + pool->obj_size;
+
+		if (pool->ctor)
+			pool->ctor(obj);
+		if (!pool->mesh)
+			POOL_LINK(pool, obj) = (i == pool->slab_objs - 1) ? NULL : next;
+		obj = next;
+	}
+	pool->ctor_calls += pool->ctor ? pool->slab_objs : 0;
+	slab->nr_free = pool->slab_objs;
+	slab->owner = slab;
+	slab->alias = NULL;
+	slab->next = pool->partial;
+	slab->partial = 1;
+	pool->partial = slab;
+	return 0;
+}
+
+// Takes a free object of (slab), which has one.
+static void *pool_slab_take(struct os_pool *pool, struct pool_slab *slab)
+{
+	void *obj = slab->free;
+
+	if (!pool->mesh) {
+		slab->free = POOL_LINK(pool, obj);
+		return obj;
+	}
+
+	// The bits past the last object are clear too, but never the lowest clear bit.
+	size_t word = 0;
+
+	while (!~slab->used[word])
+		word++;
+
+	size_t bit = __builtin_ctzl(~slab->used[word]);
+
+	slab->used[word] |= 1UL << bit;
+	return slab->mem + (word * 64 + bit) * pool->obj_size;
+}
+
+size_t os_pool_alloc_bulk(struct os_pool *pool, void **objs, size_t n)
+{
+	size_t i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < n; i++) {
+		if (!pool->partial && pool_grow(pool))
+			break;
+
+		struct pool_slab *slab = pool->partial;
+
+		objs[i] = pool_slab_take(pool, slab);
+		// An exhausted slab comes back on the list with its first free object.
+		if (!--slab->nr_free) {
+			pool->partial = slab->next;
+			slab->partial = 0;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return i;
+}
+
+void os_pool_free_bulk(struct os_pool *pool, void **objs, size_t n)
+{
+	pthread_mutex_lock(&pool->lock);
+	for (size_t i = 0; i < n; i++) {
+		size_t index = pool_slab_index(pool, objs[i]);
+		int valid = index && (objs[i] < pool->slabs[index - 1]->mem + pool->slab_size);
+
+		if (!valid)
+			errno = EINVAL;
+		DIE(!valid, "os_pool_free");
+
+		struct pool_slab *slab = pool->slabs[index - 1];
+
+		if (pool->mesh) {
+			size_t obj = (objs[i] - slab->mem) / pool->obj_size;
+
+			slab = slab->owner;
+			slab->used[obj / 64] &= ~(1UL << (obj % 64));
+		} else {
+			POOL_LINK(pool, objs[i]) = slab->free;
+			slab->free = objs[i];
+		}
+		slab->nr_free++;
+		if (!slab->partial) {
+			slab->next = pool->partial;
+			slab->partial = 1;
+			pool->partial = slab;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void *os_pool_alloc(struct os_pool *pool)
+{
+	void *obj;
+
+	return os_pool_alloc_bulk(pool, &obj, 1) ? obj : NULL;
+}
+
+void os_pool_free(struct os_pool *pool, void *obj)
+{
+	if (obj)
+		os_pool_free_bulk(pool, &obj, 1);
+}
+
+// Destroys the objects of (slab) and frees it; a meshed slab only gives back its
+// view, its objects belong to the owner.
+static void pool_slab_release(struct os_pool *pool, struct pool_slab *slab)
+{
+	if (pool->dtor && (slab->owner == slab)) {
+		void *obj = pool_slab_objs(pool, slab);
+
+		for (size_t i = 0; i < pool->slab_objs; i++, obj += pool->obj_size)
+			pool->dtor(obj);
+		pool->dtor_calls += pool->slab_objs;
+	}
+	if (pool->mesh) {
+		if (slab->owner == slab)
+			mesh_pages_release(mesh_offset(slab->mem), pool->slab_size);
+		else
+			pool->nr_aliases--;
+		mesh_view_unmap(slab->mem, pool->slab_size);
+	}
+	os_free(slab);
+}
+
+// Releases the slabs whose objects are all free, or every slab if (all) is set;
+// returns their number, the meshed ones aside.
+static size_t pool_release(struct os_pool *pool, int all)
+{
+	size_t released = 0;
+
+	for (struct pool_slab **link = &pool->partial; *link;) {
+		if (all || ((*link)->nr_free == pool->slab_objs))
+			*link = (*link)->next;
+		else
+			link = &(*link)->next;
+	}
+
+	// Meshed slabs go first: they look at their owner.
+	for (int owners = 0; owners < 2; owners++) {
+		size_t kept = 0;
+
+		for (size_t i = 0; i < pool->nr_slabs; i++) {
+			struct pool_slab *slab = pool->slabs[i];
+
+			if (((slab->owner == slab) == owners) && (all || (slab->owner->nr_free == pool->slab_objs))) {
+				pool_slab_release(pool, slab);
+				released += owners;
+			} else {
+				pool->slabs[kept++] = slab;
+			}
+		}
+		pool->nr_slabs = kept;
+	}
+	return released;
+}
+
+static size_t pool_shrink(struct os_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	size_t released = pool_release(pool, 0);
+
+	pthread_mutex_unlock(&pool->lock);
+	return released;
+}
+
+// Slabs with fewer allocated objects first.
+static int pool_slab_cmp(const void *a, const void *b)
+{
+	const struct pool_slab *x = *(struct pool_slab *const *)a, *y = *(struct pool_slab *const *)b;
+
+	return (x->nr_free < y->nr_free) - (x->nr_free > y->nr_free);
+}
+
+// Whether no object is allocated at the same offset in (a) and (b).
+static int pool_slab_disjoint(struct os_pool *pool, struct pool_slab *a, struct pool_slab *b)
+{
+	for (size_t word = 0; word < pool_slab_words(pool); word++)
+		if (a->used[word] & b->used[word])
+			return 0;
+	return 1;
+}
+
+// Moves the objects of (src) to (dst) and maps (src) and its aliases over the
+// pages of (dst), whose objects are at other offsets.
+static void pool_slab_mesh(struct os_pool *pool, struct pool_slab *dst, struct pool_slab *src)
+{
+	for (size_t i = 0; i < pool->slab_objs; i++) {
+		void *from = src->mem + i * pool->obj_size;
+		void *to = dst->mem + i * pool->obj_size;
+
+		// The free objects of the dropped pages are destroyed, and so are
+		// those of (dst) replaced by the objects of (src).
+		if (src->used[i / 64] & (1UL << (i % 64))) {
+			if (pool->dtor)
+				pool->dtor(to);
+			memcpy(to, from, pool->obj_size);
+		} else if (pool->dtor) {
+			pool->dtor(from);
+		}
+	}
+	pool->dtor_calls += pool->dtor ? pool->slab_objs : 0;
+
+	for (size_t word = 0; word < pool_slab_words(pool); word++)
+		dst->used[word] |= src->used[word];
+	dst->nr_free -= pool->slab_objs - src->nr_free;
+
+	struct pool_slab **tail = &dst->alias;
+
+	while (*tail)
+		tail = &(*tail)->alias;
+	*tail = src;
+	for (struct pool_slab *slab = src; slab; slab = slab->alias) {
+		mesh_view_alias(slab->mem, pool->slab_size, mesh_offset(dst->mem));
+		slab->owner = dst;
+	}
+	mesh_pages_release(mesh_offset(src->mem), pool->slab_size);
+	pool->nr_aliases++;
+	pool->meshes++;
+}
+
+// Meshes the slabs of (pool) pairwise; returns the bytes given back.
+static size_t pool_mesh(struct os_pool *pool)
+{
+	size_t nr_slabs = 0, released = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!pool->mesh)
+		goto out;
+
+	// Candidates: the slabs with free and allocated objects.
+	for (struct pool_slab *slab = pool->partial; slab; slab = slab->next)
+		nr_slabs += (slab->nr_free < pool->slab_objs);
+	if (nr_slabs < 2)
+		goto out;
+
+	struct pool_slab **slabs = os_malloc(nr_slabs * sizeof(*slabs));
+
+	if (!slabs)
+		goto out;
+
+	nr_slabs = 0;
+	for (struct pool_slab *slab = pool->partial; slab; slab = slab->next)
+		if (slab->nr_free < pool->slab_objs)
+			slabs[nr_slabs++] = slab;
+	qsort(slabs, nr_slabs, sizeof(*slabs), pool_slab_cmp);
+
+	// Each slab meshes once per pass, with one of similar occupancy: the
+	// emptier of the pair moves.
+	for (size_t i = 0; i < nr_slabs; i++) {
+		for (size_t j = i + 1; slabs[i] && (j < nr_slabs) && (j <= i + POOL_MESH_PROBES); j++) {
+			if (!slabs[j] ||
+				(2 * pool->slab_objs - slabs[i]->nr_free - slabs[j]->nr_free > pool->slab_objs) ||
+				!pool_slab_disjoint(pool, slabs[i], slabs[j]))
+				continue;
+			pool_slab_mesh(pool, slabs[j], slabs[i]);
+			released += pool->slab_size;
+			slabs[i] = slabs[j] = NULL;
+		}
+	}
+	os_free(slabs);
+
+	// The meshed slabs and the slabs they filled leave the partial list.
+	for (struct pool_slab **link = &pool->partial; *link;) {
+		if (((*link)->owner != *link) || !(*link)->nr_free) {
+			(*link)->partial = 0;
+			*link = (*link)->next;
+		} else {
+			link = &(*link)->next;
+		}
+	}
+out:
+	pthread_mutex_unlock(&pool->lock);
+	return released;
+}
+
+size_t os_pool_mesh(struct os_pool *pool)
+{
+	return pool_mesh(pool);
+}
+
+void os_pool_destroy(struct os_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pool_release(pool, 1);
+	os_free(pool->slabs);
+	pthread_mutex_destroy(&pool->lock);
+	os_free(pool);
+}
+
+// OBJECT CACHES
+
+struct os_cache *os_cache_create(const char *name, size_t size, size_t align,
+								 void (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	if (!align)
+		align = ALIGNMENT;
+	if ((align & (align - 1)) || (align > CACHE_ALIGN_MAX)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct os_cache *cache = os_malloc(sizeof(*cache));
+
+	if (!cache)
+		return NULL;
+
+	cache->pool = pool_create(size, (align < ALIGNMENT) ? ALIGNMENT : align, ctor, dtor);
+	if (!cache->pool) {
+		os_free(cache);
+		return NULL;
+	}
+	snprintf(cache->name, sizeof(cache->name), "%s", name ? name : "");
+	cache->size = size;
+	cache->allocs = 0;
+	cache->frees = 0;
+
+	return cache;
+}
+
+void *os_cache_alloc(struct os_cache *cache)
+{
+	void *obj = os_pool_alloc(cache->pool);
+
+	if (obj)
+		__atomic_fetch_add(&cache->allocs, 1, __ATOMIC_RELAXED);
+	return obj;
+}
+
+void os_cache_free(struct os_cache *cache, void *obj)
+{
+	if (!obj)
+		return;
+
+	os_pool_free(cache->pool, obj);
+	__atomic_fetch_add(&cache->frees, 1, __ATOMIC_RELAXED);
+}
+
+size_t os_cache_shrink(struct os_cache *cache)
+{
+	return pool_shrink(cache->pool);
+}
+
+size_t os_cache_mesh(struct os_cache *cache)
+{
+	return pool_mesh(cache->pool);
+}
+
+void os_cache_stats_get(struct os_cache *cache, struct os_cache_stats *stats)
+{
+	struct os_pool *pool = cache->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	stats->name = cache->name;
+	stats->size = cache->size;
+	stats->obj_size = pool->obj_size;
+	stats->allocs = __atomic_load_n(&cache->allocs, __ATOMIC_RELAXED);
+	stats->frees = __atomic_load_n(&cache->frees, __ATOMIC_RELAXED);
+	stats->slabs = pool->nr_slabs - pool->nr_aliases;
+	stats->objects = stats->slabs * pool->slab_objs;
+	stats->meshes = pool->meshes;
+	stats->ctor_calls = pool->ctor_calls;
+	stats->dtor_calls = pool->dtor_calls;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void os_cache_destroy(struct os_cache *cache)
+{
+	if (!cache)
+		return;
+
+	os_pool_destroy(cache->pool);
+	os_free(cache);
+}
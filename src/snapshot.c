@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// memfd-backed heap and copy-on-write snapshots.
+//
+// With the "heap_memfd" option the heap is a MAP_SHARED view of a memfd placed
+// in a reserved address range instead of the program break. A snapshot remaps
+// the live heap MAP_PRIVATE over the same file: from then on the writers fault
+// private copies of the pages they modify and the file keeps the contents of
+// the heap at the time of the snapshot, which a second read-only view exposes.
+// Releasing the snapshot writes the modified pages back to the file and maps
+// the heap shared again.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+// Flags of a /proc/self/pagemap entry.
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_FILE    (1ULL << 61)
+
+// Pagemap entries read at once while folding a snapshot back.
+#define PAGEMAP_BATCH 512
+
+static int heap_fd = -1;
+static void *heap_base;		// start of the reserved range
+static size_t heap_len;		// bytes between heap_base and the break
+static size_t heap_mapped;	// page aligned prefix of the range mapped from the file
+
+// Active snapshot; heap pages below snap_len are mapped MAP_PRIVATE.
+static void *snap_view;
+static size_t snap_len;
+
+static void *memfd_heap_init(void)
+{
+	heap_fd = memfd_create("osmem-heap", MFD_CLOEXEC);
+	if (heap_fd < 0)
+		return (void *)-1;
+
+	heap_base = mmap(NULL, osmem_conf.heap_reserve, PROT_NONE,
+					 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (heap_base == MAP_FAILED) {
+		close(heap_fd);
+		heap_fd = -1;
+		return (void *)-1;
+	}
+	return heap_base;
+}
+
+// sbrk() for the memfd heap: the file grows with the break, page by page.
+void *memfd_sbrk(intptr_t increment)
+{
+	size_t page_size = (size_t)getpagesize();
+	void *old_brk;
+
+	if ((heap_fd < 0) && (memfd_heap_init() == (void *)-1))
+		return (void *)-1;
+
+	old_brk = heap_base + heap_len;
+	if (!increment)
+		return old_brk;
+
+	if ((increment > 0) && (heap_len + increment > osmem_conf.heap_reserve)) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	if ((increment < 0) && ((size_t)-increment > heap_len)) {
+		errno = EINVAL;
+		return (void *)-1;
+	}
+
+	size_t new_len = heap_len + increment;
+	size_t new_mapped = (new_len + page_size - 1) & ~(page_size - 1);
+
+	if (new_mapped > heap_mapped) {
+		// The file is never shorter than an active snapshot, whose pages it keeps.
+		size_t private_end = (snap_len < new_mapped) ? snap_len : new_mapped;
+		size_t shared_start = (snap_len > heap_mapped) ? snap_len : heap_mapped;
+
+		if ((new_mapped > snap_len) && ftruncate(heap_fd, new_mapped))
+			return (void *)-1;
+		// Pages regrown below snap_len are copied on write, as os_heap_snapshot()
+		// maps the heap, so that the snapshot keeps reading the file.
+		if ((private_end > heap_mapped) &&
+			(mmap(heap_base + heap_mapped, private_end - heap_mapped, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_FIXED, heap_fd, heap_mapped) == MAP_FAILED))
+			return (void *)-1;
+		if ((new_mapped > shared_start) &&
+			(mmap(heap_base + shared_start, new_mapped - shared_start, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_FIXED, heap_fd, shared_start) == MAP_FAILED))
+			return (void *)-1;
+	} else if (new_mapped < heap_mapped) {
+		// Give the pages back to the reservation; the file keeps them for an
+		// active snapshot and is shrunk otherwise.
+		if (mmap(heap_base + new_mapped, heap_mapped - new_mapped, PROT_NONE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED)
+			return (void *)-1;
+		if (!snap_view && ftruncate(heap_fd, new_mapped))
+			return (void *)-1;
+	}
+
+	heap_len = new_len;
+	heap_mapped = new_mapped;
+	return old_brk;
+}
+
+int os_heap_snapshot(struct os_heap_snapshot *snap)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&heap_lock);
+
+	if (!osmem_conf.heap_memfd || (heap_fd < 0)) {
+		errno = EINVAL;
+		goto out;
+	}
+	if (snap_view) {
+		errno = EBUSY;
+		goto out;
+	}
+
+	// The file stops following the heap once the heap is private.
+	if (mmap(heap_base, heap_mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+			 heap_fd, 0) == MAP_FAILED)
+		goto out;
+
+	snap_view = mmap(NULL, heap_mapped, PROT_READ, MAP_PRIVATE, heap_fd, 0);
+	DIE(snap_view == MAP_FAILED, "mmap");
+	snap_len = heap_mapped;
+
+	snap->data = snap_view;
+	snap->size = heap_len;
+	snap->heap = heap_base;
+	ret = 0;
+out:
+	pthread_mutex_unlock(&heap_lock);
+	return ret;
+}
+
+// Writes the heap pages modified since the snapshot(private anonymous copies
+// in the pagemap) back to the file.
+static void snapshot_fold(size_t len)
+{
+	size_t page_size = (size_t)getpagesize();
+	size_t pages = len / page_size;
+	uint64_t entries[PAGEMAP_BATCH];
+	int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+	DIE(fd < 0, "open");
+
+	for (size_t first = 0; first < pages; first += PAGEMAP_BATCH) {
+		size_t n = (pages - first < PAGEMAP_BATCH) ? pages - first : PAGEMAP_BATCH;
+		off_t offset = ((uintptr_t)heap_base / page_size + first) * sizeof(uint64_t);
+
+		DIE(pread(fd, entries, n * sizeof(uint64_t), offset) != (ssize_t)(n * sizeof(uint64_t)), "pread");
+
+		for (size_t i = 0; i < n; i++) {
+			if (!(entries[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) || (entries[i] & PAGEMAP_FILE))
+				continue;
+
+			off_t page = (first + i) * page_size;
+
+			DIE(pwrite(heap_fd, heap_base + page, page_size, page) != (ssize_t)page_size, "pwrite");
+		}
+	}
+	close(fd);
+}
+
+void os_heap_snapshot_release(struct os_heap_snapshot *snap)
+{
+	pthread_mutex_lock(&heap_lock);
+
+	if (!snap_view || (snap->data != snap_view)) {
+		pthread_mutex_unlock(&heap_lock);
+		return;
+	}
+
+	// Pages above the break were dropped while the snapshot was active.
+	size_t len = (snap_len < heap_mapped) ? snap_len : heap_mapped;
+
+	snapshot_fold(len);
+	DIE(mmap(heap_base, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, heap_fd, 0) == MAP_FAILED,
+		"mmap");
+	munmap(snap_view, snap_len);
+	DIE(ftruncate(heap_fd, heap_mapped), "ftruncate");
+
+	snap_view = NULL;
+	snap_len = 0;
+	snap->data = NULL;
+	pthread_mutex_unlock(&heap_lock);
+}
+
+void os_heap_snapshot_walk(const struct os_heap_snapshot *snap,
+						   void (*fn)(const void *payload, size_t size, void *arg), void *arg)
+{
+	const void *heap_end = snap->heap + snap->size;
+	const TBlock_meta *cell = snap->heap;
+
+	// Block headers hold live heap addresses, translated into the snapshot.
+	while (((const void *)cell >= snap->heap) && ((const void *)cell < heap_end)) {
+		const TBlock_meta *copy = snap->data + ((const void *)cell - snap->heap);
+
+		if (copy->status == STATUS_ALLOC)
+			fn((const void *)copy + META_DATA_SIZE, copy->size, arg);
+		cell = copy->next;
+	}
+}
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Medium blocks carved from super-chunks.
+//
+// With the "span_max" option the blocks that would get a mapping of their own
+// and are smaller than span_max become spans: runs of whole pages taken from
+// 32 MB chunks mapped once. A span starts with the usual block header(status
+// STATUS_SPAN, prev pointing to its chunk) and is freed without a syscall.
+//
+// Each chunk keeps a tag for the first and the last page of every run, free or
+// not, in a page map at its start: freeing a span merges it with the free runs
+// around it in constant time and without touching their pages. A chunk whose
+// pages are all free is unmapped, unless it is the last one.
+//
+// span_calloc() only clears the pages that were handed out before: the pages
+// of a chunk above its high-water mark are still the zeroes of the mapping,
+// and whole dirty pages are given back to the kernel instead of cleared.
+//
+// Every function is called with heap_lock held.
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+#define SPAN_CHUNK_SIZE (32UL << 20)
+
+// Dirty pages of a zeroed span that are dropped with MADV_DONTNEED rather than
+// cleared: below it the page faults cost more than the memset.
+#define SPAN_DONTNEED_PAGES 16
+
+// Run tags: the length in pages and whether the run is free.
+#define SPAN_TAG(pages, free) (((uint32_t)(pages) << 1) | (free))
+#define SPAN_PAGES(tag) ((tag) >> 1)
+#define SPAN_FREE(tag) ((tag) & 1)
+
+struct span_chunk {
+	struct span_chunk *next;
+	size_t pages;		/* pages in the chunk */
+	size_t first;		/* first page after the chunk header and page map */
+	size_t free_pages;
+	size_t clean;		/* pages from this one up were never handed out */
+	uint32_t map[];		/* tags of the first and last page of each run */
+};
+
+static struct span_chunk *span_chunks;
+
+// Marks pages [first, first + pages) as one run.
+static void span_set_run(struct span_chunk *chunk, size_t first, size_t pages, int free)
+{
+	chunk->map[first] = SPAN_TAG(pages, free);
+	chunk->map[first + pages - 1] = SPAN_TAG(pages, free);
+}
+
+static struct span_chunk *span_chunk_map(void)
+{
+	size_t page_size = (size_t)getpagesize();
+	struct span_chunk *chunk = map_pages(SPAN_CHUNK_SIZE, MAP_PRIVATE | MAP_ANONYMOUS);
+
+	DIE(chunk == MAP_FAILED, "mmap");
+	STAT_ADD(mmap_calls, 1);
+	STAT_ADD(mapped_size, SPAN_CHUNK_SIZE);
+	STAT_ADD(span_chunks, 1);
+	if (osmem_conf.stats && (osmem_stats.mapped_size > osmem_stats.peak_mapped_size))
+		osmem_stats.peak_mapped_size = osmem_stats.mapped_size;
+
+	chunk->pages = SPAN_CHUNK_SIZE / page_size;
+	chunk->first = (sizeof(*chunk) + chunk->pages * sizeof(uint32_t) + page_size - 1) / page_size;
+	chunk->free_pages = chunk->pages - chunk->first;
+	chunk->clean = chunk->first;
+	span_set_run(chunk, chunk->first, chunk->free_pages, 1);
+
+	chunk->next = span_chunks;
+	span_chunks = chunk;
+	return chunk;
+}
+
+// Pages of a span holding a block of (size) bytes.
+static size_t span_pages(size_t size)
+{
+	size_t page_size = (size_t)getpagesize();
+
+	return (META_DATA_SIZE + SIZE_ALIGN(size) + page_size - 1) / page_size;
+}
+
+// Turns the start of the free run at (first) into a span of (pages) pages.
+static void span_take(struct span_chunk *chunk, size_t first, size_t pages)
+{
+	size_t run = SPAN_PAGES(chunk->map[first]);
+
+	span_set_run(chunk, first, pages, 0);
+	if (run > pages)
+		span_set_run(chunk, first + pages, run - pages, 1);
+	chunk->free_pages -= pages;
+	if (first + pages > chunk->clean)
+		chunk->clean = first + pages;
+}
+
+// Frees pages [first, first + pages) and merges them with the free runs around.
+static void span_release(struct span_chunk *chunk, size_t first, size_t pages)
+{
+	chunk->free_pages += pages;
+
+	size_t end = first + pages;
+
+	if ((end < chunk->pages) && SPAN_FREE(chunk->map[end]))
+		pages += SPAN_PAGES(chunk->map[end]);
+	if ((first > chunk->first) && SPAN_FREE(chunk->map[first - 1])) {
+		size_t before = SPAN_PAGES(chunk->map[first - 1]);
+
+		first -= before;
+		pages += before;
+	}
+	span_set_run(chunk, first, pages, 1);
+}
+
+static size_t span_index(struct span_chunk *chunk, TBlock_meta *cell)
+{
+	return ((void *)cell - (void *)chunk) / (size_t)getpagesize();
+}
+
+// Finds a free run of (pages) pages, mapping a new chunk if none has one.
+static struct span_chunk *span_find(size_t pages, size_t *run)
+{
+	struct span_chunk *chunk;
+	size_t first = 0;
+
+	// First fit in address order, the chunks mapped last first.
+	for (chunk = span_chunks; chunk; chunk = chunk->next) {
+		if (chunk->free_pages < pages)
+			continue;
+		for (first = chunk->first; first < chunk->pages; first += SPAN_PAGES(chunk->map[first]))
+			if (SPAN_FREE(chunk->map[first]) && (SPAN_PAGES(chunk->map[first]) >= pages))
+				break;
+		if (first < chunk->pages)
+			break;
+	}
+	if (!chunk) {
+		chunk = span_chunk_map();
+		first = chunk->first;
+	}
+	*run = first;
+	return chunk;
+}
+
+// Hands out the span of (size) bytes at page (first) of (chunk).
+static void *span_make(struct span_chunk *chunk, size_t first, size_t size)
+{
+	size_t pages = span_pages(size);
+
+	span_take(chunk, first, pages);
+	STAT_ADD(span_size, pages * (size_t)getpagesize());
+
+	TBlock_meta *cell = (void *)chunk + first * (size_t)getpagesize();
+
+	cell->status = STATUS_SPAN;
+	cell->size = SIZE_ALIGN(size);
+	cell->prev = (TBlock_meta *)chunk;
+	cell->next = NULL;
+	return (void *)cell + META_DATA_SIZE;
+}
+
+void *span_alloc(size_t size)
+{
+	size_t pages = span_pages(size);
+	size_t first;
+
+	if (pages > SPAN_CHUNK_SIZE / (size_t)getpagesize() / 2)
+		return NULL;
+
+	struct span_chunk *chunk = span_find(pages, &first);
+
+	return span_make(chunk, first, size);
+}
+
+void *span_calloc(size_t size)
+{
+	size_t page_size = (size_t)getpagesize();
+	size_t pages = span_pages(size);
+	size_t first;
+
+	if (pages > SPAN_CHUNK_SIZE / page_size / 2)
+		return NULL;
+
+	struct span_chunk *chunk = span_find(pages, &first);
+	size_t clean = chunk->clean;
+	void *payload = span_make(chunk, first, size);
+	size_t dirty = (clean > first) ? ((clean < first + pages) ? clean : first + pages) - first : 0;
+
+	// The first page holds the header; the dirty pages after it may be dropped.
+	void *page = (void *)chunk + (first + 1) * page_size;
+	size_t clear = dirty ? (size_t)((void *)chunk + (first + dirty) * page_size - payload) : 0;
+
+	if ((dirty > SPAN_DONTNEED_PAGES) && !madvise(page, (dirty - 1) * page_size, MADV_DONTNEED))
+		clear = page - payload;
+	if (clear > SIZE_ALIGN(size))
+		clear = SIZE_ALIGN(size);
+	memset(payload, 0, clear);
+	STAT_ADD(calloc_zero_skipped, SIZE_ALIGN(size) - clear);
+	return payload;
+}
+
+void span_free(TBlock_meta *cell)
+{
+	struct span_chunk *chunk = (struct span_chunk *)cell->prev;
+	size_t first = span_index(chunk, cell);
+	size_t pages = SPAN_PAGES(chunk->map[first]);
+
+	cell->status = STATUS_FREE;
+	span_release(chunk, first, pages);
+	STAT_ADD(span_size, -pages * (size_t)getpagesize());
+
+	if ((chunk->free_pages < chunk->pages - chunk->first) || (span_chunks == chunk && !chunk->next))
+		return;
+
+	// An empty chunk goes back to the system while another one remains.
+	struct span_chunk **link = &span_chunks;
+
+	while (*link != chunk)
+		link = &(*link)->next;
+	*link = chunk->next;
+	unmap_pages(chunk, SPAN_CHUNK_SIZE);
+	STAT_ADD(munmap_calls, 1);
+	STAT_ADD(mapped_size, -SPAN_CHUNK_SIZE);
+	STAT_ADD(span_chunks, -1);
+}
+
+int span_resize(TBlock_meta *cell, size_t size)
+{
+	struct span_chunk *chunk = (struct span_chunk *)cell->prev;
+	size_t first = span_index(chunk, cell);
+	size_t pages = SPAN_PAGES(chunk->map[first]);
+	size_t new_pages = span_pages(size);
+	size_t page_size = (size_t)getpagesize();
+
+	if (new_pages < pages) {
+		// The tail pages become free.
+		span_set_run(chunk, first, new_pages, 0);
+		span_release(chunk, first + new_pages, pages - new_pages);
+		STAT_ADD(span_size, -(pages - new_pages) * page_size);
+	} else if (new_pages > pages) {
+		size_t end = first + pages;
+
+		// The free run that follows must cover the missing pages.
+		if ((end == chunk->pages) || !SPAN_FREE(chunk->map[end]) ||
+			(pages + SPAN_PAGES(chunk->map[end]) < new_pages))
+			return -1;
+		span_take(chunk, end, new_pages - pages);
+		span_set_run(chunk, first, new_pages, 0);
+		STAT_ADD(span_size, (new_pages - pages) * page_size);
+	}
+	cell->size = SIZE_ALIGN(size);
+	return 0;
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Allocator counters and the call trace recorder.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "osmem_internal.h"
+
+// Size of the trace buffer, flushed with a single write when full.
+#define TRACE_BUF_SIZE (64 * 1024)
+
+struct osmem_stats osmem_stats;
+
+int trace_fd = -1;
+pthread_mutex_t trace_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static char trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len;
+
+// Writes a message to stderr without allocating.
+void osmem_log(const char *format, ...)
+{
+	char buf[512];
+	va_list args;
+
+	va_start(args, format);
+	int len = vsnprintf(buf, sizeof(buf), format, args);
+
+	va_end(args);
+	if (len > (int)sizeof(buf) - 1)
+		len = sizeof(buf) - 1;
+	if (write(STDERR_FILENO, buf, len) < 0)
+		return;
+}
+
+void os_stats_get(struct osmem_stats *stats)
+{
+	_Static_assert(sizeof(stats->tcache_capacity) / sizeof(stats->tcache_capacity[0]) == OSMEM_MAX_CLASSES,
+				   "one capacity per size class");
+
+	pthread_mutex_lock(&heap_lock);
+	*stats = osmem_stats;
+	stats->tcache_capacity_size = tcache_capacity(stats->tcache_capacity);
+	pthread_mutex_unlock(&heap_lock);
+}
+
+void os_stats_print(void)
+{
+	struct osmem_stats stats;
+
+	os_stats_get(&stats);
+	osmem_log("osmem: malloc %lu calloc %lu realloc %lu free %lu tcache hits %lu\n",
+			  stats.malloc_calls, stats.calloc_calls, stats.realloc_calls, stats.free_calls,
+			  stats.tcache_hits);
+	osmem_log("osmem: sbrk %lu mmap %lu munmap %lu heap %zu mapped %zu peak mapped %zu\n",
+			  stats.sbrk_calls, stats.mmap_calls, stats.munmap_calls, stats.heap_size,
+			  stats.mapped_size, stats.peak_mapped_size);
+	osmem_log("osmem: realloc in place %lu moved %lu copied %zu remapped %zu\n",
+			  stats.realloc_in_place, stats.realloc_moves, stats.realloc_copied, stats.realloc_remapped);
+	osmem_log("osmem: heap trims %lu deferred frees %lu tcache stolen %lu scavenged %lu\n", stats.heap_trims,
+			  stats.deferred_frees, stats.tcache_stolen, stats.tcache_scavenged);
+	if (osmem_conf.tcache_budget) {
+		char buf[OSMEM_MAX_CLASSES * 12];
+		int len = 0;
+
+		for (int i = 0; i < osmem_conf.nr_classes; i++)
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%lu", i ? "/" : "", stats.tcache_capacity[i]);
+		osmem_log("osmem: tcache misses %lu overflows %lu moved %zu capacity %zu (%s)\n", stats.tcache_misses,
+				  stats.tcache_overflows, stats.tcache_budget_moved, stats.tcache_capacity_size, buf);
+	}
+	if (stats.group_regions || stats.near_hits)
+		osmem_log("osmem: group regions %lu near hits %lu\n", stats.group_regions, stats.near_hits);
+	if (osmem_conf.calloc_heap)
+		osmem_log("osmem: calloc zeroing skipped %zu\n", stats.calloc_zero_skipped);
+	if (osmem_conf.span_max)
+		osmem_log("osmem: span chunks %lu spans %zu\n", stats.span_chunks, stats.span_size);
+}
+
+// Opens the trace file named by the "trace" option.
+void trace_record_open(void)
+{
+	trace_fd = open(osmem_conf.trace, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace_fd < 0)
+		osmem_log("osmem: cannot open trace file '%s'\n", osmem_conf.trace);
+}
+
+// Writes out the buffered trace lines; the caller holds trace_lock.
+static void trace_write(void)
+{
+	size_t done = 0;
+
+	while (done < trace_len) {
+		ssize_t ret = write(trace_fd, trace_buf + done, trace_len - done);
+
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+	trace_len = 0;
+}
+
+// Appends one line(ids are block addresses) to the trace.
+void trace_record(const char *format, ...)
+{
+	va_list args;
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_len + 128 > TRACE_BUF_SIZE)
+		trace_write();
+
+	va_start(args, format);
+	trace_len += vsnprintf(trace_buf + trace_len, TRACE_BUF_SIZE - trace_len, format, args);
+	va_end(args);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_record_flush(void)
+{
+	if (trace_fd < 0)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_write();
+	pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,506 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Per-thread caches of recently freed small blocks, one LIFO list per size class.
+// Cached blocks stay allocated from the heap point of view, so the fast paths
+// never take heap_lock.
+//
+// A heap about to grow first reclaims half of every thread's cached blocks, and
+// the caches of exited threads are moved to a global pool the other threads
+// refill from, so blocks parked in the cache of an idle thread are not lost.
+//
+// With the "tcache_idle_ms" option the heap slow path also scavenges the caches
+// once per period: every cache operation bumps a generation counter, and a
+// cache whose generation has not moved since the previous pass is emptied into
+// the heap. The owner and the scavenger meet on the cache lock, which neither
+// waits for: a thread finding its cache being scavenged uses the heap, and a
+// cache in use is skipped until the next pass.
+//
+// With the "tcache_budget" option the depth of a class is only its upper bound:
+// each thread starts with no capacity and gains a block of it on every miss(a
+// get finding the bin empty) or overflow(a put finding it full). The capacity
+// is charged to the thread's share of the budget, which grows from the
+// unclaimed budget or, once it is all claimed, is taken from the other threads
+// round robin. Every TCACHE_ADAPT_OPS operations, the classes whose bins never
+// emptied during the period lose half of their lowest count, and the share not
+// covered by capacity goes back to the budget: the capacity of cold threads and
+// classes moves to the hot ones. Blocks above a lowered capacity are used up
+// first, or taken back by a reclaim or a scavenging pass.
+
+#include <time.h>
+
+#include "osmem_internal.h"
+
+// Operations of a thread between two adaptations of its capacities.
+#define TCACHE_ADAPT_OPS 1024
+
+// Smallest share of the budget claimed or given back at once.
+#define TCACHE_BUDGET_STEP (8 * 1024)
+
+// Free blocks of one thread, chained through their first payload word.
+struct tcache {
+	void *bins[OSMEM_MAX_CLASSES];
+	unsigned int count[OSMEM_MAX_CLASSES];
+	int lock;		/* held by the owner during an operation or by a reclaiming thread */
+	int registered;
+	unsigned long gen;	/* operations of the owner */
+	unsigned long scavenge_gen;	/* generation seen by the last scavenging pass */
+	unsigned int cap[OSMEM_MAX_CLASSES];	/* blocks cached at most, with tcache_budget */
+	unsigned int low[OSMEM_MAX_CLASSES];	/* lowest count since the last adaptation */
+	size_t cap_size;	/* bytes of capacity, sum of cap times the class sizes */
+	size_t max_size;	/* share of the budget, lowered by other threads */
+	unsigned long next_adapt;	/* generation of the next adaptation */
+	struct tcache *next;	/* list of the live thread caches */
+	struct tcache *prev;
+};
+
+static __thread struct tcache tcache;
+
+// Live thread caches, walked by tcache_reclaim().
+static struct tcache tcache_list = {.next = &tcache_list, .prev = &tcache_list};
+static pthread_mutex_t tcache_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Budget claimed by the live threads, and the next thread to take capacity from.
+static size_t budget_used;
+static struct tcache *steal_next;
+
+// Blocks left by exited threads.
+static struct tcache orphans;
+static pthread_mutex_t orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+static int tcache_trylock(struct tcache *tc)
+{
+	return !__atomic_exchange_n(&tc->lock, 1, __ATOMIC_ACQUIRE);
+}
+
+static void tcache_unlock(struct tcache *tc)
+{
+	__atomic_store_n(&tc->lock, 0, __ATOMIC_RELEASE);
+}
+
+// Moves (n) blocks of (class) from the head of (from) to (to).
+static void tcache_move(struct tcache *from, struct tcache *to, int class, unsigned int n)
+{
+	for (unsigned int i = 0; i < n; i++) {
+		void *payload = from->bins[class];
+
+		from->bins[class] = *(void **)payload;
+		*(void **)payload = to->bins[class];
+		to->bins[class] = payload;
+	}
+	from->count[class] -= n;
+	to->count[class] += n;
+}
+
+// Gives the whole share of (tc) back to the budget.
+static void tcache_share_drop(struct tcache *tc)
+{
+	size_t max_size = __atomic_exchange_n(&tc->max_size, 0, __ATOMIC_RELAXED);
+
+	__atomic_fetch_sub(&budget_used, max_size, __ATOMIC_RELAXED);
+	for (int class = 0; class < OSMEM_MAX_CLASSES; class++)
+		tc->cap[class] = 0;
+	tc->cap_size = 0;
+}
+
+// Thread exit: hands the cached blocks over to the orphan pool.
+static void tcache_exit(void *arg)
+{
+	struct tcache *tc = arg;
+
+	pthread_mutex_lock(&tcache_list_lock);
+	tc->prev->next = tc->next;
+	tc->next->prev = tc->prev;
+	if (steal_next == tc)
+		steal_next = tc->next;
+	pthread_mutex_unlock(&tcache_list_lock);
+
+	// A reclaiming thread may still be emptying the cache.
+	while (!tcache_trylock(tc))
+		;
+
+	pthread_mutex_lock(&orphans_lock);
+	for (int class = 0; class < OSMEM_MAX_CLASSES; class++)
+		tcache_move(tc, &orphans, class, tc->count[class]);
+	pthread_mutex_unlock(&orphans_lock);
+
+	tcache_share_drop(tc);
+	tc->registered = 0;
+	tcache_unlock(tc);
+}
+
+static void tcache_key_create(void)
+{
+	pthread_key_create(&tcache_key, tcache_exit);
+}
+
+// Makes the cache of the calling thread visible to tcache_reclaim().
+static void tcache_register(struct tcache *tc)
+{
+	pthread_once(&tcache_once, tcache_key_create);
+	pthread_setspecific(tcache_key, tc);
+
+	pthread_mutex_lock(&tcache_list_lock);
+	tc->next = &tcache_list;
+	tc->prev = tcache_list.prev;
+	tcache_list.prev->next = tc;
+	tcache_list.prev = tc;
+	pthread_mutex_unlock(&tcache_list_lock);
+
+	tc->registered = 1;
+}
+
+// Returns the index of the smallest class that can hold (size) bytes, or -1.
+static int tcache_class(size_t size)
+{
+	int low = 0, high = osmem_conf.nr_classes - 1;
+
+	if ((high < 0) || (size > osmem_conf.classes[high]))
+		return -1;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+
+		if (osmem_conf.classes[mid] < size)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+// Returns the class size a request of (size) bytes is rounded up to,
+// or 0 if the request bypasses the size classes.
+size_t tcache_class_size(size_t size)
+{
+	int class = tcache_class(size);
+
+	if ((class < 0) || (osmem_conf.classes[class] >= osmem_conf.mmap_threshold))
+		return 0;
+	return osmem_conf.classes[class];
+}
+
+// Class of every small size, by multiple of ALIGNMENT(see os_malloc_small).
+signed char tcache_index[OSMEM_SMALL_INDEX(OSMEM_SMALL_MAX) + 1];
+
+// Rebuilds tcache_index from the configuration.
+void tcache_index_build(void)
+{
+	for (size_t i = 0; i <= OSMEM_SMALL_INDEX(OSMEM_SMALL_MAX); i++)
+		tcache_index[i] = (i && tcache_class_size(i * ALIGNMENT)) ? tcache_class(i * ALIGNMENT) : -1;
+}
+
+// Blocks of (class) that (tc) may cache.
+static unsigned int tcache_cap(struct tcache *tc, int class)
+{
+	return osmem_conf.tcache_budget ? tc->cap[class] : osmem_conf.tcache_depth[class];
+}
+
+// Lowers the share of (tc) by (bytes) if it has them; returns 1 if it did.
+static int tcache_share_take(struct tcache *tc, size_t bytes)
+{
+	size_t max_size = __atomic_load_n(&tc->max_size, __ATOMIC_RELAXED);
+
+	while (max_size >= bytes)
+		if (__atomic_compare_exchange_n(&tc->max_size, &max_size, max_size - bytes, 1, __ATOMIC_RELAXED,
+										__ATOMIC_RELAXED))
+			return 1;
+	return 0;
+}
+
+// Adds (bytes) to the share of (tc), from the unclaimed budget or from the
+// share of another thread. Returns -1 if no thread has that much.
+static int tcache_claim(struct tcache *tc, size_t bytes)
+{
+	size_t used = __atomic_load_n(&budget_used, __ATOMIC_RELAXED);
+
+	while (used + bytes <= osmem_conf.tcache_budget)
+		if (__atomic_compare_exchange_n(&budget_used, &used, used + bytes, 1, __ATOMIC_RELAXED,
+										__ATOMIC_RELAXED))
+			goto out;
+
+	int ret = -1;
+
+	pthread_mutex_lock(&tcache_list_lock);
+	struct tcache *start = steal_next ? steal_next : tcache_list.next;
+	struct tcache *victim = start;
+
+	do {
+		if ((victim != &tcache_list) && (victim != tc) && tcache_share_take(victim, bytes)) {
+			steal_next = victim->next;
+			ret = 0;
+			break;
+		}
+		victim = victim->next;
+	} while (victim != start);
+	pthread_mutex_unlock(&tcache_list_lock);
+
+	if (ret)
+		return -1;
+	STAT_ADD(tcache_budget_moved, bytes);
+out:
+	__atomic_fetch_add(&tc->max_size, bytes, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// Lowers the capacities of (tc), largest first, until its share covers them.
+static void tcache_fit(struct tcache *tc)
+{
+	while (tc->cap_size > __atomic_load_n(&tc->max_size, __ATOMIC_RELAXED)) {
+		int largest = 0;
+
+		for (int class = 1; class < osmem_conf.nr_classes; class++)
+			if (tc->cap[class] * osmem_conf.classes[class] > tc->cap[largest] * osmem_conf.classes[largest])
+				largest = class;
+		tc->cap[largest]--;
+		tc->cap_size -= osmem_conf.classes[largest];
+	}
+}
+
+// Raises the capacity of (class) by one block after a miss or an overflow,
+// within the depth of the class and the budget.
+static void tcache_grow(struct tcache *tc, int class)
+{
+	size_t size = osmem_conf.classes[class];
+	size_t step = (osmem_conf.tcache_budget < TCACHE_BUDGET_STEP) ? size : TCACHE_BUDGET_STEP;
+
+	if (tc->cap[class] >= osmem_conf.tcache_depth[class])
+		return;
+	if (!tc->registered)
+		tcache_register(tc);
+
+	if ((tc->cap_size + size > __atomic_load_n(&tc->max_size, __ATOMIC_RELAXED)) &&
+		tcache_claim(tc, size > step ? size : step))
+		return;
+	tc->cap[class]++;
+	tc->cap_size += size;
+	tcache_fit(tc);
+}
+
+// Shrinks the classes that kept blocks unused for the whole period and gives
+// the spare share back to the budget.
+static void tcache_adapt(struct tcache *tc)
+{
+	for (int class = 0; class < osmem_conf.nr_classes; class++) {
+		unsigned int drop = (tc->low[class] + 1) / 2;
+
+		if (drop > tc->cap[class])
+			drop = tc->cap[class];
+		tc->cap[class] -= drop;
+		tc->cap_size -= drop * osmem_conf.classes[class];
+		tc->low[class] = tc->count[class];
+	}
+	tcache_fit(tc);
+
+	size_t max_size = __atomic_load_n(&tc->max_size, __ATOMIC_RELAXED);
+
+	// One step is kept so that the next growth does not claim again.
+	if (max_size > tc->cap_size + TCACHE_BUDGET_STEP) {
+		size_t spare = max_size - tc->cap_size - TCACHE_BUDGET_STEP;
+
+		if (tcache_share_take(tc, spare))
+			__atomic_fetch_sub(&budget_used, spare, __ATOMIC_RELAXED);
+	}
+	tc->next_adapt = tc->gen + TCACHE_ADAPT_OPS;
+}
+
+// Refills an empty bin with up to half its capacity from the orphan pool.
+static void tcache_adopt(struct tcache *tc, int class)
+{
+	unsigned int n = (tcache_cap(tc, class) + 1) / 2;
+
+	pthread_mutex_lock(&orphans_lock);
+	if (n > orphans.count[class])
+		n = orphans.count[class];
+	tcache_move(&orphans, tc, class, n);
+	pthread_mutex_unlock(&orphans_lock);
+
+	STAT_ADD(tcache_stolen, n);
+}
+
+// Pops a cached block of (class); returns its payload or NULL.
+void *tcache_get_class(int class)
+{
+	void *payload = NULL;
+
+	// The cache is being reclaimed, use the heap.
+	if (!tcache_trylock(&tcache))
+		return NULL;
+
+	if (!tcache.bins[class]) {
+		if (osmem_conf.tcache_budget) {
+			STAT_ADD(tcache_misses, 1);
+			tcache_grow(&tcache, class);
+		}
+		if (__atomic_load_n(&orphans.count[class], __ATOMIC_RELAXED))
+			tcache_adopt(&tcache, class);
+	}
+
+	payload = tcache.bins[class];
+	if (payload) {
+		tcache.bins[class] = *(void **)payload;
+		tcache.count[class]--;
+		if (tcache.count[class] < tcache.low[class])
+			tcache.low[class] = tcache.count[class];
+	}
+	tcache.gen++;
+	if (osmem_conf.tcache_budget && (tcache.gen >= tcache.next_adapt))
+		tcache_adapt(&tcache);
+	tcache_unlock(&tcache);
+	return payload;
+}
+
+// Pops a cached block of class size (size); returns its payload or NULL.
+void *tcache_get(size_t size)
+{
+	return tcache_get_class(tcache_class(size));
+}
+
+// Caches an allocated heap block of the size of (class).
+// Returns 1 if the block was cached.
+int tcache_put_class(TBlock_meta *cell, int class)
+{
+	if (!tcache_trylock(&tcache))
+		return 0;
+	if (tcache.count[class] >= tcache_cap(&tcache, class)) {
+		if (osmem_conf.tcache_budget) {
+			STAT_ADD(tcache_overflows, 1);
+			if (tcache.count[class] == tcache.cap[class])
+				tcache_grow(&tcache, class);
+		}
+		if (tcache.count[class] >= tcache_cap(&tcache, class)) {
+			tcache_unlock(&tcache);
+			return 0;
+		}
+	}
+	if (!tcache.registered)
+		tcache_register(&tcache);
+
+	void *payload = (void *)cell + META_DATA_SIZE;
+
+	*(void **)payload = tcache.bins[class];
+	tcache.bins[class] = payload;
+	tcache.count[class]++;
+	tcache.gen++;
+	if (osmem_conf.tcache_budget && (tcache.gen >= tcache.next_adapt))
+		tcache_adapt(&tcache);
+	tcache_unlock(&tcache);
+	return 1;
+}
+
+// Caches an allocated heap block whose size is exactly a class size.
+// Returns 1 if the block was cached.
+int tcache_put(TBlock_meta *cell)
+{
+	int class = tcache_class(cell->size);
+
+	if ((class < 0) || (osmem_conf.classes[class] != cell->size))
+		return 0;
+	return tcache_put_class(cell, class);
+}
+
+// Returns the cached blocks of (tc) to the heap as free blocks, half of every
+// bin(rounded up) or all of them.
+static unsigned long tcache_release(struct tcache *tc, int all)
+{
+	unsigned long released = 0;
+
+	for (int class = 0; class < osmem_conf.nr_classes; class++) {
+		unsigned int n = all ? tc->count[class] : (tc->count[class] + 1) / 2;
+
+		for (unsigned int i = 0; i < n; i++) {
+			void *payload = tc->bins[class];
+
+			tc->bins[class] = *(void **)payload;
+			((TBlock_meta *)(payload - META_DATA_SIZE))->status = STATUS_FREE;
+		}
+		tc->count[class] -= n;
+		released += n;
+	}
+	return released;
+}
+
+// Called with heap_lock held when no free block fits: takes back half of the
+// blocks cached by every thread that is not inside a cache operation, and all
+// the orphaned blocks. Returns the number of blocks made free.
+unsigned long tcache_reclaim(void)
+{
+	unsigned long released = 0;
+
+	pthread_mutex_lock(&tcache_list_lock);
+	for (struct tcache *tc = tcache_list.next; tc != &tcache_list; tc = tc->next) {
+		if (!tcache_trylock(tc))
+			continue;
+		released += tcache_release(tc, 0);
+		tcache_unlock(tc);
+	}
+	pthread_mutex_unlock(&tcache_list_lock);
+
+	pthread_mutex_lock(&orphans_lock);
+	released += tcache_release(&orphans, 1);
+	pthread_mutex_unlock(&orphans_lock);
+
+	STAT_ADD(tcache_stolen, released);
+	return released;
+}
+
+// Called with heap_lock held: empties into the heap the caches that saw no
+// operation since the previous pass. Returns the number of blocks made free.
+unsigned long tcache_scavenge(void)
+{
+	unsigned long released = 0;
+
+	pthread_mutex_lock(&tcache_list_lock);
+	for (struct tcache *tc = tcache_list.next; tc != &tcache_list; tc = tc->next) {
+		if (!tcache_trylock(tc))
+			continue;
+		if (tc->gen == tc->scavenge_gen) {
+			released += tcache_release(tc, 1);
+			tcache_share_drop(tc);
+		}
+		tc->scavenge_gen = tc->gen;
+		tcache_unlock(tc);
+	}
+	pthread_mutex_unlock(&tcache_list_lock);
+
+	STAT_ADD(tcache_scavenged, released);
+	return released;
+}
+
+// Called with heap_lock held: whether tcache_idle_ms passed since the last pass.
+int tcache_scavenge_due(void)
+{
+	static struct timespec last;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+	long elapsed = (now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000;
+
+	if (elapsed < (long)osmem_conf.tcache_idle_ms)
+		return 0;
+	last = now;
+	return 1;
+}
+
+// Adds the capacity of every live thread cache to (capacity), one entry per
+// class, and returns the bytes it covers.
+size_t tcache_capacity(unsigned long *capacity)
+{
+	size_t size = 0;
+
+	pthread_mutex_lock(&tcache_list_lock);
+	for (struct tcache *tc = tcache_list.next; tc != &tcache_list; tc = tc->next) {
+		for (int class = 0; class < osmem_conf.nr_classes; class++) {
+			unsigned int cap = osmem_conf.tcache_budget ? __atomic_load_n(&tc->cap[class], __ATOMIC_RELAXED) :
+						  osmem_conf.tcache_depth[class];
+
+			capacity[class] += cap;
+			size += cap * osmem_conf.classes[class];
+		}
+	}
+	pthread_mutex_unlock(&tcache_list_lock);
+	return size;
+}
@@ -50,6 +50,38 @@ TESTS = {
     "test-all": 5,
 }
 
+# Regression and feature tests. They are checked like the tests above, but
+# carry no points.
+EXTRA_TESTS = [
+    "test-malloc-top-chunk",
+    "test-malloc-top-trim",
+    "test-realloc-mapped-grow",
+    "test-realloc-remap-heap",
+    "test-realloc-remap-mapped",
+]
+
+# Tests that check their own results, for calls that do not trace the same
+# way from one run to the next(memfd mappings, threads). They pass when they
+# exit with status 0 and carry no points.
+SELF_CHECKED_TESTS = [
+    "test-pool-mesh",
+    "test-heap-snapshot",
+    "test-span-calloc",
+    "test-tcache-threads",
+    "test-pinned-pool",
+    "test-conf-late",
+    "test-pool-frames",
+    "test-expand-vector",
+    "test-node-allocator",
+    "test-heap-policies",
+    "test-small-macros",
+    "test-small-macros-cxx",
+    "test-object-cache",
+    "test-group-alloc",
+    "test-near-alloc",
+    "test-fixed-base",
+]
+
 
 class UnfinishedCall(Exception):
     def __init__(self, *args: object) -> None:
@@ -57,6 +89,8 @@ class UnfinishedCall(Exception):
 
 
 class Call:
+    MREMAP_FIXED = 0x2
+
     def __init__(self, line: str, resumed_line: str = None) -> None:
         if resumed_line:
             line = re.sub(r"<.*\)", ")", line + resumed_line)
@@ -74,23 +108,34 @@ class Call:
     def add_nested_calls(self, nested_calls: list = None) -> None:
         self.nested_calls = nested_calls.copy() if nested_calls else []
 
-    def prettify(self, heap_start, mmaps: dict) -> str:
+    def prettify(self, heap_start, mmaps: dict, ranges: list = ()) -> str:
+        # The new address of mremap is only passed with MREMAP_FIXED.
+        if self.name == "mremap" and not int(self.args[3]) & Call.MREMAP_FIXED:
+            self.args = self.args[:4]
+
         self.args = list(
             map(
-                lambda arg: self.interpret_addr(arg, heap_start, mmaps),
+                lambda arg: self.interpret_addr(arg, heap_start, mmaps, ranges),
                 self.args,
             )
         )
-        self.ret = self.interpret_addr(self.ret, heap_start, mmaps)
+        self.ret = self.interpret_addr(self.ret, heap_start, mmaps, ranges)
 
         if self.name == "mmap":
             self.interpret_mmap_args()
 
     @staticmethod
-    def interpret_addr(addr: str, heap_start: int, mmaps: dict) -> str:
+    def interpret_addr(addr: str, heap_start: int, mmaps: dict, ranges: list = ()) -> str:
         if "0x" in addr:
-            heap_addr = "HeapStart + " + hex(int(addr, 16) - heap_start)
-            return mmaps.get(addr, heap_addr)
+            if addr in mmaps:
+                return mmaps[addr]
+
+            # Addresses inside a mapping, the latest one first.
+            for start, length, name in reversed(ranges):
+                if start <= int(addr, 16) < start + length:
+                    return f"{name} + {hex(int(addr, 16) - start)}"
+
+            return "HeapStart + " + hex(int(addr, 16) - heap_start)
 
         return addr
 
@@ -155,6 +200,7 @@ class LtraceParser:
         "os_free",
         "brk",
         "mmap",
+        "mremap",
         "munmap",
     ]
 
@@ -179,6 +225,7 @@ class LtraceParser:
         self.line_index = 0
 
         self.mmaps = {}
+        self.mmap_ranges = []
         self.mmaps_count = 1
         self.block_size = 0x20
 
@@ -215,12 +262,39 @@ class LtraceParser:
         if (
             line.startswith("brk")
             or line.startswith("mmap")
+            or line.startswith("mremap")
             or line.startswith("munmap")
         ):
             return False
 
         return any(call in line for call in LtraceParser.TRACED_CALLS)
 
+    def add_mapping(self, syscall: Call) -> None:
+        if syscall.name == "mmap":
+            # Pages mapped at a given address(e.g. in the heap) are not a new mapping.
+            if syscall.args[0] != "0":
+                return
+            length = int(syscall.args[1])
+        elif syscall.name == "mremap":
+            # A mapping resized in place or moved into another one keeps its name.
+            if syscall.ret == syscall.args[0]:
+                for i, (start, _, name) in enumerate(self.mmap_ranges):
+                    if hex(start) == syscall.ret:
+                        self.mmap_ranges[i] = (start, int(syscall.args[2]), name)
+                return
+            if int(syscall.args[3]) & Call.MREMAP_FIXED:
+                return
+            length = int(syscall.args[2])
+        else:
+            return
+
+        name = f"<mapped-addr{self.mmaps_count}>"
+        payload_start = hex(int(syscall.ret, 16) + self.block_size)
+        self.mmaps[syscall.ret] = name
+        self.mmaps[payload_start] = f"{name} + {hex(self.block_size)}"
+        self.mmap_ranges.append((int(syscall.ret, 16), length, name))
+        self.mmaps_count += 1
+
     def parse_libcall(self):
         if self.line_index >= len(self.lines):
             return None
@@ -243,14 +317,8 @@ class LtraceParser:
 
             if line.startswith(" "):
                 syscalls.append(Call(line.strip()))
-                if syscalls[-1].name == "mmap":
-                    payload_start = hex(int(syscalls[-1].ret, 16) + self.block_size)
-                    self.mmaps[syscalls[-1].ret] = f"<mapped-addr{self.mmaps_count}>"
-                    self.mmaps[
-                        payload_start
-                    ] = f"<mapped-addr{self.mmaps_count}> + {hex(self.block_size)}"
-                    self.mmaps_count += 1
-                syscalls[-1].prettify(self.heap_start, self.mmaps)
+                self.add_mapping(syscalls[-1])
+                syscalls[-1].prettify(self.heap_start, self.mmaps, self.mmap_ranges)
 
             self.line_index += 1
 
@@ -259,7 +327,7 @@ class LtraceParser:
         except UnfinishedCall:
             return None
 
-        libcall.prettify(self.heap_start, self.mmaps)
+        libcall.prettify(self.heap_start, self.mmaps, self.mmap_ranges)
         libcall.add_nested_calls(syscalls)
 
         return libcall
@@ -293,12 +361,14 @@ class Test:
     SNIPPET_DIR = os.path.join(os.path.dirname(os.path.realpath(__file__)), "snippets")
     REF_DIR = os.path.join(os.path.dirname(os.path.realpath(__file__)), "ref")
 
-    def __init__(self, name, points) -> None:
+    def __init__(self, name, points, self_checked=False) -> None:
         if "snippets/" in name:
             name = os.path.basename(name)
 
         self.name = name
         self.points = points
+        self.self_checked = self_checked
+        self.status = None
         self.test_file = TestFile(executable = os.path.join(Test.SNIPPET_DIR, self.name),
                 out_file = os.path.join(Test.SNIPPET_DIR, self.name + ".out"),
                 ref_file = os.path.join(Test.REF_DIR, self.name + ".ref"))
@@ -315,6 +385,15 @@ class Test:
             print(f"Failed to open {self.test_file.executable}", file=sys.stderr)
             sys.exit(-1)
 
+        if self.self_checked:
+            with Popen(
+                [self.test_file.executable], stdout=PIPE, stderr=PIPE, env=self.env
+            ) as proc:
+                _, stderr = proc.communicate()
+                self.output = stderr.decode("ascii")
+                self.status = proc.returncode
+            return
+
         with Popen(
             [
                 "ltrace",
@@ -347,6 +426,13 @@ class Test:
         pass_msg = f" passed ...   {self.points}"
         fail_msg = " failed ...   0"
 
+        if self.self_checked:
+            result = self.status == 0
+            print(pass_msg if result else fail_msg)
+            if not result:
+                print(self.output, file=sys.stderr)
+            return result
+
         diff_err = ""
         memcheck_err = ""
 
@@ -462,7 +548,7 @@ def main():
     test_name, verbose, diff, memcheck = parse_args()
 
     if test_name:
-        test = Test(test_name, 1)
+        test = Test(test_name, 1, os.path.basename(test_name) in SELF_CHECKED_TESTS)
         test.run()
         test.grade(verbose, diff, memcheck)
         return
@@ -473,6 +559,16 @@ def main():
         if test.grade(verbose, diff, memcheck):
             total += score
 
+    for test_name in EXTRA_TESTS:
+        test = Test(test_name, 0)
+        test.run()
+        test.grade(verbose, diff, memcheck)
+
+    for test_name in SELF_CHECKED_TESTS:
+        test = Test(test_name, 0, self_checked=True)
+        test.run()
+        test.grade(verbose, diff, memcheck)
+
     print("\nTotal:" + " " * 59 + f" {total}/100")
 
 
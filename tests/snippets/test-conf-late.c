@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define NUM_BLOCKS	64
+
+int main(void)
+{
+	void *ptrs[NUM_BLOCKS];
+	void *first;
+
+	/* Before the heap exists, its source can still be chosen */
+	FAIL(osmem_conf_parse("heap_reserve:1g") != 0, "DBG: heap_reserve rejected before the first allocation");
+	FAIL(osmem_conf.heap_reserve != 1024 * 1024 * 1024, "DBG: heap_reserve not applied");
+
+	first = os_malloc_checked(100);
+
+	/* The heap lives at the program break: switching it to a memfd is refused */
+	FAIL(osmem_conf_parse("heap_memfd:true,trim_threshold:4k") != 1, "DBG: heap_memfd accepted on a live heap");
+	FAIL(osmem_conf.heap_memfd != 0, "DBG: heap_memfd changed on a live heap");
+	FAIL(osmem_conf.trim_threshold != 4 * MULT_KB, "DBG: trim_threshold not applied next to a rejected pair");
+	FAIL(osmem_conf_parse("heap_reserve:2g") != 1, "DBG: heap_reserve accepted on a live heap");
+	FAIL(osmem_conf.heap_reserve != 1024 * 1024 * 1024, "DBG: heap_reserve changed on a live heap");
+
+	/* The heap keeps growing and trimming at the program break */
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		ptrs[i] = os_malloc_checked(3000);
+		memset(ptrs[i], i, 3000);
+	}
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		for (int j = 0; j < 3000; j++)
+			FAIL(((unsigned char *)ptrs[i])[j] != i, "DBG: heap blocks overlap");
+		os_free(ptrs[i]);
+	}
+
+	/* Cleanup */
+	os_free(first);
+
+	return 0;
+}
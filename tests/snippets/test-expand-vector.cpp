@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <cstdint>
+#include <utility>
+#include "test-utils.h"
+#include "osmem.hpp"
+
+#define NUM_ELEMS	300000
+
+/* Not trivially copyable, but it does not depend on its own address */
+struct handle {
+	int *ptr;
+
+	handle() : ptr(nullptr) {}
+	handle(int *p) : ptr(p) {}
+	handle(const handle &other) : ptr(other.ptr) {}
+	handle &operator=(const handle &other)
+	{
+		ptr = other.ptr;
+		return *this;
+	}
+};
+
+template <>
+struct osmem::is_trivially_relocatable<handle> : std::true_type {};
+
+static void fill(void *ptr, size_t size, int seed)
+{
+	for (size_t i = 0; i < size; i++)
+		((unsigned char *)ptr)[i] = (unsigned char)(seed + i);
+}
+
+static int filled(void *ptr, size_t size, int seed)
+{
+	for (size_t i = 0; i < size; i++)
+		if (((unsigned char *)ptr)[i] != (unsigned char)(seed + i))
+			return 0;
+	return 1;
+}
+
+static void check_expand(void)
+{
+	void *a = os_malloc_checked(1000);
+	void *b = os_malloc_checked(1000);
+	void *c = os_malloc_checked(1000);
+	void *m = os_malloc_checked(200 * MULT_KB + 100);
+	size_t usable;
+
+	FAIL(os_expand(NULL, 100) != 0, "DBG: os_expand expanded NULL");
+	FAIL(os_expand(a, 0) != 0, "DBG: os_expand accepted size 0");
+
+	/* A heap block takes the free block after it, up to the next live one */
+	fill(a, 1000, 1);
+	os_free(b);
+	usable = os_expand(a, 1900);
+	FAIL(usable < 1900, "DBG: os_expand did not take the next free block");
+	FAIL(usable != os_malloc_usable_size(a), "DBG: os_expand returned a wrong usable size");
+	FAIL(!filled(a, 1000, 1), "DBG: os_expand corrupted the block");
+	FAIL(os_expand(a, 100) != usable, "DBG: os_expand shrank the block");
+	FAIL(os_expand(a, 5000) != 0, "DBG: os_expand grew over a live block");
+	FAIL(os_malloc_usable_size(a) != usable, "DBG: a failed os_expand changed the block");
+
+	/* The last block takes the rest of the heap, then grows it */
+	fill(c, 1000, 2);
+	FAIL(os_expand(c, 60 * MULT_KB) < 60 * MULT_KB, "DBG: os_expand did not take the free heap top");
+	FAIL(os_expand(c, 120 * MULT_KB) < 120 * MULT_KB, "DBG: os_expand did not grow the heap");
+	FAIL(!filled(c, 1000, 2), "DBG: os_expand corrupted the last block");
+	fill(c, 120 * MULT_KB, 3);
+	FAIL(os_expand(c, 200 * MULT_KB) != 0, "DBG: os_expand grew a heap block past the mmap threshold");
+
+	/* A mapped block takes the slack of its last page */
+	fill(m, 200 * MULT_KB + 100, 4);
+	FAIL(os_expand(m, 200 * MULT_KB + 1000) < 200 * MULT_KB + 1000, "DBG: os_expand did not take the page slack");
+	FAIL(!filled(m, 200 * MULT_KB + 100, 4), "DBG: os_expand corrupted the mapped block");
+	fill(m, 200 * MULT_KB + 1000, 5);
+
+	/* Cleanup */
+	os_free(a);
+	os_free(c);
+	os_free(m);
+}
+
+static void check_vector(void)
+{
+	osmem::vector<int> v;
+	int sentinel = 42;
+
+	FAIL(!v.empty() || (v.capacity() != 0), "DBG: a new vector is not empty");
+
+	/* Growth keeps the elements, and the capacity covers the usable size */
+	for (int i = 0; i < NUM_ELEMS; i++) {
+		v.push_back(i);
+		FAIL(v.capacity() != os_malloc_usable_size(v.data()) / sizeof(int),
+			 "DBG: the capacity does not cover the usable size");
+	}
+	FAIL(v.size() != NUM_ELEMS, "DBG: osmem::vector lost elements");
+	for (int i = 0; i < NUM_ELEMS; i++)
+		FAIL(v[i] != i, "DBG: osmem::vector corrupted its elements");
+
+	/* An element of the vector itself, pushed when the storage moves */
+	v.resize(v.capacity());
+	v.push_back(v[10]);
+	FAIL(v.back() != 10, "DBG: push_back of an own element read the moved storage");
+
+	/* Copies, moves and resizes */
+	osmem::vector<int> copy(v);
+	FAIL((copy.size() != v.size()) || memcmp(copy.data(), v.data(), v.size() * sizeof(int)),
+		 "DBG: the copy differs");
+	osmem::vector<int> moved(std::move(copy));
+	FAIL(!copy.empty() || (moved.size() != v.size()), "DBG: the move kept the elements");
+	moved.resize(5, 7);
+	FAIL((moved.size() != 5) || (moved[4] != 4), "DBG: resize did not shrink");
+	moved.resize(8, 7);
+	FAIL(moved[7] != 7, "DBG: resize did not fill");
+	moved = osmem::vector<int>{1, 2, 3};
+	FAIL((moved.size() != 3) || (moved[2] != 3), "DBG: the initializer list was not copied");
+
+	/* Relocatable types declared as such */
+	osmem::vector<handle> handles(3);
+	for (int i = 0; i < 10000; i++)
+		handles.emplace_back(&sentinel);
+	FAIL((handles[0].ptr != nullptr) || (*handles.back().ptr != 42), "DBG: handles were not relocated");
+
+	/* Cleanup */
+	v.clear();
+	handles.clear();
+}
+
+int main(void)
+{
+	check_expand();
+	check_vector();
+
+	return 0;
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define FIXED_BASE	0x200000000000UL
+#define NUM_PTRS	6
+#define NUM_BLOCKS	64
+
+/*
+ * One run of a fixed sequence of calls in a window whose halves are not a
+ * whole number of pages long; prints the addresses it got
+ */
+static void child(void)
+{
+	size_t page_size = (size_t)getpagesize();
+	size_t reserve = (1048584 + page_size - 1) & ~(page_size - 1);
+	uintptr_t ptrs[NUM_PTRS];
+
+	FAIL(osmem_conf_parse("fixed_base:0x200000000000,heap_reserve:1048584") != 0, "DBG: fixed_base rejected");
+	FAIL(osmem_conf.heap_reserve != reserve, "DBG: heap_reserve not rounded up to a page");
+
+	/* A mapping first: the window is reserved before the heap exists */
+	ptrs[0] = (uintptr_t)os_malloc_checked(300 * MULT_KB);
+	FAIL(osmem_conf_parse("heap_reserve:2m") != 1, "DBG: heap_reserve accepted with the window reserved");
+	FAIL(osmem_conf_parse("fixed_base:0x300000000000") != 1, "DBG: fixed_base accepted with the window reserved");
+
+	ptrs[1] = (uintptr_t)os_malloc_checked(100);
+	ptrs[2] = (uintptr_t)os_malloc_checked(3000);
+	ptrs[3] = (uintptr_t)os_malloc_checked(200 * MULT_KB);
+	os_free((void *)ptrs[1]);
+	ptrs[4] = (uintptr_t)os_malloc_checked(50);
+	ptrs[5] = (uintptr_t)os_realloc_checked((void *)ptrs[2], 5000);
+
+	/* The heap in the first half of the window, the mappings in the second */
+	for (int i = 0; i < NUM_PTRS; i++) {
+		uintptr_t start = FIXED_BASE + ((i == 0) || (i == 3) ? reserve : 0);
+
+		FAIL((ptrs[i] < start) || (ptrs[i] >= start + reserve), "DBG: a block is outside its area of the window");
+		printf("%lx\n", (unsigned long)ptrs[i]);
+	}
+
+	/* Cleanup */
+	os_free((void *)ptrs[0]);
+	os_free((void *)ptrs[3]);
+	os_free((void *)ptrs[4]);
+	os_free((void *)ptrs[5]);
+}
+
+/* Runs the sequence in a new process, with its own ASLR layout */
+static void run_child(char *out, size_t len)
+{
+	char exe[256], cmd[300];
+	ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	FILE *pipe;
+	size_t read;
+
+	FAIL(exe_len < 0, "DBG: readlink failed");
+	exe[exe_len] = '\0';
+	snprintf(cmd, sizeof(cmd), "'%s' child", exe);
+	pipe = popen(cmd, "r");
+	FAIL(pipe == NULL, "DBG: popen failed");
+	read = fread(out, 1, len - 1, pipe);
+	out[read] = '\0';
+	FAIL(pclose(pipe) != 0, "DBG: the child run failed");
+	FAIL(read == 0, "DBG: the child printed no address");
+}
+
+int main(int argc, char *argv[])
+{
+	char first[256], second[256];
+	void *ptrs[NUM_BLOCKS];
+	void *ptr;
+
+	if ((argc > 1) && !strcmp(argv[1], "child")) {
+		child();
+		return 0;
+	}
+
+	/* The same calls get the same addresses in every process */
+	run_child(first, sizeof(first));
+	run_child(second, sizeof(second));
+	FAIL(strcmp(first, second) != 0, "DBG: addresses differ between two runs");
+
+	/* Once the heap is at the program break, the window cannot be set up */
+	ptr = os_malloc_checked(100);
+	FAIL(osmem_conf_parse("fixed_base:0x200000000000,trim_threshold:4k") != 1,
+		 "DBG: fixed_base accepted on a live heap");
+	FAIL(osmem_conf.fixed_base != 0, "DBG: fixed_base changed on a live heap");
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		ptrs[i] = os_malloc_checked(3000);
+		memset(ptrs[i], i, 3000);
+	}
+
+	/* Cleanup */
+	for (int i = 0; i < NUM_BLOCKS; i++)
+		os_free(ptrs[i]);
+	os_free(ptr);
+
+	return 0;
+}
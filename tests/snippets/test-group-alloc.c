@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define NUM_BLOCKS	64
+#define BLOCK_SIZE	40
+#define GROUP_STRIDE	(METADATA_SIZE + 48)
+
+static struct block_meta *meta(void *ptr)
+{
+	return (struct block_meta *)((char *)ptr - METADATA_SIZE);
+}
+
+/* A single call site of os_malloc() */
+static __attribute__((noinline)) void *site_alloc(size_t size)
+{
+	void *ptr = os_malloc(size);
+
+	/* Keeps the call from being a tail call: the site is in this function */
+	__asm__ volatile("" : : : "memory");
+	return ptr;
+}
+
+int main(void)
+{
+	struct osmem_stats before, after;
+	void *first[NUM_BLOCKS], *second[NUM_BLOCKS];
+	void *ptr, *site[2], *plain;
+	uintptr_t site_id;
+
+	FAIL(osmem_conf_parse("stats:true") != 0, "DBG: stats rejected");
+	os_stats_get(&before);
+
+	/* Interleaved requests of two groups: each group's blocks follow each other */
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		first[i] = os_malloc_group(1, BLOCK_SIZE);
+		second[i] = os_malloc_group(2, BLOCK_SIZE);
+		FAIL(!first[i] || !second[i], "DBG: os_malloc_group failed");
+		memset(first[i], 1, BLOCK_SIZE);
+		memset(second[i], 2, BLOCK_SIZE);
+	}
+	for (int i = 1; i < NUM_BLOCKS; i++) {
+		FAIL((char *)first[i] - (char *)first[i - 1] != GROUP_STRIDE, "DBG: group 1 blocks are not adjacent");
+		FAIL((char *)second[i] - (char *)second[i - 1] != GROUP_STRIDE, "DBG: group 2 blocks are not adjacent");
+	}
+	os_stats_get(&after);
+	FAIL(after.group_regions - before.group_regions != 2, "DBG: not one region per group");
+	FAIL(os_malloc_usable_size(first[0]) < BLOCK_SIZE, "DBG: group block too small");
+
+	/* A freed block is only reused by its own group */
+	os_free(first[10]);
+	ptr = os_malloc_group(2, BLOCK_SIZE);
+	FAIL(ptr == first[10], "DBG: another group reused a freed block");
+	os_free(ptr);
+	ptr = os_malloc_group(1, BLOCK_SIZE);
+	FAIL(ptr != first[10], "DBG: the group did not reuse its freed block");
+	first[10] = ptr;
+	memset(first[10], 1, BLOCK_SIZE);
+
+	/* Large requests and reserved ids get plain blocks */
+	os_stats_get(&before);
+	plain = os_malloc_group(1, 2000);
+	FAIL(plain == NULL, "DBG: os_malloc_group failed on a large size");
+	FAIL(meta(plain)->status != STATUS_ALLOC, "DBG: a large request was grouped");
+	os_free(plain);
+	plain = os_malloc_group(1UL << 63 | 1, BLOCK_SIZE);
+	FAIL(plain == NULL, "DBG: os_malloc_group failed on a reserved id");
+	FAIL(meta(plain)->status != STATUS_ALLOC, "DBG: a reserved id was grouped");
+	os_free(plain);
+	os_stats_get(&after);
+	FAIL(after.group_regions != before.group_regions, "DBG: a plain request took a region");
+
+	/* Call site groups: the requests of one site follow each other */
+	FAIL(osmem_conf_parse("site_groups:true") != 0, "DBG: site_groups rejected");
+	site[0] = site_alloc(BLOCK_SIZE);
+	plain = os_malloc(BLOCK_SIZE);
+	site[1] = site_alloc(BLOCK_SIZE);
+	FAIL(meta(site[0])->status != STATUS_GROUP, "DBG: site_groups did not group a small request");
+	FAIL((char *)site[1] - (char *)site[0] != GROUP_STRIDE, "DBG: the blocks of a site are not adjacent");
+	FAIL(meta(plain)->prev == meta(site[0])->prev, "DBG: two call sites share a group");
+
+	/* An explicit group id equal to a site's return address is another group */
+	site_id = (*(uintptr_t *)meta(site[0])->prev - 1) & ~(1UL << 63);
+	ptr = os_malloc_group(site_id, BLOCK_SIZE);
+	FAIL(meta(ptr)->status != STATUS_GROUP, "DBG: os_malloc_group did not group");
+	FAIL(meta(ptr)->prev == meta(site[0])->prev, "DBG: a group id collided with a call site");
+	os_free(ptr);
+
+	/* Cleanup */
+	os_free(site[0]);
+	os_free(site[1]);
+	os_free(plain);
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		for (int j = 0; j < BLOCK_SIZE; j++) {
+			FAIL(((unsigned char *)first[i])[j] != 1, "DBG: group 1 blocks were overwritten");
+			FAIL(((unsigned char *)second[i])[j] != 2, "DBG: group 2 blocks were overwritten");
+		}
+		os_free(first[i]);
+		os_free(second[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <cstdint>
+#include <thread>
+#include "test-utils.h"
+#include "osmem_heap.hpp"
+
+#define NUM_THREADS	4
+#define NUM_OPS		20000
+
+/*
+ * Three free holes of 300, 100 and 200 bytes, in address order, each between
+ * live blocks; returns the block placed for a request of 150 bytes
+ */
+template <class Heap>
+static void *place_in_holes(Heap &h, void **holes)
+{
+	void *live[4];
+	void *ptr;
+
+	live[0] = h.allocate(16);
+	holes[0] = h.allocate(300);
+	live[1] = h.allocate(16);
+	holes[1] = h.allocate(100);
+	live[2] = h.allocate(16);
+	holes[2] = h.allocate(200);
+	live[3] = h.allocate(16);
+	for (int i = 0; i < 3; i++)
+		h.deallocate(holes[i]);
+
+	ptr = h.allocate(150);
+	FAIL(ptr == nullptr, "DBG: osmem::heap failed to allocate");
+
+	/* Cleanup */
+	h.deallocate(ptr);
+	for (int i = 0; i < 4; i++)
+		h.deallocate(live[i]);
+	return ptr;
+}
+
+template <class Heap>
+static void check_blocks(Heap &h)
+{
+	void *ptrs[64];
+
+	FAIL(h.allocate(0) != nullptr, "DBG: osmem::heap accepted size 0");
+	h.deallocate(nullptr);
+
+	/* Aligned, large enough and disjoint blocks, some larger than a region */
+	for (int i = 0; i < 64; i++) {
+		size_t size = (i % 16) ? inc_sz_sm[i % NUM_SZ_SM] : inc_sz_lg[i / 16];
+
+		ptrs[i] = h.allocate(size);
+		FAIL(ptrs[i] == nullptr, "DBG: osmem::heap failed to allocate");
+		FAIL((uintptr_t)ptrs[i] % 8 != 0, "DBG: osmem::heap block not 8-byte aligned");
+		FAIL(Heap::usable_size(ptrs[i]) < size, "DBG: osmem::heap block too small");
+		memset(ptrs[i], i, size);
+	}
+	for (int i = 0; i < 64; i++) {
+		size_t size = (i % 16) ? inc_sz_sm[i % NUM_SZ_SM] : inc_sz_lg[i / 16];
+
+		for (size_t j = 0; j < size; j++)
+			FAIL(((unsigned char *)ptrs[i])[j] != i, "DBG: osmem::heap blocks overlap");
+	}
+
+	/* Freed neighbours merge: two adjacent blocks make room for their sum */
+	void *a = h.allocate(1000);
+	void *b = h.allocate(1000);
+	void *guard = h.allocate(16);
+
+	h.deallocate(b);
+	h.deallocate(a);
+	FAIL(h.allocate(2000) != a, "DBG: osmem::heap did not merge free neighbours");
+
+	/* Cleanup */
+	h.deallocate(a);
+	h.deallocate(guard);
+	for (int i = 0; i < 64; i++)
+		h.deallocate(ptrs[i]);
+}
+
+int main(void)
+{
+	void *holes[3];
+
+	/* Placement of each fit policy */
+	{
+		osmem::heap<> best;
+		FAIL(place_in_holes(best, holes) != holes[2], "DBG: best_fit did not take the smallest hole");
+	}
+	{
+		osmem::heap<osmem::first_fit> first;
+		FAIL(place_in_holes(first, holes) != holes[0], "DBG: first_fit did not take the first hole");
+	}
+	{
+		osmem::heap<osmem::next_fit> next;
+		void *first = next.allocate(300);
+		void *second = next.allocate(300);
+
+		/* The search goes on from the block placed last, past the earlier hole */
+		next.deallocate(first);
+		void *third = next.allocate(100);
+
+		FAIL(third == first, "DBG: next_fit went back to the first hole");
+		FAIL(third < second, "DBG: next_fit did not go on from the last placement");
+		next.deallocate(second);
+		next.deallocate(third);
+	}
+
+	/* Split, merge and region handling, with every backend */
+	{
+		osmem::heap<osmem::best_fit, osmem::no_lock, osmem::counting_stats> h;
+
+		check_blocks(h);
+		FAIL(h.stats().in_use != 0, "DBG: in_use does not go back to 0");
+		FAIL(h.stats().allocs != h.stats().frees, "DBG: allocs and frees do not match");
+		FAIL(h.stats().peak_in_use < (size_t)inc_sz_lg[3], "DBG: peak_in_use missed the largest block");
+		FAIL((h.stats().grows < 2) || (h.stats().size < (size_t)inc_sz_lg[3]), "DBG: the regions were not counted");
+	}
+	{
+		osmem::heap<osmem::first_fit, osmem::no_lock, osmem::counting_stats, osmem::osmem_backend<>> h;
+
+		check_blocks(h);
+		FAIL(h.stats().in_use != 0, "DBG: in_use does not go back to 0 with osmem_backend");
+	}
+
+	/* Locked heaps shared by threads */
+	{
+		osmem::heap<osmem::best_fit, osmem::mutex_lock, osmem::counting_stats> mutex_heap;
+		osmem::heap<osmem::next_fit, osmem::spin_lock, osmem::counting_stats> spin_heap;
+		std::thread threads[NUM_THREADS];
+
+		for (int t = 0; t < NUM_THREADS; t++) {
+			threads[t] = std::thread([&mutex_heap, &spin_heap, t] {
+				void *by_mutex[16] = {}, *by_spin[16] = {};
+
+				for (int i = 0; i < NUM_OPS; i++) {
+					int slot = i % 16;
+					size_t size = inc_sz_sm[(i + t) % NUM_SZ_SM];
+
+					if (by_mutex[slot]) {
+						FAIL((*(int *)by_mutex[slot] != t) || (*(int *)by_spin[slot] != t),
+							 "DBG: a block of a locked heap was shared");
+						mutex_heap.deallocate(by_mutex[slot]);
+						spin_heap.deallocate(by_spin[slot]);
+					}
+					by_mutex[slot] = mutex_heap.allocate(size);
+					by_spin[slot] = spin_heap.allocate(size);
+					FAIL(!by_mutex[slot] || !by_spin[slot], "DBG: a locked heap failed to allocate");
+					*(int *)by_mutex[slot] = t;
+					*(int *)by_spin[slot] = t;
+				}
+				for (int slot = 0; slot < 16; slot++) {
+					mutex_heap.deallocate(by_mutex[slot]);
+					spin_heap.deallocate(by_spin[slot]);
+				}
+			});
+		}
+		for (int t = 0; t < NUM_THREADS; t++)
+			threads[t].join();
+		FAIL(mutex_heap.stats().allocs != mutex_heap.stats().frees, "DBG: mutex_lock lost an operation");
+		FAIL(spin_heap.stats().allocs != spin_heap.stats().frees, "DBG: spin_lock lost an operation");
+		FAIL(mutex_heap.stats().in_use || spin_heap.stats().in_use, "DBG: locked heaps kept blocks");
+	}
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define SMALL_SIZE	1000
+#define BIG_SIZE	(100 * MULT_KB)
+
+static int filled(const void *ptr, int c, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		if (((const unsigned char *)ptr)[i] != c)
+			return 0;
+	return 1;
+}
+
+int main(void)
+{
+	struct os_heap_snapshot snap;
+	struct osmem_stats before, after;
+	void *small, *big, *big_snap;
+
+	FAIL(osmem_conf_parse("heap_memfd:true,trim_threshold:64k,top_pad:0,stats:true") != 0,
+		 "DBG: configuration rejected");
+
+	small = os_malloc_checked(SMALL_SIZE);
+	big = os_malloc_checked(BIG_SIZE);
+	memset(small, 'a', SMALL_SIZE);
+	memset(big, 'b', BIG_SIZE);
+
+	FAIL(os_heap_snapshot(&snap) != 0, "DBG: os_heap_snapshot failed");
+	big_snap = (void *)snap.data + (big - snap.heap);
+	FAIL(!filled(big_snap, 'b', BIG_SIZE), "DBG: the snapshot does not hold the heap");
+
+	/* Trim the heap below the snapshot, then grow it back and write to it */
+	os_stats_get(&before);
+	os_free(big);
+	os_stats_get(&after);
+	FAIL(after.heap_trims == before.heap_trims, "DBG: the heap was not trimmed");
+
+	big = os_malloc_checked(BIG_SIZE);
+	memset(big, 'c', BIG_SIZE);
+	memset(small, 'd', SMALL_SIZE);
+
+	/* The snapshot still holds the heap of the time it was taken */
+	FAIL(!filled(big_snap, 'b', BIG_SIZE), "DBG: writes to the regrown heap reached the snapshot");
+	FAIL(!filled(snap.data + (small - snap.heap), 'a', SMALL_SIZE), "DBG: writes reached the snapshot");
+
+	/* Releasing the snapshot keeps the writes made meanwhile */
+	os_heap_snapshot_release(&snap);
+	FAIL(!filled(big, 'c', BIG_SIZE), "DBG: the regrown heap lost its writes");
+	FAIL(!filled(small, 'd', SMALL_SIZE), "DBG: the heap lost its writes");
+
+	/* Cleanup */
+	os_free(big);
+	os_free(small);
+
+	return 0;
+}
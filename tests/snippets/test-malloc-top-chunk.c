@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+int main(void)
+{
+	void *ptrs[NUM_SZ_SM], *grown[3], *ptr;
+
+	/* A 16 KB heap grown by 32 KB at least */
+	FAIL(osmem_conf_parse("prealloc_size:16k,top_chunk:32k") != 0, "DBG: top_chunk rejected");
+
+	/* Carve blocks from the preallocated top chunk */
+	for (int i = 0; i < NUM_SZ_SM; i++)
+		ptrs[i] = os_malloc_checked(inc_sz_sm[i]);
+
+	/* Grow the top chunk by its step, then carve from what is left */
+	grown[0] = os_malloc_checked(20 * MULT_KB);
+	grown[1] = os_malloc_checked(inc_sz_sm[10]);
+
+	/* Grow it by more than its step */
+	grown[2] = os_malloc_checked(100 * MULT_KB);
+
+	/* The freed last block goes back to the top chunk, the others are reused */
+	os_free(grown[2]);
+	os_free(ptrs[5]);
+	ptrs[5] = os_malloc_checked(inc_sz_sm[5]);
+	grown[2] = os_malloc_checked(50 * MULT_KB);
+
+	/* Extend the last block within the top chunk, then past it */
+	grown[2] = os_realloc(grown[2], 90 * MULT_KB);
+	FAIL(grown[2] == NULL, "DBG: os_realloc returned NULL on valid size");
+	grown[2] = os_realloc(grown[2], 120 * MULT_KB);
+	FAIL(grown[2] == NULL, "DBG: os_realloc returned NULL on valid size");
+
+	/* Free the trailing blocks together, then carve over them */
+	os_free(grown[1]);
+	os_free(grown[2]);
+	ptr = os_malloc_checked(inc_sz_sm[10]);
+
+	/* Cleanup */
+	os_free(ptr);
+	os_free(grown[0]);
+	for (int i = 0; i < NUM_SZ_SM; i++)
+		os_free(ptrs[i]);
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+int main(void)
+{
+	void *first, *last, *ptr;
+
+	/* Trim the top chunk from 64 KB, keeping 16 KB of it */
+	FAIL(osmem_conf_parse("top_chunk:32k,trim_threshold:64k,top_pad:16k") != 0,
+		 "DBG: top_chunk rejected");
+
+	first = os_malloc_checked(100 * MULT_KB);
+	last = os_malloc_checked(100 * MULT_KB);
+	ptr = os_malloc_checked(inc_sz_sm[8]);
+
+	/* A small top chunk is kept */
+	os_free(ptr);
+
+	/* The freed last block makes it large enough to trim */
+	os_free(last);
+	last = os_malloc_checked(100 * MULT_KB);
+
+	/* A free block left before the last one is trimmed with it */
+	os_free(first);
+	os_free(last);
+
+	/* The heap grows back from the pad */
+	ptr = os_malloc_checked(inc_sz_md[2]);
+
+	/* Cleanup */
+	os_free(ptr);
+
+	return 0;
+}
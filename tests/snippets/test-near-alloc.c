@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define BLOCK_SIZE	2000
+#define NUM_LIVE	7
+#define SMALL_SIZE	40
+#define GROUP_STRIDE	(METADATA_SIZE + 48)
+
+static struct block_meta *meta(void *ptr)
+{
+	return (struct block_meta *)((char *)ptr - METADATA_SIZE);
+}
+
+/* Two call sites whose os_malloc_near() requests fall back to os_malloc() */
+static __attribute__((noinline)) void *site_a(void)
+{
+	void *ptr = os_malloc_near(NULL, SMALL_SIZE);
+
+	__asm__ volatile("" : : : "memory");
+	return ptr;
+}
+
+static __attribute__((noinline)) void *site_b(void)
+{
+	void *ptr = os_malloc_near(NULL, SMALL_SIZE);
+
+	__asm__ volatile("" : : : "memory");
+	return ptr;
+}
+
+int main(void)
+{
+	struct osmem_stats before, after;
+	void *a, *b, *c, *ptr, *group, *live[NUM_LIVE], *sites[3];
+
+	FAIL(osmem_conf_parse("stats:true") != 0, "DBG: stats rejected");
+
+	/* The free block right after the hint is taken */
+	a = os_malloc_checked(BLOCK_SIZE);
+	b = os_malloc_checked(BLOCK_SIZE);
+	c = os_malloc_checked(BLOCK_SIZE);
+	os_free(b);
+	os_stats_get(&before);
+	ptr = os_malloc_near(a, 500);
+	os_stats_get(&after);
+	FAIL(ptr != b, "DBG: os_malloc_near did not take the next free block");
+	FAIL(after.near_hits != before.near_hits + 1, "DBG: near_hits not counted");
+	FAIL(after.malloc_calls != before.malloc_calls + 1, "DBG: malloc_calls not counted");
+	os_free(ptr);
+
+	/* Without free blocks within a page of the hint, a plain block */
+	for (int i = 0; i < NUM_LIVE; i++)
+		live[i] = os_malloc_checked(BLOCK_SIZE);
+	os_stats_get(&before);
+	ptr = os_malloc_near(live[NUM_LIVE / 2], 500);
+	FAIL(ptr == NULL, "DBG: os_malloc_near failed without room near the hint");
+	os_free(ptr);
+	ptr = os_malloc_near(a, 200 * MULT_KB);
+	FAIL(ptr == NULL, "DBG: os_malloc_near failed on a mapped size");
+	FAIL(meta(ptr)->status != STATUS_MAPPED, "DBG: os_malloc_near did not map a large block");
+	os_free(ptr);
+	os_stats_get(&after);
+	FAIL(after.near_hits != before.near_hits, "DBG: a fallback counted as a near hit");
+
+	/* The hint of a group block places in its group */
+	group = os_malloc_group(7, SMALL_SIZE);
+	ptr = os_malloc_near(group, SMALL_SIZE);
+	FAIL(meta(ptr)->status != STATUS_GROUP, "DBG: os_malloc_near left the group of the hint");
+	FAIL(meta(ptr)->prev != meta(group)->prev, "DBG: os_malloc_near used another group");
+	os_free(ptr);
+	os_free(group);
+
+	/* Fallbacks are grouped by the caller's call site, not by os_malloc_near's */
+	FAIL(osmem_conf_parse("site_groups:true") != 0, "DBG: site_groups rejected");
+	sites[0] = site_a();
+	sites[1] = site_b();
+	sites[2] = site_a();
+	FAIL(meta(sites[0])->status != STATUS_GROUP, "DBG: the fallback was not grouped");
+	FAIL(meta(sites[0])->prev == meta(sites[1])->prev, "DBG: two call sites share a group");
+	FAIL((char *)sites[2] - (char *)sites[0] != GROUP_STRIDE, "DBG: the blocks of a site are not adjacent");
+
+	/* Cleanup */
+	for (int i = 0; i < 3; i++)
+		os_free(sites[i]);
+	for (int i = 0; i < NUM_LIVE; i++)
+		os_free(live[i]);
+	os_free(a);
+	os_free(c);
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include "test-utils.h"
+#include "osmem.hpp"
+
+#define NUM_NODES	10000
+#define SLAB_SIZE	(64 * MULT_KB)
+#define NODE_SIZE	32	/* a list node of a long, two links and the value, in a pool */
+
+template <class T>
+using list = std::list<T, osmem::node_allocator<T>>;
+
+template <class K, class V>
+using map = std::map<K, V, std::less<K>, osmem::node_allocator<std::pair<const K, V>>>;
+
+template <class K, class V>
+using unordered_map = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+										 osmem::node_allocator<std::pair<const K, V>>>;
+
+int main(void)
+{
+	list<long> nodes;
+	map<int, int> tree;
+	unordered_map<int, int> table;
+	uintptr_t low = UINTPTR_MAX, high = 0;
+
+	/* Nodes of one type fill slabs one after the other */
+	for (long i = 0; i < NUM_NODES; i++)
+		nodes.push_back(i);
+	for (long &value : nodes) {
+		low = MIN(low, (uintptr_t)&value);
+		high = MAX(high, (uintptr_t)&value);
+		FAIL((uintptr_t)&value % 8 != 0, "DBG: a node is not aligned");
+	}
+	FAIL(high - low > (NUM_NODES * NODE_SIZE / SLAB_SIZE + 2) * SLAB_SIZE,
+		 "DBG: the nodes of a list are scattered");
+
+	/* Nodes freed are the next ones handed out */
+	long *freed = &nodes.back();
+
+	nodes.pop_back();
+	nodes.push_back(-1);
+	FAIL(&nodes.back() != freed, "DBG: a freed node was not reused first");
+
+	/* Rebinding to other node types, arrays(the hash buckets) included */
+	for (int i = 0; i < NUM_NODES; i++) {
+		tree[i] = 2 * i;
+		table[i] = 3 * i;
+	}
+	for (int i = 0; i < NUM_NODES; i += 2) {
+		tree.erase(i);
+		table.erase(i);
+	}
+	for (int i = 0; i < NUM_NODES; i++) {
+		FAIL(tree.count(i) != (size_t)(i % 2), "DBG: std::map lost a node");
+		FAIL(table.count(i) != (size_t)(i % 2), "DBG: std::unordered_map lost a node");
+		if (i % 2)
+			FAIL((tree[i] != 2 * i) || (table[i] != 3 * i), "DBG: a node was corrupted");
+	}
+
+	/* Nodes freed by another thread, whose cache goes back to the pool at its exit */
+	std::thread([&nodes] {
+		list<long> local;
+
+		for (int i = 0; i < 100; i++)
+			local.push_back(i);
+		nodes.clear();
+	}).join();
+	for (long i = 0; i < NUM_NODES; i++)
+		nodes.push_back(i);
+	long expected = 0;
+	for (long value : nodes)
+		FAIL(value != expected++, "DBG: a node reused across threads was corrupted");
+
+	/* Every instance is equal, oversized arrays are refused */
+	osmem::node_allocator<long> alloc;
+	FAIL(!(alloc == osmem::node_allocator<int>()), "DBG: node allocators differ");
+	try {
+		alloc.allocate(SIZE_MAX / 4);
+		FAIL(1, "DBG: an oversized array was allocated");
+	} catch (const std::bad_array_new_length &) {
+	}
+
+	/* Cleanup */
+	nodes.clear();
+	tree.clear();
+	table.clear();
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include "test-utils.h"
+
+#define OBJ_SIZE	100
+#define OBJ_ALIGN	64
+#define NUM_OBJS	2000
+#define CTOR_MAGIC	0x636f6e73UL
+
+/* An object with a state set up once per slab */
+struct conn {
+	unsigned long magic;
+	unsigned long uses;
+	char buf[OBJ_SIZE - 2 * sizeof(unsigned long)];
+};
+
+static unsigned long nr_ctors, nr_dtors;
+
+static void conn_ctor(void *obj)
+{
+	struct conn *c = obj;
+
+	c->magic = CTOR_MAGIC;
+	c->uses = 0;
+	nr_ctors++;
+}
+
+static void conn_dtor(void *obj)
+{
+	struct conn *c = obj;
+
+	FAIL(c->magic != CTOR_MAGIC, "DBG: dtor called on an object that was not constructed");
+	c->magic = 0;
+	nr_dtors++;
+}
+
+int main(void)
+{
+	static struct conn *objs[NUM_OBJS];
+	struct os_cache_stats stats;
+	struct os_cache *cache, *plain;
+	struct conn *reused;
+
+	/* Alignments that are not powers of two up to a page are refused */
+	errno = 0;
+	FAIL(os_cache_create("bad", OBJ_SIZE, 48, NULL, NULL) != NULL, "DBG: os_cache_create accepted align 48");
+	FAIL(errno != EINVAL, "DBG: os_cache_create did not set EINVAL");
+	FAIL(os_cache_create("bad", OBJ_SIZE, 8192, NULL, NULL) != NULL, "DBG: os_cache_create accepted align 8192");
+
+	cache = os_cache_create("conn", sizeof(struct conn), OBJ_ALIGN, conn_ctor, conn_dtor);
+	FAIL(cache == NULL, "DBG: os_cache_create failed");
+
+	/* Every object of a new slab is constructed once, when the slab is added */
+	for (int i = 0; i < NUM_OBJS; i++) {
+		objs[i] = os_cache_alloc(cache);
+		FAIL(objs[i] == NULL, "DBG: os_cache_alloc failed");
+		FAIL((uintptr_t)objs[i] % OBJ_ALIGN != 0, "DBG: cache object not aligned");
+		FAIL(objs[i]->magic != CTOR_MAGIC, "DBG: cache object not constructed");
+		objs[i]->uses++;
+		memset(objs[i]->buf, i, sizeof(objs[i]->buf));
+	}
+	os_cache_stats_get(cache, &stats);
+	FAIL(strcmp(stats.name, "conn") || (stats.size != sizeof(struct conn)), "DBG: wrong cache name or size");
+	FAIL(stats.obj_size < sizeof(struct conn) || (stats.obj_size % OBJ_ALIGN), "DBG: wrong cache object size");
+	FAIL(stats.allocs != NUM_OBJS, "DBG: allocs not counted");
+	FAIL(stats.objects < NUM_OBJS, "DBG: the slabs hold fewer objects than allocated");
+	FAIL((stats.ctor_calls != stats.objects) || (nr_ctors != stats.objects), "DBG: ctor not called once per object");
+	FAIL(stats.dtor_calls != 0, "DBG: dtor called on live slabs");
+
+	/* A freed object keeps its state, the next allocation gets it back as is */
+	os_cache_free(cache, objs[7]);
+	reused = os_cache_alloc(cache);
+	FAIL(reused != objs[7], "DBG: the freed object was not reused first");
+	FAIL((reused->magic != CTOR_MAGIC) || (reused->uses != 1), "DBG: the cached object lost its state");
+	for (size_t j = 0; j < sizeof(reused->buf); j++)
+		FAIL(reused->buf[j] != 7, "DBG: the cached object lost its contents");
+	os_cache_stats_get(cache, &stats);
+	FAIL(stats.ctor_calls != nr_ctors, "DBG: reuse called the ctor");
+
+	/* Shrinking releases the free slabs only, destroying their objects */
+	for (int i = 0; i < NUM_OBJS; i++)
+		if (i >= NUM_OBJS / 10)
+			os_cache_free(cache, objs[i]);
+	FAIL(os_cache_shrink(cache) == 0, "DBG: os_cache_shrink released no slab");
+	os_cache_stats_get(cache, &stats);
+	FAIL(stats.frees != NUM_OBJS - NUM_OBJS / 10 + 1, "DBG: frees not counted");
+	FAIL(stats.dtor_calls != nr_dtors, "DBG: dtor_calls does not match the dtor");
+	FAIL(stats.ctor_calls - stats.dtor_calls != stats.objects, "DBG: released slabs kept constructed objects");
+	for (int i = 0; i < NUM_OBJS / 10; i++)
+		FAIL(objs[i]->magic != CTOR_MAGIC, "DBG: os_cache_shrink destroyed a live object");
+
+	/* A cache without ctor and dtor */
+	plain = os_cache_create(NULL, 24, 0, NULL, NULL);
+	FAIL(plain == NULL, "DBG: os_cache_create failed without ctor");
+	objs[NUM_OBJS - 1] = os_cache_alloc(plain);
+	FAIL(objs[NUM_OBJS - 1] == NULL, "DBG: os_cache_alloc failed without ctor");
+	FAIL((uintptr_t)objs[NUM_OBJS - 1] % 8 != 0, "DBG: default alignment is not 8 bytes");
+	os_cache_stats_get(plain, &stats);
+	FAIL(strcmp(stats.name, "") || stats.ctor_calls, "DBG: a plain cache has a name or a ctor");
+	os_cache_free(plain, objs[NUM_OBJS - 1]);
+	os_cache_destroy(plain);
+
+	/* Cleanup */
+	for (int i = 0; i < NUM_OBJS / 10; i++)
+		os_cache_free(cache, objs[i]);
+	os_cache_destroy(cache);
+	FAIL(nr_dtors != nr_ctors, "DBG: os_cache_destroy did not destroy every object");
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define POOL_SIZE	(64 * MULT_KB)
+#define NUM_BLOCKS	32
+
+/* Every page of [ptr, ptr + size) is resident */
+static int resident(void *ptr, size_t size)
+{
+	unsigned char vec[POOL_SIZE / 4096 + 2];
+	void *start = (void *)((uintptr_t)ptr & ~(uintptr_t)4095);
+	size_t len = (ptr + size) - start;
+
+	FAIL(mincore(start, len, vec) != 0, "DBG: mincore failed");
+	for (size_t i = 0; i < (len + 4095) / 4096; i++)
+		if (!(vec[i] & 1))
+			return 0;
+	return 1;
+}
+
+int main(void)
+{
+	struct osmem_stats before, created, destroyed;
+	struct os_pinned_pool *pool;
+	void *ptrs[NUM_BLOCKS];
+	void *whole;
+
+	FAIL(osmem_conf_parse("stats:true") != 0, "DBG: stats rejected");
+
+	/* Sizes that cannot be mapped are refused */
+	FAIL(os_pinned_pool_create(0) != NULL, "DBG: os_pinned_pool_create accepted 0 bytes");
+	errno = 0;
+	FAIL(os_pinned_pool_create(SIZE_MAX) != NULL, "DBG: os_pinned_pool_create accepted SIZE_MAX");
+	FAIL(errno != ENOMEM, "DBG: os_pinned_pool_create did not set ENOMEM");
+
+	/* One mapping, faulted in, locked if RLIMIT_MEMLOCK allows it */
+	os_stats_get(&before);
+	pool = os_pinned_pool_create(POOL_SIZE);
+	FAIL(pool == NULL, "DBG: os_pinned_pool_create failed");
+	os_stats_get(&created);
+	FAIL(created.mmap_calls - before.mmap_calls != 1, "DBG: the pool took more than one mapping");
+	FAIL(created.mapped_size - before.mapped_size < POOL_SIZE, "DBG: the pool mapping is too small");
+	FAIL((os_pinned_pool_locked(pool) != 0) && (os_pinned_pool_locked(pool) != 1),
+		 "DBG: os_pinned_pool_locked is not a boolean");
+
+	/* Blocks are cache line aligned, resident and do not overlap */
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		ptrs[i] = os_pinned_alloc(pool, inc_sz_sm[i % 8]);
+		FAIL(ptrs[i] == NULL, "DBG: os_pinned_alloc failed");
+		FAIL((uintptr_t)ptrs[i] % 64 != 0, "DBG: os_pinned_alloc returned an unaligned block");
+		FAIL(!resident(ptrs[i], inc_sz_sm[i % 8]), "DBG: a pinned block is not resident");
+		memset(ptrs[i], i + 1, inc_sz_sm[i % 8]);
+	}
+	for (int i = 0; i < NUM_BLOCKS; i++)
+		for (int j = 0; j < inc_sz_sm[i % 8]; j++)
+			FAIL(((unsigned char *)ptrs[i])[j] != i + 1, "DBG: pinned blocks overlap");
+
+	/* The pool has no room for a block of its whole size while blocks are live */
+	FAIL(os_pinned_alloc(pool, POOL_SIZE) != NULL, "DBG: os_pinned_alloc overcommitted the pool");
+	FAIL(os_pinned_alloc(pool, 0) != NULL, "DBG: os_pinned_alloc accepted 0 bytes");
+
+	/* Freed blocks merge back into one that spans the pool */
+	for (int i = 0; i < NUM_BLOCKS; i += 2)
+		os_pinned_free(pool, ptrs[i]);
+	for (int i = 1; i < NUM_BLOCKS; i += 2)
+		os_pinned_free(pool, ptrs[i]);
+	whole = os_pinned_alloc(pool, POOL_SIZE - 4096);
+	FAIL(whole == NULL, "DBG: os_pinned_free did not merge the free blocks");
+	FAIL(whole != ptrs[0], "DBG: the merged block does not start the pool");
+	os_pinned_free(pool, whole);
+	os_pinned_free(pool, NULL);
+
+	/* Cleanup */
+	os_pinned_pool_destroy(pool);
+	os_stats_get(&destroyed);
+	FAIL(destroyed.munmap_calls - created.munmap_calls != 1, "DBG: the pool was not unmapped");
+	FAIL(destroyed.mapped_size != before.mapped_size, "DBG: mapped_size kept the pool");
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <coroutine>
+#include <cstdint>
+#include <thread>
+#include "test-utils.h"
+#include "osmem.hpp"
+
+#define OBJ_SIZE	40
+#define NUM_OBJS	1000
+#define NUM_CORO	200
+
+/* Counts from 0 to (n) - 1, one value per resumption */
+struct counter {
+	struct promise_type : osmem::frame_allocated {
+		int value;
+
+		counter get_return_object()
+		{
+			return counter{std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		std::suspend_always yield_value(int v) noexcept
+		{
+			value = v;
+			return {};
+		}
+		void return_void() noexcept {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+
+	/* The next value, or -1 once done */
+	int next()
+	{
+		handle.resume();
+		return handle.done() ? -1 : handle.promise().value;
+	}
+};
+
+counter count(int n)
+{
+	for (int i = 0; i < n; i++)
+		co_yield i;
+}
+
+static void check_pool(void)
+{
+	static void *objs[NUM_OBJS];
+	struct os_pool *pool = os_pool_create(OBJ_SIZE);
+	void *obj;
+
+	FAIL(pool == NULL, "DBG: os_pool_create failed");
+	FAIL(os_pool_create(0) != NULL, "DBG: os_pool_create accepted size 0");
+	FAIL(os_pool_object_size(pool) != 48, "DBG: pool objects are not rounded to 16 bytes");
+
+	/* Objects are aligned, distinct and span several slabs */
+	FAIL(os_pool_alloc_bulk(pool, objs, NUM_OBJS / 2) != NUM_OBJS / 2, "DBG: os_pool_alloc_bulk fell short");
+	for (int i = NUM_OBJS / 2; i < NUM_OBJS; i++) {
+		objs[i] = os_pool_alloc(pool);
+		FAIL(objs[i] == NULL, "DBG: os_pool_alloc failed");
+	}
+	for (int i = 0; i < NUM_OBJS; i++) {
+		FAIL((uintptr_t)objs[i] % 16 != 0, "DBG: pool object not 16-byte aligned");
+		memset(objs[i], i & 0xff, OBJ_SIZE);
+	}
+	for (int i = 0; i < NUM_OBJS; i++)
+		for (int j = 0; j < OBJ_SIZE; j++)
+			FAIL(((unsigned char *)objs[i])[j] != (i & 0xff), "DBG: pool objects overlap");
+
+	/* The object freed last is handed out first */
+	obj = objs[NUM_OBJS / 3];
+	os_pool_free(pool, obj);
+	FAIL(os_pool_alloc(pool) != obj, "DBG: the freed object was not reused first");
+	os_pool_free(pool, NULL);
+
+	/* Cleanup */
+	os_pool_free_bulk(pool, objs, NUM_OBJS);
+	os_pool_destroy(pool);
+}
+
+static void check_frames(void)
+{
+	static_assert(osmem::detail::frame_class(1) == 0);
+	static_assert(osmem::detail::frame_class(64) == 0);
+	static_assert(osmem::detail::frame_class(65) == 1);
+	static_assert(osmem::detail::frame_class(1024) == 15);
+	static_assert(osmem::detail::frame_class(1025) == 16);
+	static_assert(osmem::detail::frame_class(2048) == 16);
+	static_assert(osmem::detail::frame_class(2049) == 17);
+	static_assert(osmem::detail::frame_class(4096) == 17);
+	static_assert(osmem::detail::frame_class(4097) == -1);
+	static_assert(osmem::detail::frame_class_size(17) == 4096);
+
+	/* A freed frame is the next one of its class, the cache is LIFO */
+	void *frame = osmem::frame_alloc(300);
+	void *other = osmem::frame_alloc(320);
+
+	FAIL((uintptr_t)frame % 16 != 0, "DBG: frame not 16-byte aligned");
+	FAIL(frame == other, "DBG: two live frames share memory");
+	osmem::frame_free(frame, 300);
+	FAIL(osmem::frame_alloc(310) != frame, "DBG: a freed frame was not reused by its class");
+	osmem::frame_free(frame, 310);
+	osmem::frame_free(other, 320);
+
+	/* Frames above 4 KB go to operator new */
+	frame = osmem::frame_alloc(8192);
+	memset(frame, 0, 8192);
+	osmem::frame_free(frame, 8192);
+
+	/* Many live coroutines, each with its own frame */
+	static counter coros[NUM_CORO];
+
+	for (int i = 0; i < NUM_CORO; i++)
+		coros[i] = count(i % 10 + 1);
+	for (int step = 0; step <= 10; step++)
+		for (int i = 0; i < NUM_CORO; i++)
+			if (step <= i % 10 + 1)
+				FAIL(coros[i].next() != (step <= i % 10 ? step : -1), "DBG: a coroutine frame was corrupted");
+
+	/* Frames freed by another thread are taken by its cache, then given back at its exit */
+	std::thread([] {
+		for (int i = 0; i < NUM_CORO; i++)
+			coros[i].handle.destroy();
+	}).join();
+
+	/* Cleanup */
+	for (int i = 0; i < NUM_CORO; i++) {
+		coros[i] = count(3);
+		FAIL(coros[i].next() != 0, "DBG: a reused frame was corrupted");
+	}
+	for (int i = 0; i < NUM_CORO; i++)
+		coros[i].handle.destroy();
+}
+
+int main(void)
+{
+	check_pool();
+	check_frames();
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define OBJ_SIZE	256
+#define NUM_OBJS	64
+#define PAGE_OBJS	(4096 / OBJ_SIZE)
+
+/* Bytes of the mesh memfd backed by memory */
+static size_t mesh_file_bytes(void)
+{
+	char path[64], link[64];
+	struct dirent *ent;
+	struct stat st;
+	size_t bytes = 0;
+	DIR *dir = opendir("/proc/self/fd");
+
+	FAIL(dir == NULL, "DBG: cannot list /proc/self/fd");
+	while ((ent = readdir(dir))) {
+		ssize_t len;
+
+		snprintf(path, sizeof(path), "/proc/self/fd/%s", ent->d_name);
+		len = readlink(path, link, sizeof(link) - 1);
+		if (len < 0)
+			continue;
+		link[len] = '\0';
+		if (strstr(link, "osmem-mesh") && !stat(path, &st))
+			bytes = st.st_blocks * 512;
+	}
+	closedir(dir);
+	return bytes;
+}
+
+static int obj_index(void *obj)
+{
+	return ((uintptr_t)obj % 4096) / OBJ_SIZE;
+}
+
+static int obj_page(void *obj, void *first)
+{
+	return ((uintptr_t)obj / 4096) - ((uintptr_t)first / 4096);
+}
+
+int main(void)
+{
+	void *objs[NUM_OBJS];
+	struct os_pool *pool;
+	size_t before, released;
+
+	FAIL(osmem_conf_parse("pool_mesh:true") != 0, "DBG: pool_mesh rejected");
+	pool = os_pool_create(OBJ_SIZE);
+	FAIL(pool == NULL, "DBG: os_pool_create failed");
+
+	for (int i = 0; i < NUM_OBJS; i++) {
+		objs[i] = os_pool_alloc(pool);
+		FAIL(objs[i] == NULL, "DBG: os_pool_alloc failed");
+		memset(objs[i], i + 1, OBJ_SIZE);
+	}
+
+	/* Even slabs keep their even objects, odd slabs their odd ones */
+	for (int i = 0; i < NUM_OBJS; i++) {
+		if (obj_index(objs[i]) % 2 != obj_page(objs[i], objs[0]) % 2) {
+			os_pool_free(pool, objs[i]);
+			objs[i] = NULL;
+		}
+	}
+
+	before = mesh_file_bytes();
+	released = os_pool_mesh(pool);
+	FAIL(released == 0, "DBG: os_pool_mesh merged no slabs");
+	FAIL(mesh_file_bytes() + released != before, "DBG: os_pool_mesh did not punch the merged pages");
+
+	/* The objects of both slabs of every pair kept their contents */
+	for (int i = 0; i < NUM_OBJS; i++) {
+		if (!objs[i])
+			continue;
+		for (int j = 0; j < OBJ_SIZE; j++)
+			FAIL(((unsigned char *)objs[i])[j] != i + 1, "DBG: os_pool_mesh corrupted an object");
+	}
+
+	/* Frees through the view of a meshed slab reach its owner */
+	for (int i = 0; i < NUM_OBJS; i++) {
+		if (objs[i] && (obj_page(objs[i], objs[0]) % 2)) {
+			os_pool_free(pool, objs[i]);
+			objs[i] = NULL;
+		}
+	}
+	for (int i = 0; i < NUM_OBJS; i++) {
+		if (!objs[i])
+			continue;
+		for (int j = 0; j < OBJ_SIZE; j++)
+			FAIL(((unsigned char *)objs[i])[j] != i + 1, "DBG: a free corrupted a meshed object");
+	}
+
+	/* The freed places are handed out again, without overlapping live objects */
+	for (int i = 0; i < NUM_OBJS; i++) {
+		if (objs[i])
+			continue;
+		objs[i] = os_pool_alloc(pool);
+		FAIL(objs[i] == NULL, "DBG: os_pool_alloc failed after meshing");
+		memset(objs[i], i + 1, OBJ_SIZE);
+	}
+	for (int i = 0; i < NUM_OBJS; i++)
+		for (int j = 0; j < OBJ_SIZE; j++)
+			FAIL(((unsigned char *)objs[i])[j] != i + 1, "DBG: objects overlap after meshing");
+
+	/* Cleanup */
+	for (int i = 0; i < NUM_OBJS; i++)
+		os_pool_free(pool, objs[i]);
+	os_pool_destroy(pool);
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+int main(void)
+{
+	static char copy[1024 * MULT_KB];
+	void *ptr, *ptr_free;
+	size_t size = inc_sz_sm[10] + 1000;
+
+	/* Map every block of a page or more */
+	FAIL(osmem_conf_parse("mmap_threshold:4096") != 0, "DBG: mmap_threshold rejected");
+
+	/* Leave an unmapped hole right after the mapping of ptr */
+	ptr_free = os_malloc_checked(size);
+	ptr = os_malloc_checked(size);
+	os_free(ptr_free);
+
+	/* Grow the mapped block: only its old size may be copied */
+	for (int i = 0; i < NUM_SZ_MD - 1; i++) {
+		taint(ptr, size);
+		memcpy(copy, ptr, size);
+		ptr = os_realloc(ptr, inc_sz_md[i]);
+		FAIL(memcmp(ptr, copy, size) != 0, "DBG: os_realloc corrupted memory");
+		size = inc_sz_md[i];
+	}
+
+	/* Cleanup */
+	os_free(ptr);
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+/* Random bytes, each KB numbered so that moved pages keep their order */
+void fill(void *ptr, size_t size)
+{
+	taint(ptr, size);
+	for (size_t i = 0; i + sizeof(size_t) <= size; i += MULT_KB)
+		memcpy(ptr + i, &i, sizeof(size_t));
+}
+
+int main(void)
+{
+	static char copy[1024 * MULT_KB];
+	static char copy_prev[128], copy_next[128];
+	void *ptr, *prev, *next, *reuse_first, *reuse_last;
+	size_t size = 60 * MULT_KB;
+
+	/* Remap every block of 16 KB or more */
+	FAIL(osmem_conf_parse("realloc_remap:16k") != 0, "DBG: realloc_remap rejected");
+
+	/* The payload of ptr starts in the middle of a page */
+	prev = os_malloc_checked(100);
+	ptr = os_malloc_checked(size);
+	next = os_malloc_checked(100);
+	fill(prev, 100);
+	fill(ptr, size);
+	fill(next, 100);
+	memcpy(copy_prev, prev, 100);
+	memcpy(copy_next, next, 100);
+
+	/* Move the heap block to a mapping: its whole pages are remapped */
+	memcpy(copy, ptr, size);
+	ptr = os_realloc(ptr, inc_sz_md[3]);
+	FAIL(ptr == NULL, "DBG: os_realloc returned NULL on valid size");
+	FAIL(memcmp(ptr, copy, size) != 0, "DBG: os_realloc corrupted memory");
+	FAIL(memcmp(prev, copy_prev, 100) != 0, "DBG: os_realloc corrupted the previous block");
+	FAIL(memcmp(next, copy_next, 100) != 0, "DBG: os_realloc corrupted the next block");
+
+	/* Reuse the old block: its partial first page and the fresh pages after it */
+	reuse_first = os_malloc_checked(100);
+	reuse_last = os_malloc_checked(size - 1000);
+	fill(reuse_first, 100);
+	fill(reuse_last, size - 1000);
+	FAIL(memcmp(ptr, copy, size) != 0, "DBG: heap reuse corrupted the moved block");
+	FAIL(memcmp(prev, copy_prev, 100) != 0, "DBG: heap reuse corrupted the previous block");
+	FAIL(memcmp(next, copy_next, 100) != 0, "DBG: heap reuse corrupted the next block");
+	os_free(reuse_first);
+	os_free(reuse_last);
+
+	/* Grow the block, now mapped over two mappings, then move it back to the heap */
+	size = inc_sz_md[3];
+	for (int i = 4; i >= 2; i -= 2) {
+		fill(ptr, size);
+		memcpy(copy, ptr, size);
+		ptr = os_realloc(ptr, inc_sz_md[i]);
+		FAIL(ptr == NULL, "DBG: os_realloc returned NULL on valid size");
+		FAIL(memcmp(ptr, copy, MIN(size, (size_t)inc_sz_md[i])) != 0, "DBG: os_realloc corrupted memory");
+		size = inc_sz_md[i];
+	}
+
+	/* Cleanup */
+	os_free(ptr);
+	os_free(prev);
+	os_free(next);
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+/* Random bytes, each KB numbered so that moved pages keep their order */
+void fill(void *ptr, size_t size)
+{
+	taint(ptr, size);
+	for (size_t i = 0; i + sizeof(size_t) <= size; i += MULT_KB)
+		memcpy(ptr + i, &i, sizeof(size_t));
+}
+
+int main(void)
+{
+	static char copy[1024 * MULT_KB];
+	size_t sizes[] = {300 * MULT_KB, 600 * MULT_KB, 1000 * MULT_KB, 400 * MULT_KB, 100 * MULT_KB};
+	size_t size = inc_sz_md[3];
+	void *ptr;
+
+	/* Remap every block of 256 KB or more */
+	FAIL(osmem_conf_parse("realloc_remap:256k") != 0, "DBG: realloc_remap rejected");
+
+	ptr = os_malloc_checked(size);
+
+	/*
+	 * Copy the block while it is below 256 KB, then remap it while it grows
+	 * and shrinks, and copy it back to the heap
+	 */
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		fill(ptr, size);
+		memcpy(copy, ptr, size);
+		ptr = os_realloc(ptr, sizes[i]);
+		FAIL(ptr == NULL, "DBG: os_realloc returned NULL on valid size");
+		FAIL(memcmp(ptr, copy, MIN(size, sizes[i])) != 0, "DBG: os_realloc corrupted memory");
+		size = sizes[i];
+	}
+
+	/* Cleanup */
+	os_free(ptr);
+
+	return 0;
+}
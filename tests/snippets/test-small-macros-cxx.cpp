@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+#include "osmem.hpp"
+
+/* Built with -Werror: the macros and templates must not warn in C++ */
+
+struct pair {
+	long key;
+	long value;
+};
+
+int main(void)
+{
+	size_t runtime = (size_t)getpid() % 2 + 100;
+	void *ptr, *again;
+
+	FAIL(osmem_conf_parse("size_classes:16/32/64/128/4096,tcache_depths:8") != 0, "DBG: tcache options rejected");
+
+	ptr = OS_MALLOC(2 * sizeof(pair));
+	FAIL(ptr == nullptr, "DBG: OS_MALLOC failed");
+	memset(ptr, 1, 2 * sizeof(pair));
+	OS_FREE(ptr, 2 * sizeof(pair));
+	again = OS_MALLOC(2 * sizeof(pair));
+	FAIL(again != ptr, "DBG: OS_FREE did not cache the block");
+	OS_FREE(again, 2 * sizeof(pair));
+
+	ptr = OS_MALLOC(runtime * 2);
+	FAIL(ptr == nullptr, "DBG: OS_MALLOC failed on a runtime size");
+	OS_FREE(ptr, runtime * 2);
+	ptr = OS_MALLOC(OSMEM_SMALL_MAX + 1);
+	FAIL(ptr == nullptr, "DBG: OS_MALLOC failed above OSMEM_SMALL_MAX");
+	OS_FREE(ptr, OSMEM_SMALL_MAX + 1);
+
+	/* The template entry points share the classes of the macros */
+	ptr = osmem::alloc<2 * sizeof(pair)>();
+	FAIL(ptr == nullptr, "DBG: osmem::alloc failed");
+	osmem::free<2 * sizeof(pair)>(ptr);
+	FAIL(OS_MALLOC(2 * sizeof(pair)) != ptr, "DBG: osmem::free and OS_MALLOC use different classes");
+	OS_FREE(ptr, 2 * sizeof(pair));
+
+	/* Cleanup */
+	ptr = osmem::alloc<OSMEM_SMALL_MAX * 2>();
+	FAIL(ptr == nullptr, "DBG: osmem::alloc failed above OSMEM_SMALL_MAX");
+	osmem::free<OSMEM_SMALL_MAX * 2>(ptr);
+
+	return 0;
+}
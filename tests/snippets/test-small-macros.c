@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+/* Built with -Werror: the macros must not warn on any size expression */
+
+struct pair {
+	long key;
+	long value;
+};
+
+int main(void)
+{
+	struct osmem_stats before, after;
+	size_t runtime = (size_t)getpid() % 2 + 100;
+	void *ptr, *again;
+
+	FAIL(osmem_conf_parse("size_classes:16/32/64/128/4096,tcache_depths:8,stats:true") != 0,
+		 "DBG: tcache options rejected");
+
+	/* A product known at compile time takes the small entry points and the cache */
+	ptr = OS_MALLOC(2 * sizeof(struct pair));
+	FAIL(ptr == NULL, "DBG: OS_MALLOC failed");
+	FAIL(os_malloc_usable_size(ptr) < 2 * sizeof(struct pair), "DBG: OS_MALLOC block too small");
+	memset(ptr, 1, 2 * sizeof(struct pair));
+	OS_FREE(ptr, 2 * sizeof(struct pair));
+	os_stats_get(&before);
+	again = OS_MALLOC(2 * sizeof(struct pair));
+	os_stats_get(&after);
+	FAIL(again != ptr, "DBG: OS_FREE did not cache the block");
+	FAIL(after.tcache_hits != before.tcache_hits + 1, "DBG: OS_MALLOC missed the thread cache");
+	OS_FREE(again, 2 * sizeof(struct pair));
+
+	/* The largest small size, and sizes that fall back to os_malloc()/os_free() */
+	ptr = OS_MALLOC(OSMEM_SMALL_MAX);
+	FAIL(ptr == NULL, "DBG: OS_MALLOC failed at OSMEM_SMALL_MAX");
+	memset(ptr, 2, OSMEM_SMALL_MAX);
+	OS_FREE(ptr, OSMEM_SMALL_MAX);
+	ptr = OS_MALLOC(OSMEM_SMALL_MAX + 1);
+	FAIL(ptr == NULL, "DBG: OS_MALLOC failed above OSMEM_SMALL_MAX");
+	OS_FREE(ptr, OSMEM_SMALL_MAX + 1);
+	ptr = OS_MALLOC(runtime * 2);
+	FAIL(ptr == NULL, "DBG: OS_MALLOC failed on a runtime size");
+	OS_FREE(ptr, runtime * 2);
+	FAIL(OS_MALLOC(0 * sizeof(struct pair)) != NULL, "DBG: OS_MALLOC(0) returned a block");
+
+	/* Cleanup */
+	OS_FREE(NULL, 0);
+
+	return 0;
+}
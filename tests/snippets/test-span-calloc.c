@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+/* Spans(above the 32k mmap threshold) of at most and of more than 16 pages */
+#define SMALL_SPAN	(40 * MULT_KB)
+#define BIG_SPAN	(200 * MULT_KB)
+
+static void *dirty_span(size_t size)
+{
+	void *ptr = os_malloc_checked(size);
+
+	memset(ptr, 0xff, size);
+	return ptr;
+}
+
+/* Calloc of (size) bytes over the freed span (old); returns the bytes it did not clear */
+static size_t calloc_reused(void **ptr, void *old, size_t size)
+{
+	struct osmem_stats before, after;
+
+	os_stats_get(&before);
+	*ptr = os_calloc_checked(1, size);
+	os_stats_get(&after);
+	FAIL(*ptr != old, "DBG: os_calloc did not reuse the freed span");
+
+	return after.calloc_zero_skipped - before.calloc_zero_skipped;
+}
+
+int main(void)
+{
+	size_t page_size = getpagesize();
+	void *ptr, *old, *live;
+
+	FAIL(osmem_conf_parse("mmap_threshold:32k,span_max:4m,calloc_heap:true,stats:true") != 0, "DBG: configuration rejected");
+
+	/* Dirty pages below the clean high-water mark are cleared, those above are not */
+	old = dirty_span(SMALL_SPAN);
+	os_free(old);
+	FAIL(calloc_reused(&ptr, old, BIG_SPAN) != BIG_SPAN - (SMALL_SPAN / page_size + 1) * page_size + METADATA_SIZE,
+		 "DBG: os_calloc cleared pages above the high-water mark");
+	os_free(ptr);
+
+	/* More than 16 dirty pages are dropped with MADV_DONTNEED */
+	old = dirty_span(BIG_SPAN);
+	live = dirty_span(SMALL_SPAN);
+	os_free(old);
+	FAIL(calloc_reused(&ptr, old, BIG_SPAN) != BIG_SPAN - page_size + METADATA_SIZE,
+		 "DBG: os_calloc cleared the dirty pages of a large span");
+	os_free(ptr);
+
+	/* At most 16 dirty pages are cleared */
+	old = dirty_span(SMALL_SPAN);
+	os_free(old);
+	FAIL(calloc_reused(&ptr, old, SMALL_SPAN) != 0, "DBG: os_calloc skipped the dirty pages of a small span");
+
+	/* The neighbouring span kept its contents */
+	for (size_t i = 0; i < SMALL_SPAN; i++)
+		FAIL(((unsigned char *)live)[i] != 0xff, "DBG: os_calloc cleared a live span");
+
+	/* Cleanup */
+	os_free(ptr);
+	os_free(live);
+
+	return 0;
+}
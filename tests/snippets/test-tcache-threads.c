@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "test-utils.h"
+#include "osmem_conf.h"
+
+#define NUM_OPS			200000
+#define NUM_IDLE		16
+#define RING_SIZE		256
+#define LIVE_MAGIC		0x6c6976656f736d65UL
+#define MAX_SECONDS		10
+#define RUN_MS			100
+
+/* Blocks handed from the allocating thread to the freeing one */
+struct item {
+	unsigned char *ptr;
+	size_t size;
+	unsigned long id;
+};
+
+static struct item ring[RING_SIZE];
+static unsigned long ring_head, ring_tail;
+static unsigned long nr_mallocs, nr_frees;
+
+/* Every byte of a live block tells which allocation it belongs to */
+void canary_write(unsigned char *ptr, size_t size, unsigned long id)
+{
+	for (size_t i = 0; i < size; i++)
+		ptr[i] = (unsigned char)(id * 31 + i);
+	memcpy(ptr + sizeof(unsigned long), &(unsigned long){LIVE_MAGIC}, sizeof(unsigned long));
+}
+
+int canary_check(unsigned char *ptr, size_t size, unsigned long id)
+{
+	unsigned long magic;
+
+	memcpy(&magic, ptr + sizeof(unsigned long), sizeof(unsigned long));
+	if (magic != LIVE_MAGIC)
+		return -1;
+	for (size_t i = 0; i < size; i++) {
+		if ((i >= sizeof(unsigned long)) && (i < 2 * sizeof(unsigned long)))
+			continue;
+		if (ptr[i] != (unsigned char)(id * 31 + i))
+			return -1;
+	}
+	return 0;
+}
+
+long elapsed_ms(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Allocates blocks of every class(and some larger ones) for many scavenging
+ * periods: the allocating thread never frees, so each of its calls misses the
+ * cache and takes the heap path, which scavenges the idle caches
+ */
+void *producer(void *arg)
+{
+	unsigned long rng = 1;
+	struct timespec start;
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long id = 0; (id < NUM_OPS) || (elapsed_ms(&start) < RUN_MS); id++) {
+		FAIL(elapsed_ms(&start) > MAX_SECONDS * 1000, "DBG: the threads took too long");
+
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+
+		size_t size = (rng % 16) ? 16 + rng % 241 : 300 + rng % 1700;
+		unsigned char *ptr = os_malloc_checked(size);
+		unsigned long magic;
+
+		/* A block still owned by the other thread carries the magic */
+		memcpy(&magic, ptr + sizeof(unsigned long), sizeof(unsigned long));
+		FAIL(magic == LIVE_MAGIC, "DBG: os_malloc returned a live block");
+		canary_write(ptr, size, id);
+		nr_mallocs++;
+
+		while (ring_tail - __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE) == RING_SIZE)
+			sched_yield();
+		ring[ring_tail % RING_SIZE] = (struct item){ptr, size, id};
+		__atomic_store_n(&ring_tail, ring_tail + 1, __ATOMIC_RELEASE);
+	}
+
+	/* The end of the stream */
+	while (ring_tail - __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE) == RING_SIZE)
+		sched_yield();
+	ring[ring_tail % RING_SIZE] = (struct item){NULL, 0, 0};
+	__atomic_store_n(&ring_tail, ring_tail + 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/* Checks and frees the blocks of the producer: they fill this thread's cache */
+void *consumer(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		while (__atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) == ring_head)
+			sched_yield();
+
+		struct item item = ring[ring_head % RING_SIZE];
+
+		__atomic_store_n(&ring_head, ring_head + 1, __ATOMIC_RELEASE);
+		if (!item.ptr)
+			break;
+
+		FAIL(canary_check(item.ptr, item.size, item.id) != 0, "DBG: a live block was handed out twice");
+		memset(item.ptr, 0, item.size);
+		os_free(item.ptr);
+		nr_frees++;
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	struct osmem_stats before, after;
+	void *ptrs[NUM_IDLE];
+	pthread_t threads[2];
+
+	/* The threads allocate in a window of their own, away from the libc heap */
+	FAIL(osmem_conf_parse("fixed_base:0x100000000000,size_classes:16/32/64/128/256,tcache_depths:32,"
+						  "tcache_idle_ms:1,tcache_budget:16k,stats:true") != 0,
+		 "DBG: tcache options rejected");
+
+	/* Leave blocks in the cache of this thread, which then stays idle */
+	for (int i = 0; i < NUM_IDLE; i++)
+		ptrs[i] = os_malloc_checked(inc_sz_sm[i % 5] + 16);
+	for (int i = 0; i < NUM_IDLE; i++)
+		os_free(ptrs[i]);
+
+	os_stats_get(&before);
+	FAIL(pthread_create(&threads[0], NULL, consumer, NULL) != 0, "DBG: pthread_create failed");
+	FAIL(pthread_create(&threads[1], NULL, producer, NULL) != 0, "DBG: pthread_create failed");
+	for (int i = 0; i < 2; i++)
+		FAIL(pthread_join(threads[i], NULL) != 0, "DBG: pthread_join failed");
+	os_stats_get(&after);
+
+	/* Every call is counted once */
+	FAIL(after.malloc_calls - before.malloc_calls != nr_mallocs, "DBG: malloc_calls do not add up");
+	FAIL(after.free_calls - before.free_calls != nr_frees, "DBG: free_calls do not add up");
+	FAIL(nr_mallocs != nr_frees, "DBG: a block was not freed");
+
+	/* A get either hits or, with a budget, may miss; a put may overflow */
+	FAIL(after.tcache_hits - before.tcache_hits > nr_mallocs, "DBG: more tcache hits than mallocs");
+	FAIL(after.tcache_misses - before.tcache_misses > nr_mallocs, "DBG: more tcache misses than mallocs");
+	FAIL(after.tcache_overflows - before.tcache_overflows > nr_frees, "DBG: more tcache overflows than frees");
+	FAIL(after.tcache_misses == before.tcache_misses, "DBG: the allocating thread never missed");
+	FAIL(after.tcache_overflows == before.tcache_overflows, "DBG: the freeing thread never overflowed");
+
+	/* Only this thread is left, its cache emptied and its share given back */
+	FAIL(after.tcache_scavenged == before.tcache_scavenged, "DBG: no idle cache was scavenged");
+	FAIL(after.tcache_capacity_size != 0, "DBG: the idle thread kept its capacity");
+
+	/* Allocate again from the blocks the exited threads left */
+	for (int i = 0; i < NUM_IDLE; i++)
+		ptrs[i] = os_malloc_checked(inc_sz_sm[i % 5] + 16);
+
+	/* Cleanup */
+	for (int i = 0; i < NUM_IDLE; i++)
+		os_free(ptrs[i]);
+
+	return 0;
+}
@@ -49,7 +49,7 @@ void taint(void *ptr, size_t size)
 	size = ((size + 7) >> 3) << 3;
 
 	for (size_t i = 0; i < size; i += 4096)
-		memcpy(ptr + i, buf, MIN(4096, size - i));
+		memcpy((char *)ptr + i, buf, MIN(4096, size - i));
 }
 
 void *os_calloc_checked(size_t nmemb, size_t size)
@@ -59,7 +59,7 @@ void *os_calloc_checked(size_t nmemb, size_t size)
 	if (nmemb * size != 0) {
 		FAIL(ptr == NULL, "DBG: os_calloc returned NULL on valid size");
 		for (unsigned int i = 0; i < size; i++)
-			FAIL(*((char *)(ptr + i)) != 0, "DBG: os_calloc returned uninitialized memory");
+			FAIL(*((char *)ptr + i) != 0, "DBG: os_calloc returned uninitialized memory");
 	}
 
 	return ptr;
@@ -83,7 +83,7 @@ void *os_realloc_checked(void *ptr, size_t size)
 	if (!ptr)
 		return os_realloc(ptr, size);
 
-	memcpy(&oldBlock, ptr - sizeof(struct block_meta), sizeof(oldBlock));
+	memcpy(&oldBlock, (char *)ptr - sizeof(struct block_meta), sizeof(oldBlock));
 
 	ptr_realloc = os_realloc(ptr, size);
 
@@ -0,0 +1,418 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Derives size classes, the mmap threshold, thread cache depths and the
+// preallocation size from an allocation trace and writes them as a header
+// that tunes libosmem at build time(make -C src TUNING=<header>).
+
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "osmem_internal.h"
+#include "trace.h"
+
+// Candidate mmap thresholds are the powers of two in [MIN_THRESHOLD, MAX_THRESHOLD].
+#define MIN_THRESHOLD (64UL << 10)
+#define MAX_THRESHOLD (32UL << 20)
+#define SIZE_BITS 64
+
+// Depth histograms are kept up to MAX_DEPTH cached blocks per class.
+#define MAX_DEPTH 4096
+
+// Preallocations are multiples of PREALLOC_STEP.
+#define PREALLOC_STEP (64UL << 10)
+
+struct advice_opts {
+	int nr_classes;
+	size_t max_class;
+	double mmap_rate;
+	double hit_ratio;
+	size_t cache_budget;
+	size_t max_prealloc;
+};
+
+struct advice {
+	unsigned long allocs;
+	size_t max_small;		/* largest aligned size covered by classes */
+	unsigned long *size_count;	/* allocations per aligned size(index size / ALIGNMENT) */
+	unsigned long log_count[SIZE_BITS];	/* allocations per power of two bucket */
+
+	size_t mmap_threshold;
+	size_t prealloc_size;
+	size_t peak_live;
+	int nr_classes;
+	size_t classes[OSMEM_MAX_CLASSES];
+	unsigned int depth[OSMEM_MAX_CLASSES];
+	unsigned long class_allocs[OSMEM_MAX_CLASSES];
+	unsigned long class_hits[OSMEM_MAX_CLASSES];
+	size_t requested, rounded;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-k classes] [-m max_class] [-r mmap_rate] [-h hit_ratio] [-b budget]\n"
+		"          [-p max_prealloc] [-o header] [-f] trace\n"
+		"  -k  number of size classes, at most %d (default 16)\n"
+		"  -m  largest request size served by the size classes (default 4k)\n"
+		"  -r  highest share of allocations left to mmap (default 0.001)\n"
+		"  -h  share of frees each class depth should keep cached (default 0.9)\n"
+		"  -b  thread cache memory budget per thread (default 256k)\n"
+		"  -p  largest preallocation (default 64m)\n"
+		"  -o  output header (default standard output)\n"
+		"  -f  write an OSMEM_CONF string instead of a header\n", prog, OSMEM_MAX_CLASSES);
+	exit(EXIT_FAILURE);
+}
+
+static size_t option_size(const char *str)
+{
+	size_t size;
+
+	if (trace_parse_size(str, &size)) {
+		fprintf(stderr, "invalid size '%s'\n", str);
+		exit(EXIT_FAILURE);
+	}
+	return size;
+}
+
+static int size_bit(size_t size)
+{
+	return size ? SIZE_BITS - 1 - __builtin_clzl(size) : 0;
+}
+
+// Counts every allocation request of the trace.
+static void count_request(struct advice *adv, size_t size)
+{
+	if (!size)
+		return;
+
+	adv->allocs++;
+	adv->log_count[size_bit(size)]++;
+	if (SIZE_ALIGN(size) <= adv->max_small)
+		adv->size_count[SIZE_ALIGN(size) / ALIGNMENT]++;
+}
+
+// Counts the allocation requests of the trace.
+static int first_pass(struct trace *trace, struct advice *adv)
+{
+	struct trace_op op;
+	int ret;
+
+	while ((ret = trace_next(trace, &op)) > 0)
+		if (op.type != 'f')
+			count_request(adv, op.nmemb * op.size);
+	return ret;
+}
+
+// The smallest power of two threshold leaving at most (rate) of the allocations to mmap.
+static void pick_threshold(struct advice *adv, struct advice_opts *opts)
+{
+	unsigned long above = 0;
+	int bit = size_bit(MAX_THRESHOLD);
+
+	for (int i = SIZE_BITS - 1; i >= bit; i--)
+		above += adv->log_count[i];
+
+	adv->mmap_threshold = MAX_THRESHOLD;
+	for (; bit >= size_bit(MIN_THRESHOLD); bit--) {
+		if (above > opts->mmap_rate * adv->allocs)
+			break;
+		adv->mmap_threshold = 1UL << bit;
+		above += adv->log_count[bit - 1];
+	}
+}
+
+// Chooses the classes minimizing the bytes lost by rounding requests up, over the
+// observed aligned sizes(dynamic programming on the sorted sizes).
+static void pick_classes(struct advice *adv, struct advice_opts *opts)
+{
+	size_t limit = adv->max_small < adv->mmap_threshold ? adv->max_small : adv->mmap_threshold - 1;
+	size_t n = 0, *sizes = calloc(limit / ALIGNMENT + 1, sizeof(*sizes));
+	double *cnt = calloc(limit / ALIGNMENT + 2, sizeof(*cnt));
+	double *sum = calloc(limit / ALIGNMENT + 2, sizeof(*sum));
+
+	if (!sizes || !cnt || !sum)
+		abort();
+
+	for (size_t s = ALIGNMENT; s <= limit; s += ALIGNMENT) {
+		if (!adv->size_count[s / ALIGNMENT])
+			continue;
+		sizes[n] = s;
+		cnt[n + 1] = cnt[n] + adv->size_count[s / ALIGNMENT];
+		sum[n + 1] = sum[n] + (double)adv->size_count[s / ALIGNMENT] * s;
+		n++;
+	}
+
+	int k = opts->nr_classes < (int)n ? opts->nr_classes : (int)n;
+
+	adv->nr_classes = k;
+	if (!k)
+		goto out;
+
+	// cost[j][i]: least waste covering sizes[0..i] with j + 1 classes, the last at sizes[i].
+	double *cost = calloc(k * n, sizeof(*cost));
+	size_t *from = calloc(k * n, sizeof(*from));
+
+	if (!cost || !from)
+		abort();
+
+	for (size_t i = 0; i < n; i++)
+		cost[i] = sizes[i] * cnt[i + 1] - sum[i + 1];
+
+	for (int j = 1; j < k; j++) {
+		for (size_t i = j; i < n; i++) {
+			double best = -1;
+
+			for (size_t t = j - 1; t < i; t++) {
+				double c = cost[(j - 1) * n + t] + sizes[i] * (cnt[i + 1] - cnt[t + 1])
+						   - (sum[i + 1] - sum[t + 1]);
+
+				if ((best < 0) || (c < best)) {
+					best = c;
+					from[j * n + i] = t;
+				}
+			}
+			cost[j * n + i] = best;
+		}
+	}
+
+	// The largest class is the largest observed size; walk the choices back.
+	size_t i = n - 1;
+
+	for (int j = k - 1; j >= 0; j--) {
+		adv->classes[j] = sizes[i];
+		i = from[j * n + i];
+	}
+
+	free(cost);
+	free(from);
+out:
+	free(sizes);
+	free(cnt);
+	free(sum);
+}
+
+static int class_of(struct advice *adv, size_t size)
+{
+	for (int i = 0; i < adv->nr_classes; i++)
+		if (size <= adv->classes[i])
+			return i;
+	return -1;
+}
+
+// Replays the trace with unbounded per-class free pools: the depth of a class is the
+// pool size below which (hit_ratio) of its frees happen. The same pass records the
+// peak of live heap memory.
+static int second_pass(struct trace *trace, struct advice *adv, struct advice_opts *opts)
+{
+	unsigned long (*depth_hist)[MAX_DEPTH + 1] = calloc(OSMEM_MAX_CLASSES, sizeof(*depth_hist));
+	unsigned long pool[OSMEM_MAX_CLASSES] = {0}, frees[OSMEM_MAX_CLASSES] = {0};
+	struct trace_map map;
+	struct trace_op op;
+	size_t live = 0;
+	int ret;
+
+	if (!depth_hist)
+		abort();
+
+	trace_map_init(&map);
+	while ((ret = trace_next(trace, &op)) > 0) {
+		struct trace_obj *obj = trace_map_get(&map, op.id);
+		size_t size = op.nmemb * op.size;
+
+		// Release the old block of frees and reallocs.
+		if (obj && ((op.type == 'f') || (op.type == 'r'))) {
+			int class = class_of(adv, obj->size);
+
+			if (obj->size && (obj->size < adv->mmap_threshold))
+				live -= SIZE_ALIGN(class < 0 ? obj->size : adv->classes[class]) + META_DATA_SIZE;
+			if (obj->size && (class >= 0)) {
+				depth_hist[class][pool[class] < MAX_DEPTH ? pool[class] : MAX_DEPTH]++;
+				frees[class]++;
+				pool[class]++;
+			}
+			trace_map_del(&map, obj);
+		}
+		if ((op.type == 'f') || !size)
+			continue;
+
+		int class = class_of(adv, size);
+
+		obj = trace_map_put(&map, op.new_id);
+		obj->size = size;
+		if (class >= 0) {
+			adv->class_allocs[class]++;
+			adv->requested += size;
+			adv->rounded += adv->classes[class];
+			if (pool[class]) {
+				pool[class]--;
+				adv->class_hits[class]++;
+			}
+		}
+		if (size < adv->mmap_threshold) {
+			live += SIZE_ALIGN(class < 0 ? size : adv->classes[class]) + META_DATA_SIZE;
+			if (live > adv->peak_live)
+				adv->peak_live = live;
+		}
+	}
+	trace_map_free(&map);
+
+	// Smallest depth caching (hit_ratio) of the frees, then scaled into the budget.
+	size_t total = 0;
+
+	for (int c = 0; c < adv->nr_classes; c++) {
+		unsigned long seen = 0;
+
+		adv->depth[c] = 0;
+		while ((adv->depth[c] < MAX_DEPTH) && (seen < opts->hit_ratio * frees[c]))
+			seen += depth_hist[c][adv->depth[c]++];
+		total += (size_t)adv->depth[c] * adv->classes[c];
+	}
+	if (total > opts->cache_budget)
+		for (int c = 0; c < adv->nr_classes; c++)
+			adv->depth[c] = (unsigned int)((double)adv->depth[c] * opts->cache_budget / total);
+
+	size_t prealloc = (adv->peak_live + PREALLOC_STEP - 1) / PREALLOC_STEP * PREALLOC_STEP;
+
+	if (prealloc < PREALLOC_STEP)
+		prealloc = PREALLOC_STEP;
+	adv->prealloc_size = prealloc < opts->max_prealloc ? prealloc : opts->max_prealloc;
+
+	free(depth_hist);
+	return ret;
+}
+
+static void write_header(FILE *out, struct advice *adv, const char *path)
+{
+	fprintf(out, "/* SPDX-License-Identifier: BSD-3-Clause */\n\n");
+	fprintf(out, "/* Generated by osmem-advise from %s(%lu allocations) */\n\n", path, adv->allocs);
+	fprintf(out, "#pragma once\n\n");
+	fprintf(out, "#define OSMEM_MMAP_THRESHOLD %zu\n", adv->mmap_threshold);
+	fprintf(out, "#define OSMEM_PREALLOC_SIZE %zu\n", adv->prealloc_size);
+	fprintf(out, "#define OSMEM_NR_CLASSES %d\n", adv->nr_classes);
+
+	fprintf(out, "#define OSMEM_SIZE_CLASSES {");
+	for (int c = 0; c < adv->nr_classes; c++)
+		fprintf(out, "%s%zu", c ? ", " : "", adv->classes[c]);
+	fprintf(out, "%s}\n", adv->nr_classes ? "" : "0");
+
+	fprintf(out, "#define OSMEM_TCACHE_DEPTHS {");
+	for (int c = 0; c < adv->nr_classes; c++)
+		fprintf(out, "%s%u", c ? ", " : "", adv->depth[c]);
+	fprintf(out, "%s}\n", adv->nr_classes ? "" : "0");
+}
+
+// Same advice as a runtime configuration, usable as OSMEM_CONF="$(osmem-advise -f trace)".
+static void write_conf(FILE *out, struct advice *adv)
+{
+	fprintf(out, "mmap_threshold:%zu,prealloc_size:%zu", adv->mmap_threshold, adv->prealloc_size);
+	if (adv->nr_classes) {
+		fprintf(out, ",size_classes:");
+		for (int c = 0; c < adv->nr_classes; c++)
+			fprintf(out, "%s%zu", c ? "/" : "", adv->classes[c]);
+		fprintf(out, ",tcache_depths:");
+		for (int c = 0; c < adv->nr_classes; c++)
+			fprintf(out, "%s%u", c ? "/" : "", adv->depth[c]);
+	}
+	fprintf(out, "\n");
+}
+
+static void write_report(struct advice *adv)
+{
+	fprintf(stderr, "allocations      %lu\n", adv->allocs);
+	fprintf(stderr, "mmap threshold   %zu\n", adv->mmap_threshold);
+	fprintf(stderr, "peak live heap   %zu\n", adv->peak_live);
+	fprintf(stderr, "preallocation    %zu\n", adv->prealloc_size);
+	fprintf(stderr, "class waste      %.2f%%\n",
+		adv->rounded ? 100.0 * (adv->rounded - adv->requested) / adv->rounded : 0.0);
+	fprintf(stderr, "%8s %8s %12s %8s\n", "class", "depth", "allocs", "reuse%");
+	for (int c = 0; c < adv->nr_classes; c++)
+		fprintf(stderr, "%8zu %8u %12lu %8.2f\n", adv->classes[c], adv->depth[c], adv->class_allocs[c],
+			adv->class_allocs[c] ? 100.0 * adv->class_hits[c] / adv->class_allocs[c] : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct advice_opts opts = {
+		.nr_classes = 16, .max_class = 4096, .mmap_rate = 0.001, .hit_ratio = 0.9,
+		.cache_budget = 256 << 10, .max_prealloc = 64 << 20,
+	};
+	struct advice adv;
+	struct trace trace;
+	const char *output = NULL;
+	int conf = 0, opt;
+
+	while ((opt = getopt(argc, argv, "k:m:r:h:b:p:o:f")) != -1) {
+		switch (opt) {
+		case 'k':
+			opts.nr_classes = atoi(optarg);
+			break;
+		case 'm':
+			opts.max_class = option_size(optarg);
+			break;
+		case 'r':
+			opts.mmap_rate = atof(optarg);
+			break;
+		case 'h':
+			opts.hit_ratio = atof(optarg);
+			break;
+		case 'b':
+			opts.cache_budget = option_size(optarg);
+			break;
+		case 'p':
+			opts.max_prealloc = option_size(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'f':
+			conf = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ((optind != argc - 1) || (opts.nr_classes < 0) || (opts.nr_classes > OSMEM_MAX_CLASSES))
+		usage(argv[0]);
+	if (!strcmp(argv[optind], "-")) {
+		fprintf(stderr, "the trace is read twice and must be a file\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&adv, 0, sizeof(adv));
+	adv.max_small = SIZE_ALIGN(opts.max_class);
+	adv.size_count = calloc(adv.max_small / ALIGNMENT + 1, sizeof(*adv.size_count));
+	if (!adv.size_count)
+		abort();
+
+	if (trace_open(&trace, argv[optind]))
+		return EXIT_FAILURE;
+	if (first_pass(&trace, &adv) < 0)
+		return EXIT_FAILURE;
+
+	pick_threshold(&adv, &opts);
+	pick_classes(&adv, &opts);
+
+	rewind(trace.file);
+	trace.line = 0;
+	if (second_pass(&trace, &adv, &opts) < 0)
+		return EXIT_FAILURE;
+	trace_close(&trace);
+
+	FILE *out = output ? fopen(output, "w") : stdout;
+
+	if (!out) {
+		perror(output);
+		return EXIT_FAILURE;
+	}
+	if (conf)
+		write_conf(out, &adv);
+	else
+		write_header(out, &adv, argv[optind]);
+	write_report(&adv);
+	if (out != stdout)
+		fclose(out);
+
+	free(adv.size_count);
+	return EXIT_SUCCESS;
+}
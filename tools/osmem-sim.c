@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Replays allocation traces against the allocator built on top of a simulated
+// address space and reports the footprint of every configuration of a sweep.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#include "osmem.h"
+#include "osmem_conf.h"
+#include "osmem_internal.h"
+#include "sim_os.h"
+#include "trace.h"
+
+#define MAX_VALUES 64
+
+// Outcome of a single replay, sent from the child to the parent through a pipe.
+struct sim_result {
+	struct osmem_conf conf;
+	int status;
+	unsigned long ops;
+	unsigned long bad_ops;
+	size_t live_at_peak;
+	size_t final_size;
+	size_t final_live;
+	double seconds;
+	struct sim_stats stats;
+};
+
+static const char * const policy_names[] = {"best", "first", "next"};
+
+// Values of the swept parameters.
+struct sweep {
+	int policies[MAX_VALUES];
+	size_t thresholds[MAX_VALUES];
+	size_t steps[MAX_VALUES];
+	size_t preallocs[MAX_VALUES];
+	int n_policies, n_thresholds, n_steps, n_preallocs;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-j jobs] [-c conf] [-p policies] [-t thresholds] [-g steps] [-P preallocs] trace\n"
+		"  -c  base configuration in the OSMEM_CONF format (default OSMEM_CONF)\n"
+		"  -p  comma separated fit policies: best, first, next (default best)\n"
+		"  -t  comma separated mmap thresholds (default 128k)\n"
+		"  -g  comma separated heap growth steps, 0 is exact growth (default 0)\n"
+		"  -P  comma separated preallocation sizes (default 128k)\n"
+		"  -j  number of replays run in parallel (default 1)\n"
+		"Sizes accept k, m and g suffixes; every combination is replayed.\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static int parse_policy(const char *str)
+{
+	for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++)
+		if (!strcmp(str, policy_names[i]))
+			return i;
+
+	fprintf(stderr, "unknown fit policy '%s'\n", str);
+	exit(EXIT_FAILURE);
+}
+
+// Splits a comma separated list into sizes or policies.
+static int parse_list(char *str, size_t *sizes, int *policies)
+{
+	int n = 0;
+
+	for (char *tok = strtok(str, ","); tok; tok = strtok(NULL, ",")) {
+		if (n == MAX_VALUES) {
+			fprintf(stderr, "too many values in a sweep list\n");
+			exit(EXIT_FAILURE);
+		}
+		if (policies) {
+			policies[n++] = parse_policy(tok);
+		} else if (trace_parse_size(tok, &sizes[n++])) {
+			fprintf(stderr, "invalid size '%s'\n", tok);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return n;
+}
+
+// Replays the trace against the current configuration.
+static void replay(const char *path, struct sim_result *res)
+{
+	struct trace trace;
+	struct trace_map map;
+	struct trace_op op;
+	size_t live = 0, peak = 0;
+	struct timespec start, stop;
+	int ret;
+
+	res->status = EXIT_FAILURE;
+	if (trace_open(&trace, path))
+		return;
+
+	sim_init();
+	trace_map_init(&map);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((ret = trace_next(&trace, &op)) > 0) {
+		struct trace_obj *obj = trace_map_get(&map, op.id);
+
+		res->ops++;
+		switch (op.type) {
+		case 'm':
+		case 'c':
+			if (obj) {
+				res->bad_ops++;
+				break;
+			}
+			obj = trace_map_put(&map, op.id);
+			obj->size = op.nmemb * op.size;
+			obj->ptr = (op.type == 'm') ? os_malloc(op.size) : os_calloc(op.nmemb, op.size);
+			live += obj->size;
+			break;
+		case 'r':
+			if (!obj)
+				obj = trace_map_put(&map, op.id);
+			live -= obj->size;
+			obj->ptr = os_realloc(obj->ptr, op.size);
+			obj->size = op.size;
+			live += obj->size;
+			if (!op.size)
+				trace_map_del(&map, obj);
+			else
+				trace_map_rename(&map, obj, op.new_id);
+			break;
+		case 'f':
+			if (!obj) {
+				res->bad_ops++;
+				break;
+			}
+			os_free(obj->ptr);
+			live -= obj->size;
+			trace_map_del(&map, obj);
+			break;
+		default:
+			res->bad_ops++;
+		}
+
+		if (sim_stats.peak_size > peak) {
+			peak = sim_stats.peak_size;
+			res->live_at_peak = live;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	trace_close(&trace);
+	trace_map_free(&map);
+
+	if (ret < 0)
+		return;
+
+	res->seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+	res->final_size = sim_stats.heap_size + sim_stats.mmap_size;
+	res->final_live = live;
+	res->stats = sim_stats;
+	res->status = 0;
+}
+
+// Runs one replay in a child process so every configuration starts from a pristine allocator.
+static pid_t spawn(const char *path, struct osmem_conf *conf, int *fd)
+{
+	int fds[2];
+
+	if (pipe(fds)) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!pid) {
+		struct sim_result res;
+
+		close(fds[0]);
+		memset(&res, 0, sizeof(res));
+		osmem_conf = *conf;
+		res.conf = *conf;
+		replay(path, &res);
+		if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+			_exit(EXIT_FAILURE);
+		_exit(res.status);
+	}
+
+	close(fds[1]);
+	*fd = fds[0];
+	return pid;
+}
+
+static double percent(size_t part, size_t total)
+{
+	return total ? 100.0 * part / total : 0.0;
+}
+
+static void print_result(struct sim_result *res)
+{
+	if (res->status) {
+		printf("%-6s %10zu %10zu %10zu  replay failed\n", policy_names[res->conf.fit_policy],
+			   res->conf.mmap_threshold, res->conf.grow_step, res->conf.prealloc_size);
+		return;
+	}
+
+	printf("%-6s %10zu %10zu %10zu %12zu %12zu %6.2f %12zu %6.2f %8lu %8lu %8lu %12zu %8.3f\n",
+		   policy_names[res->conf.fit_policy], res->conf.mmap_threshold, res->conf.grow_step,
+		   res->conf.prealloc_size, res->stats.heap_size, res->stats.peak_size,
+		   100.0 - percent(res->live_at_peak, res->stats.peak_size), res->final_size,
+		   100.0 - percent(res->final_live, res->final_size), res->stats.sbrk_calls,
+		   res->stats.mmap_calls, res->stats.munmap_calls, res->stats.bytes_copied, res->seconds);
+}
+
+// Returns the first option set that makes the allocator use memory calls the
+// simulated address space does not redirect(mremap, madvise, memfd, fixed
+// mappings), or NULL.
+static const char *unsupported_option(void)
+{
+	if (osmem_conf.realloc_remap)
+		return "realloc_remap";
+	if (osmem_conf.span_max)
+		return "span_max";
+	if (osmem_conf.calloc_heap)
+		return "calloc_heap";
+	if (osmem_conf.heap_memfd)
+		return "heap_memfd";
+	if (osmem_conf.fixed_base)
+		return "fixed_base";
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sweep sweep = {
+		.policies = {osmem_conf.fit_policy}, .thresholds = {osmem_conf.mmap_threshold},
+		.steps = {osmem_conf.grow_step}, .preallocs = {osmem_conf.prealloc_size},
+		.n_policies = 1, .n_thresholds = 1, .n_steps = 1, .n_preallocs = 1,
+	};
+	int jobs = 1, opt;
+
+	while ((opt = getopt(argc, argv, "j:c:p:t:g:P:")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'c':
+			if (osmem_conf_parse(optarg))
+				usage(argv[0]);
+			sweep.policies[0] = osmem_conf.fit_policy;
+			sweep.thresholds[0] = osmem_conf.mmap_threshold;
+			sweep.steps[0] = osmem_conf.grow_step;
+			sweep.preallocs[0] = osmem_conf.prealloc_size;
+			break;
+		case 'p':
+			sweep.n_policies = parse_list(optarg, NULL, sweep.policies);
+			break;
+		case 't':
+			sweep.n_thresholds = parse_list(optarg, sweep.thresholds, NULL);
+			break;
+		case 'g':
+			sweep.n_steps = parse_list(optarg, sweep.steps, NULL);
+			break;
+		case 'P':
+			sweep.n_preallocs = parse_list(optarg, sweep.preallocs, NULL);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ((optind != argc - 1) || (jobs < 1))
+		usage(argv[0]);
+
+	const char *option = unsupported_option();
+
+	if (option) {
+		fprintf(stderr, "option '%s' cannot be simulated\n", option);
+		return EXIT_FAILURE;
+	}
+
+	// Replays are measured by the simulator, not by the allocator's own recorder.
+	osmem_conf.print_stats = 0;
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+	}
+
+	int total = sweep.n_policies * sweep.n_thresholds * sweep.n_steps * sweep.n_preallocs;
+	struct sim_result *results = calloc(total, sizeof(*results));
+	pid_t *pids = calloc(total, sizeof(*pids));
+	int *fds = calloc(total, sizeof(*fds));
+	int next = 0, running = 0, failed = 0;
+
+	if (!results || !pids || !fds) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	// Launch the combinations, keeping at most (jobs) replays alive.
+	while ((next < total) || running) {
+		if ((next < total) && (running < jobs)) {
+			struct osmem_conf conf = osmem_conf;
+			int i = next;
+
+			conf.prealloc_size = sweep.preallocs[i % sweep.n_preallocs];
+			i /= sweep.n_preallocs;
+			conf.grow_step = sweep.steps[i % sweep.n_steps];
+			i /= sweep.n_steps;
+			conf.mmap_threshold = sweep.thresholds[i % sweep.n_thresholds];
+			i /= sweep.n_thresholds;
+			conf.fit_policy = sweep.policies[i];
+
+			pids[next] = spawn(argv[optind], &conf, &fds[next]);
+			next++;
+			running++;
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+
+		for (int i = 0; i < next; i++) {
+			if (pids[i] != pid)
+				continue;
+			if (read(fds[i], &results[i], sizeof(results[i])) != sizeof(results[i]))
+				results[i].status = EXIT_FAILURE;
+			close(fds[i]);
+			failed |= results[i].status;
+		}
+		running--;
+	}
+
+	printf("%-6s %10s %10s %10s %12s %12s %6s %12s %6s %8s %8s %8s %12s %8s\n",
+		   "policy", "threshold", "grow", "prealloc", "heap", "peak", "frag%", "final",
+		   "frag%", "sbrk", "mmap", "munmap", "copied", "seconds");
+	for (int i = 0; i < total; i++)
+		print_result(&results[i]);
+
+	free(results);
+	free(pids);
+	free(fds);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
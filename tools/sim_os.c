@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define SIM_OS_IMPL
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim_os.h"
+
+// Reserved sizes of the simulated heap and mapping areas.
+#define SIM_HEAP_RESERVE (64UL << 30)
+#define SIM_MMAP_RESERVE (1UL << 40)
+
+// Reserved ranges are made writable in chunks as the high-water mark grows.
+#define SIM_COMMIT_CHUNK (64UL << 20)
+
+// Freed mappings are recycled through buckets keyed by their page count.
+#define SIM_BUCKETS 4096
+
+// Header written in a recycled mapping.
+struct sim_range {
+	size_t pages;
+	struct sim_range *next;
+};
+
+struct sim_stats sim_stats;
+
+static size_t page_size;
+static char *heap_base, *heap_brk, *heap_committed;
+static char *mmap_base, *mmap_top, *mmap_committed;
+static struct sim_range *buckets[SIM_BUCKETS];
+
+static char *reserve(size_t size)
+{
+	char *addr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	return addr;
+}
+
+// Makes [*committed, end) writable, rounding up to a commit chunk.
+static void commit(char **committed, char *end)
+{
+	if (end <= *committed)
+		return;
+
+	size_t size = ((end - *committed) + SIM_COMMIT_CHUNK - 1) / SIM_COMMIT_CHUNK * SIM_COMMIT_CHUNK;
+
+	if (mprotect(*committed, size, PROT_READ | PROT_WRITE)) {
+		perror("mprotect");
+		exit(EXIT_FAILURE);
+	}
+	*committed += size;
+}
+
+static void update_peak(void)
+{
+	size_t size = sim_stats.heap_size + sim_stats.mmap_size;
+
+	if (size > sim_stats.peak_size)
+		sim_stats.peak_size = size;
+}
+
+void sim_init(void)
+{
+	page_size = getpagesize();
+	heap_base = heap_brk = heap_committed = reserve(SIM_HEAP_RESERVE);
+	mmap_base = mmap_top = mmap_committed = reserve(SIM_MMAP_RESERVE);
+}
+
+void *sim_sbrk(intptr_t increment)
+{
+	char *old_brk = heap_brk;
+
+	if (!increment)
+		return old_brk;
+
+	if ((increment > 0) && ((size_t)(heap_brk - heap_base) + increment > SIM_HEAP_RESERVE)) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+
+	sim_stats.sbrk_calls++;
+	heap_brk += increment;
+	commit(&heap_committed, heap_brk);
+
+	sim_stats.heap_size = heap_brk - heap_base;
+	update_peak();
+	return old_brk;
+}
+
+void *sim_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	(void)addr;
+	(void)prot;
+	(void)flags;
+	(void)fd;
+	(void)offset;
+
+	size_t pages = (length + page_size - 1) / page_size;
+	struct sim_range **link = &buckets[pages % SIM_BUCKETS];
+	char *ret = NULL;
+
+	sim_stats.mmap_calls++;
+
+	// Reuse a freed range of the same length.
+	while (*link) {
+		if ((*link)->pages == pages) {
+			ret = (char *)*link;
+			*link = (*link)->next;
+			break;
+		}
+		link = &(*link)->next;
+	}
+
+	if (!ret) {
+		if ((size_t)(mmap_top - mmap_base) + pages * page_size > SIM_MMAP_RESERVE) {
+			errno = ENOMEM;
+			return MAP_FAILED;
+		}
+		ret = mmap_top;
+		mmap_top += pages * page_size;
+		commit(&mmap_committed, mmap_top);
+	}
+
+	sim_stats.mmap_size += pages * page_size;
+	update_peak();
+	return ret;
+}
+
+int sim_munmap(void *addr, size_t length)
+{
+	size_t pages = (length + page_size - 1) / page_size;
+	struct sim_range *range = addr;
+
+	sim_stats.munmap_calls++;
+	sim_stats.mmap_size -= pages * page_size;
+
+	range->pages = pages;
+	range->next = buckets[pages % SIM_BUCKETS];
+	buckets[pages % SIM_BUCKETS] = range;
+	return 0;
+}
+
+void *sim_memcpy(void *dest, const void *src, size_t n)
+{
+	(void)src;
+	sim_stats.bytes_copied += n;
+	return dest;
+}
+
+void *sim_memset(void *s, int c, size_t n)
+{
+	(void)c;
+	sim_stats.bytes_zeroed += n;
+	return s;
+}
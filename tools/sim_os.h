@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Force-included when building the allocator for osmem-sim: the memory syscalls
+ * are redirected to a simulated address space and payload copies are only
+ * accounted, so a replay touches nothing but the block metadata.
+ */
+
+#pragma once
+
+/* Included before the allocator sources, which may rely on GNU extensions */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+/* Counters of the simulated address space */
+struct sim_stats {
+	unsigned long sbrk_calls;
+	unsigned long mmap_calls;
+	unsigned long munmap_calls;
+	size_t heap_size;
+	size_t mmap_size;
+	size_t peak_size;
+	size_t bytes_copied;
+	size_t bytes_zeroed;
+};
+
+extern struct sim_stats sim_stats;
+
+void sim_init(void);
+void *sim_sbrk(intptr_t increment);
+void *sim_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+int sim_munmap(void *addr, size_t length);
+void *sim_memcpy(void *dest, const void *src, size_t n);
+void *sim_memset(void *s, int c, size_t n);
+
+#ifndef SIM_OS_IMPL
+#define sbrk sim_sbrk
+#define mmap sim_mmap
+#define munmap sim_munmap
+#define memcpy sim_memcpy
+#define memset sim_memset
+#endif
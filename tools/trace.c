@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+// Opens a trace file, "-" reads the standard input.
+int trace_open(struct trace *trace, const char *path)
+{
+	trace->path = path;
+	trace->line = 0;
+	trace->file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+
+	if (!trace->file) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Reads the unsigned number at (*pos) and moves (*pos) past it. Returns -1
+// if there is none or it does not fit in 64 bits.
+static int trace_number(char **pos, uint64_t *value)
+{
+	char *str = *pos + strspn(*pos, " \t");
+	char *end;
+
+	if (*str == '-')
+		return -1;
+	errno = 0;
+	*value = strtoull(str, &end, 0);
+	if ((end == str) || (errno == ERANGE))
+		return -1;
+	*pos = end;
+	return 0;
+}
+
+// Reads the next operation. Returns 1 on success, 0 at the end of the trace
+// and -1 on a malformed line.
+int trace_next(struct trace *trace, struct trace_op *op)
+{
+	char buf[256];
+	uint64_t value;
+
+	while (fgets(buf, sizeof(buf), trace->file)) {
+		char *pos = buf + 1;
+
+		trace->line++;
+		if ((buf[0] == '#') || (buf[0] == '\n'))
+			continue;
+
+		op->type = buf[0];
+		if (trace_number(&pos, &op->id))
+			goto malformed;
+		op->new_id = op->id;
+		op->nmemb = 1;
+		op->size = 0;
+
+		switch (op->type) {
+		case 'r':
+			if (trace_number(&pos, &value))
+				goto malformed;
+			op->size = value;
+			// The new id is optional.
+			if ((*pos != '\n') && (*pos != '\0') && trace_number(&pos, &op->new_id))
+				goto malformed;
+			goto check;
+		case 'c':
+			if (trace_number(&pos, &value))
+				goto malformed;
+			op->nmemb = value;
+			/* fallthrough */
+		case 'm':
+			if (trace_number(&pos, &value))
+				goto malformed;
+			op->size = value;
+			/* fallthrough */
+		case 'f':
+check:
+			if ((*pos == '\n') || (*pos == '\0'))
+				return 1;
+		}
+malformed:
+		fprintf(stderr, "%s:%lu: malformed trace line\n", trace->path, trace->line);
+		return -1;
+	}
+	return 0;
+}
+
+void trace_close(struct trace *trace)
+{
+	if (trace->file != stdin)
+		fclose(trace->file);
+}
+
+void trace_map_init(struct trace_map *map)
+{
+	map->cap = 1024;
+	map->count = 0;
+	map->slots = calloc(map->cap, sizeof(*map->slots));
+	if (!map->slots)
+		abort();
+}
+
+static size_t trace_map_hash(uint64_t id)
+{
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+	return id;
+}
+
+struct trace_obj *trace_map_get(struct trace_map *map, uint64_t id)
+{
+	size_t i = trace_map_hash(id) & (map->cap - 1);
+
+	while (map->slots[i].used) {
+		if (map->slots[i].id == id)
+			return &map->slots[i];
+		i = (i + 1) & (map->cap - 1);
+	}
+	return NULL;
+}
+
+// Doubles the table once it is half full.
+static void trace_map_grow(struct trace_map *map)
+{
+	struct trace_obj *old = map->slots;
+	size_t old_cap = map->cap;
+
+	map->cap *= 2;
+	map->slots = calloc(map->cap, sizeof(*map->slots));
+	if (!map->slots)
+		abort();
+
+	for (size_t i = 0; i < old_cap; i++) {
+		if (!old[i].used)
+			continue;
+
+		size_t j = trace_map_hash(old[i].id) & (map->cap - 1);
+
+		while (map->slots[j].used)
+			j = (j + 1) & (map->cap - 1);
+		map->slots[j] = old[i];
+	}
+	free(old);
+}
+
+// Returns the object named (id), inserting an empty one if it is missing.
+struct trace_obj *trace_map_put(struct trace_map *map, uint64_t id)
+{
+	struct trace_obj *obj = trace_map_get(map, id);
+
+	if (obj)
+		return obj;
+
+	if (2 * (map->count + 1) > map->cap)
+		trace_map_grow(map);
+
+	size_t i = trace_map_hash(id) & (map->cap - 1);
+
+	while (map->slots[i].used)
+		i = (i + 1) & (map->cap - 1);
+
+	obj = &map->slots[i];
+	memset(obj, 0, sizeof(*obj));
+	obj->id = id;
+	obj->used = 1;
+	map->count++;
+	return obj;
+}
+
+// Removes an object, shifting back the rest of its probe chain.
+void trace_map_del(struct trace_map *map, struct trace_obj *obj)
+{
+	size_t i = obj - map->slots;
+	size_t j = i;
+
+	map->slots[i].used = 0;
+	map->count--;
+
+	for (;;) {
+		j = (j + 1) & (map->cap - 1);
+		if (!map->slots[j].used)
+			return;
+
+		size_t home = trace_map_hash(map->slots[j].id) & (map->cap - 1);
+
+		// Move the entry if its home slot is not between i and j(cyclically).
+		if ((i <= j) ? ((home <= i) || (home > j)) : ((home <= i) && (home > j))) {
+			map->slots[i] = map->slots[j];
+			map->slots[j].used = 0;
+			i = j;
+		}
+	}
+}
+
+// Moves an object under a new id and returns its new slot.
+struct trace_obj *trace_map_rename(struct trace_map *map, struct trace_obj *obj, uint64_t id)
+{
+	struct trace_obj copy = *obj;
+
+	if (obj->id == id)
+		return obj;
+
+	trace_map_del(map, obj);
+	obj = trace_map_put(map, id);
+	copy.id = id;
+	*obj = copy;
+	return obj;
+}
+
+void trace_map_free(struct trace_map *map)
+{
+	free(map->slots);
+	map->slots = NULL;
+}
+
+// Parses a size with an optional k, m or g suffix; returns -1 on junk or
+// on a size that does not fit in a size_t.
+int trace_parse_size(const char *str, size_t *size)
+{
+	char *end;
+	unsigned long long value;
+	int shift = 0;
+
+	if (*str == '-')
+		return -1;
+	errno = 0;
+	value = strtoull(str, &end, 0);
+	if ((end == str) || (errno == ERANGE))
+		return -1;
+
+	switch (*end) {
+	case 'g':
+	case 'G':
+		shift += 10;
+		/* fallthrough */
+	case 'm':
+	case 'M':
+		shift += 10;
+		/* fallthrough */
+	case 'k':
+	case 'K':
+		shift += 10;
+		end++;
+	}
+	if (*end || (value > (SIZE_MAX >> shift)))
+		return -1;
+
+	*size = value << shift;
+	return 0;
+}
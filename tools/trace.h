@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Allocation trace format, one operation per line:
+ *   m <id> <size>		os_malloc
+ *   c <id> <nmemb> <size>	os_calloc
+ *   r <id> <size> [<new-id>]	os_realloc of a live object, renamed to <new-id> if given
+ *   f <id>			os_free
+ * Ids are unsigned 64-bit names chosen by the recorder (the library's own
+ * recorder uses block addresses); lines starting with '#' are comments.
+ */
+
+/* One trace operation */
+struct trace_op {
+	char type;
+	uint64_t id;
+	uint64_t new_id;	/* id of the object after a realloc */
+	size_t nmemb;
+	size_t size;
+};
+
+/* Streaming trace reader */
+struct trace {
+	FILE *file;
+	const char *path;
+	unsigned long line;
+};
+
+int trace_open(struct trace *trace, const char *path);
+int trace_next(struct trace *trace, struct trace_op *op);
+void trace_close(struct trace *trace);
+
+/* Live object tracked while replaying a trace */
+struct trace_obj {
+	uint64_t id;
+	void *ptr;
+	size_t size;
+	uint64_t born;
+	int used;
+};
+
+/* Open addressing map from trace ids to live objects */
+struct trace_map {
+	struct trace_obj *slots;
+	size_t cap;
+	size_t count;
+};
+
+void trace_map_init(struct trace_map *map);
+struct trace_obj *trace_map_get(struct trace_map *map, uint64_t id);
+struct trace_obj *trace_map_put(struct trace_map *map, uint64_t id);
+void trace_map_del(struct trace_map *map, struct trace_obj *obj);
+struct trace_obj *trace_map_rename(struct trace_map *map, struct trace_obj *obj, uint64_t id);
+void trace_map_free(struct trace_map *map);
+
+int trace_parse_size(const char *str, size_t *size);
@@ -27,3 +27,5 @@ struct block_meta {
 #define STATUS_FREE   0
 #define STATUS_ALLOC  1
 #define STATUS_MAPPED 2
+#define STATUS_SPAN   3
+#define STATUS_GROUP  4
@@ -7,7 +7,215 @@
 #include <stdio.h>
 #include "printf.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void *os_malloc(size_t size);
 void os_free(void *ptr);
 void *os_calloc(size_t nmemb, size_t size);
 void *os_realloc(void *ptr, size_t size);
+
+/*
+ * Grows the block of (ptr) to hold at least (size) bytes without moving it:
+ * a heap block takes the free blocks that follow it(or the heap grows when it
+ * is the last one), a mapped block its page slack and then the pages right
+ * after its mapping. Returns the new usable size, or 0 if the block has to
+ * move, in which case it is left unchanged.
+ */
+size_t os_expand(void *ptr, size_t size);
+
+/*
+ * Allocates (size) bytes next to the other blocks of (group): requests up to
+ * 1 KB of a group are carved from regions dedicated to it, so objects built
+ * and traversed together(graph nodes, AST nodes) share cache lines and pages.
+ * The block is freed with os_free(); its memory is only reused by the group.
+ * Up to 256 groups are kept apart, the requests of further groups and larger
+ * ones are plain allocations. The "site_groups" option groups the small
+ * os_malloc() requests by call site the same way; group ids with the top bit
+ * set are reserved for these and get plain allocations too.
+ */
+void *os_malloc_group(unsigned long group, size_t size);
+
+/*
+ * Allocates (size) bytes close to the live block (hint): in a free heap block
+ * within a page of it(the closest one), or in the group of a group block.
+ * Otherwise, and for sizes that are mapped, it behaves like os_malloc(). Meant
+ * for linked structures that keep a child next to its parent.
+ */
+void *os_malloc_near(void *hint, size_t size);
+
+/* Bytes usable in the block of (ptr), at least the size requested(rounded up to 8) */
+size_t os_malloc_usable_size(void *ptr);
+
+/*
+ * Empties into the heap the thread caches that saw no operation since the
+ * previous call(or the previous pass of the "tcache_idle_ms" scavenger), e.g.
+ * from a timer thread of the application. Returns the number of blocks freed.
+ */
+unsigned long os_tcache_scavenge(void);
+
+/*
+ * Entry points for sizes known at compile time, up to OSMEM_SMALL_MAX bytes:
+ * (index) is the size in 8-byte units, rounded up, and selects the size class
+ * with a single table load. Use them through OS_MALLOC()/OS_FREE(), which fall
+ * back to os_malloc()/os_free() for sizes known only at run time. A block freed
+ * with OS_FREE() must be given the size it was allocated with.
+ */
+#define OSMEM_SMALL_MAX 4096
+#define OSMEM_SMALL_INDEX(size) (((size) + 7) / 8)
+
+void *os_malloc_small(size_t index);
+void os_free_small(void *ptr, size_t index);
+
+#define OS_MALLOC(size)										\
+	((__builtin_constant_p(size) && ((size) != 0) && ((size) <= OSMEM_SMALL_MAX)) ?		\
+	 os_malloc_small(OSMEM_SMALL_INDEX(size)) : os_malloc(size))
+
+#define OS_FREE(ptr, size)									\
+	((__builtin_constant_p(size) && ((size) != 0) && ((size) <= OSMEM_SMALL_MAX)) ?		\
+	 os_free_small((ptr), OSMEM_SMALL_INDEX(size)) : os_free(ptr))
+
+/* Allocator counters, collected when the "stats" option is enabled */
+struct osmem_stats {
+	unsigned long malloc_calls;
+	unsigned long calloc_calls;
+	unsigned long realloc_calls;
+	unsigned long free_calls;
+	unsigned long tcache_hits;	/* allocations served by the thread cache */
+	unsigned long tcache_stolen;	/* cached blocks taken back from other or exited threads */
+	unsigned long tcache_scavenged;	/* cached blocks of idle threads returned to the heap */
+	unsigned long tcache_misses;	/* "tcache_budget": gets finding their bin empty */
+	unsigned long tcache_overflows;	/* "tcache_budget": puts finding their bin full */
+	size_t tcache_budget_moved;	/* "tcache_budget": bytes of capacity taken from other threads */
+	size_t tcache_capacity_size;	/* bytes the live thread caches may hold */
+	unsigned long tcache_capacity[32];	/* blocks they may hold, by size class */
+	unsigned long sbrk_calls;
+	unsigned long mmap_calls;
+	unsigned long munmap_calls;
+	size_t heap_size;		/* bytes obtained with sbrk */
+	size_t mapped_size;		/* bytes currently mapped for blocks */
+	size_t peak_mapped_size;
+	unsigned long realloc_in_place;
+	unsigned long realloc_moves;
+	size_t realloc_copied;		/* bytes copied by moving reallocations */
+	size_t realloc_remapped;	/* bytes moved by remapping their pages instead */
+	unsigned long heap_trims;	/* times the free heap top was returned */
+	unsigned long deferred_frees;	/* frees queued while the heap lock was taken */
+	unsigned long span_chunks;	/* super-chunks mapped for spans */
+	size_t span_size;		/* bytes of the live spans */
+	unsigned long group_regions;	/* regions carved for allocation groups */
+	unsigned long near_hits;	/* os_malloc_near() blocks placed next to their hint */
+	size_t calloc_zero_skipped;	/* os_calloc() bytes known to be zero, not cleared */
+};
+
+/*
+ * Pinned pools: (bytes) of memory faulted in and mlock'd at creation, served
+ * with 64-byte aligned blocks. If RLIMIT_MEMLOCK does not allow locking the
+ * pool, the pool is still created, prefaulted but not locked;
+ * os_pinned_pool_locked() tells which. With the "pinned_memlock" option, the
+ * process-wide RLIMIT_MEMLOCK soft limit is first raised to the hard limit.
+ * The mappings count in the mmap_calls, munmap_calls and mapped_size stats.
+ */
+struct os_pinned_pool;
+
+struct os_pinned_pool *os_pinned_pool_create(size_t bytes);
+int os_pinned_pool_locked(struct os_pinned_pool *pool);
+void *os_pinned_alloc(struct os_pinned_pool *pool, size_t size);
+void os_pinned_free(struct os_pinned_pool *pool, void *ptr);
+void os_pinned_pool_destroy(struct os_pinned_pool *pool);
+
+/*
+ * Heap snapshots, available with the "heap_memfd" option: the heap lives in a
+ * memfd and a snapshot is a read-only copy-on-write view of it. The view keeps
+ * the heap contents of the time of the call while the other threads go on
+ * allocating and writing; only the pages they modify are copied. A live heap
+ * address p is found at data + (p - heap) in the view.
+ *
+ * One snapshot exists at a time: os_heap_snapshot() returns -1 with errno set
+ * to EBUSY while another one is held, or EINVAL without a memfd heap. Releasing
+ * a snapshot writes the modified pages back to the memfd, so no other thread
+ * may write to the heap during os_heap_snapshot_release().
+ *
+ * A memfd heap is shared with the children of fork(), which must only exec.
+ */
+struct os_heap_snapshot {
+	const void *data;	/* read-only view of the heap */
+	size_t size;		/* heap size at the time of the snapshot */
+	const void *heap;	/* start of the live heap */
+};
+
+int os_heap_snapshot(struct os_heap_snapshot *snap);
+void os_heap_snapshot_release(struct os_heap_snapshot *snap);
+
+/* Calls (fn) with the payload(inside the view) and size of every heap block allocated in (snap) */
+void os_heap_snapshot_walk(const struct os_heap_snapshot *snap,
+						   void (*fn)(const void *payload, size_t size, void *arg), void *arg);
+
+/*
+ * Object pools: objects of one size, 16-byte aligned, carved from 64 KB slabs
+ * taken from the heap. Objects are handed out from one slab at a time, the slab
+ * freed into last first; the slabs are freed with the pool. The bulk calls move
+ * up to (n) objects under a single lock acquisition; os_pool_alloc_bulk()
+ * returns how many it allocated. Freeing an object of another pool aborts.
+ */
+struct os_pool;
+
+struct os_pool *os_pool_create(size_t size);
+size_t os_pool_object_size(struct os_pool *pool);
+void *os_pool_alloc(struct os_pool *pool);
+void os_pool_free(struct os_pool *pool, void *obj);
+size_t os_pool_alloc_bulk(struct os_pool *pool, void **objs, size_t n);
+void os_pool_free_bulk(struct os_pool *pool, void **objs, size_t n);
+void os_pool_destroy(struct os_pool *pool);
+
+/*
+ * Meshing, for the pools and caches created with the "pool_mesh" option: slabs
+ * whose objects sit at different offsets are merged onto the physical pages of
+ * one of them, objects keeping their addresses. Returns the bytes given back
+ * to the system(0 for other pools). No other thread may write to an object of
+ * the pool meanwhile.
+ */
+size_t os_pool_mesh(struct os_pool *pool);
+
+/*
+ * Object caches: pools whose objects are built by (ctor) when their slab is
+ * added and torn down by (dtor) when it is released, so an object freed to the
+ * cache keeps its constructed state(locks, lists, buffers) and the next
+ * allocation gets it back as is. Either function may be NULL. Objects are
+ * aligned to (align), a power of two up to 4096(0 for 8 bytes).
+ *
+ * os_cache_shrink() releases the slabs whose objects are all free and returns
+ * their number; os_cache_destroy() releases every slab, so all the objects must
+ * have been freed.
+ */
+struct os_cache;
+
+struct os_cache_stats {
+	const char *name;
+	size_t size;			/* object size requested */
+	size_t obj_size;		/* bytes taken by an object in a slab */
+	unsigned long allocs;
+	unsigned long frees;
+	size_t slabs;
+	size_t objects;			/* objects in the slabs, free or not */
+	unsigned long ctor_calls;
+	unsigned long dtor_calls;
+	unsigned long meshes;		/* slabs merged by os_cache_mesh() */
+};
+
+struct os_cache *os_cache_create(const char *name, size_t size, size_t align,
+								 void (*ctor)(void *obj), void (*dtor)(void *obj));
+void *os_cache_alloc(struct os_cache *cache);
+void os_cache_free(struct os_cache *cache, void *obj);
+size_t os_cache_shrink(struct os_cache *cache);
+size_t os_cache_mesh(struct os_cache *cache);
+void os_cache_stats_get(struct os_cache *cache, struct os_cache_stats *stats);
+void os_cache_destroy(struct os_cache *cache);
+
+void os_stats_get(struct osmem_stats *stats);
+void os_stats_print(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,460 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "osmem.h"
+
+namespace osmem {
+
+/*
+ * Allocation of a size known at compile time(e.g. alloc<sizeof(T)>()): the
+ * size class is selected with a single table load, see OS_MALLOC().
+ */
+template <std::size_t N>
+inline void *alloc()
+{
+	static_assert(N > 0, "zero-sized allocation");
+
+	if constexpr (N <= OSMEM_SMALL_MAX)
+		return os_malloc_small(OSMEM_SMALL_INDEX(N));
+	else
+		return os_malloc(N);
+}
+
+/* Frees a block returned by alloc<N>() */
+template <std::size_t N>
+inline void free(void *ptr)
+{
+	if constexpr (N <= OSMEM_SMALL_MAX)
+		os_free_small(ptr, OSMEM_SMALL_INDEX(N));
+	else
+		os_free(ptr);
+}
+
+namespace detail {
+
+/*
+ * Coroutine frame size classes: 64-byte steps up to 1 KB, then 2 and 4 KB.
+ * Larger frames go to the global operator new.
+ */
+constexpr std::size_t frame_step = 64;
+constexpr std::size_t frame_small_max = 1024;
+constexpr std::size_t frame_max = 4096;
+constexpr int nr_frame_classes = frame_small_max / frame_step + 2;
+
+constexpr std::size_t frame_class_size(int cls)
+{
+	return (cls < (int)(frame_small_max / frame_step)) ? (cls + 1) * frame_step
+		: frame_small_max << (cls + 1 - frame_small_max / frame_step);
+}
+
+constexpr int frame_class(std::size_t size)
+{
+	if (size <= frame_small_max)
+		return (size + frame_step - 1) / frame_step - (size != 0);
+	if (size <= frame_max)
+		return frame_small_max / frame_step + (size > 2 * frame_small_max);
+	return -1;
+}
+
+/* Objects cached per thread and pool, and moved to and from the pool at once */
+constexpr unsigned int cache_depth = 64;
+constexpr unsigned int cache_batch = 32;
+
+/*
+ * Freed objects of one pool kept by a thread, LIFO so the next object is the
+ * most recently used. Caches are trivial so that using them needs no
+ * initialization check; the objects flushing them at thread exit are only
+ * touched when a cache goes from empty to non-empty.
+ */
+struct pool_cache {
+	void *objs[cache_depth];
+	unsigned int count;
+
+	/*
+	 * (pool) returns the pool and (arm) makes sure the cache is flushed at
+	 * thread exit; both are only called outside the fast path.
+	 */
+	template <class Pool, class Arm>
+	void *alloc(Pool pool, Arm arm)
+	{
+		if (!count) {
+			arm();
+			count = os_pool_alloc_bulk(pool(), objs, cache_batch);
+			if (!count)
+				throw std::bad_alloc();
+		}
+		return objs[--count];
+	}
+
+	/* A full cache gives its oldest objects back to the pool */
+	template <class Pool, class Arm>
+	void free(void *obj, Pool pool, Arm arm) noexcept
+	{
+		if (!count) {
+			arm();
+		} else if (count == cache_depth) {
+			os_pool_free_bulk(pool(), objs, cache_batch);
+			count -= cache_batch;
+			for (unsigned int i = 0; i < count; i++)
+				objs[i] = objs[i + cache_batch];
+		}
+		objs[count++] = obj;
+	}
+
+	void flush(os_pool *pool) noexcept
+	{
+		if (count)
+			os_pool_free_bulk(pool, objs, count);
+		count = 0;
+	}
+};
+
+/* One pool per frame class, shared by the threads and never destroyed */
+inline os_pool *frame_pool(int cls)
+{
+	static os_pool *const *pools = [] {
+		static os_pool *p[nr_frame_classes];
+
+		for (int i = 0; i < nr_frame_classes; i++) {
+			p[i] = os_pool_create(frame_class_size(i));
+			if (!p[i])
+				throw std::bad_alloc();
+		}
+		return p;
+	}();
+
+	return pools[cls];
+}
+
+inline thread_local pool_cache frames[nr_frame_classes];
+
+struct frame_cache_exit {
+	bool armed;
+
+	~frame_cache_exit()
+	{
+		for (int cls = 0; cls < nr_frame_classes; cls++)
+			frames[cls].flush(frame_pool(cls));
+	}
+};
+
+inline thread_local frame_cache_exit frames_exit;
+
+} /* namespace detail */
+
+/* Allocates a coroutine frame of (size) bytes */
+inline void *frame_alloc(std::size_t size)
+{
+	const int cls = detail::frame_class(size);
+
+	if (cls < 0)
+		return ::operator new(size);
+	return detail::frames[cls].alloc([cls] { return detail::frame_pool(cls); },
+									 [] { detail::frames_exit.armed = true; });
+}
+
+/* Frees a frame returned by frame_alloc(size) */
+inline void frame_free(void *ptr, std::size_t size) noexcept
+{
+	const int cls = detail::frame_class(size);
+
+	if (cls < 0)
+		::operator delete(ptr, size);
+	else
+		detail::frames[cls].free(ptr, [cls] { return detail::frame_pool(cls); },
+								 [] { detail::frames_exit.armed = true; });
+}
+
+/*
+ * Promise type mixin: the frames of the coroutines whose promise_type derives
+ * from it come from per-thread, size-class pools instead of the global operator
+ * new, and are freed with their size.
+ *
+ *	struct task {
+ *		struct promise_type : osmem::frame_allocated { ... };
+ *	};
+ *
+ * Frames may be freed by another thread than the one that allocated them.
+ */
+struct frame_allocated {
+	static void *operator new(std::size_t size)
+	{
+		return frame_alloc(size);
+	}
+
+	static void operator delete(void *ptr, std::size_t size) noexcept
+	{
+		frame_free(ptr, size);
+	}
+};
+
+namespace detail {
+
+/* The pool of the nodes of type T, shared by the threads and never destroyed */
+template <class T>
+os_pool *node_pool()
+{
+	static os_pool *const pool = [] {
+		os_pool *p = os_pool_create(sizeof(T));
+
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}();
+
+	return pool;
+}
+
+template <class T>
+inline thread_local pool_cache nodes;
+
+template <class T>
+struct node_cache_exit {
+	bool armed;
+
+	~node_cache_exit()
+	{
+		nodes<T>.flush(node_pool<T>());
+	}
+};
+
+template <class T>
+inline thread_local node_cache_exit<T> nodes_exit;
+
+} /* namespace detail */
+
+/*
+ * Allocator for node-based containers(std::list, std::map, std::unordered_map,
+ * ...). The containers rebind it to their node type and allocate nodes one at
+ * a time: single objects come from a per-thread cache refilled from slabs
+ * dedicated to their type, so the nodes of a container stay close to each
+ * other. Arrays(e.g. hash buckets) go to the global operator new.
+ *
+ *	std::map<int, int, std::less<int>, osmem::node_allocator<std::pair<const int, int>>> m;
+ */
+template <class T>
+struct node_allocator {
+	static_assert(alignof(T) <= 16, "pool objects are 16-byte aligned");
+
+	using value_type = T;
+	using is_always_equal = std::true_type;
+
+	node_allocator() noexcept = default;
+
+	template <class U>
+	node_allocator(const node_allocator<U> &) noexcept {}
+
+	T *allocate(std::size_t n)
+	{
+		if (n == 1)
+			return static_cast<T *>(detail::nodes<T>.alloc(detail::node_pool<T>,
+								[] { detail::nodes_exit<T>.armed = true; }));
+		if (n > static_cast<std::size_t>(-1) / sizeof(T))
+			throw std::bad_array_new_length();
+		return static_cast<T *>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T *ptr, std::size_t n) noexcept
+	{
+		if (n == 1)
+			detail::nodes<T>.free(ptr, detail::node_pool<T>, [] { detail::nodes_exit<T>.armed = true; });
+		else
+			::operator delete(ptr, n * sizeof(T));
+	}
+
+	template <class U>
+	bool operator==(const node_allocator<U> &) const noexcept
+	{
+		return true;
+	}
+};
+
+/*
+ * Types whose objects may be moved to another address with a plain byte copy,
+ * which os_realloc() does. Specialize it for types that are not trivially
+ * copyable but do not depend on their own address.
+ */
+template <class T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+/*
+ * A vector of trivially relocatable elements that grows through the allocator:
+ * the storage is first expanded in place with os_expand(), then moved with
+ * os_realloc(), never allocated anew and copied element by element. The
+ * capacity covers the whole usable size of the block.
+ */
+template <class T>
+class vector {
+	static_assert(is_trivially_relocatable<T>::value, "osmem::vector elements are moved with os_realloc");
+	static_assert(alignof(T) <= 8, "osmem blocks are 8-byte aligned");
+
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+	using reference = T &;
+	using const_reference = const T &;
+	using iterator = T *;
+	using const_iterator = const T *;
+
+	vector() noexcept = default;
+
+	explicit vector(size_type n)
+	{
+		resize(n);
+	}
+
+	vector(size_type n, const T &value)
+	{
+		resize(n, value);
+	}
+
+	vector(std::initializer_list<T> init)
+	{
+		reserve(init.size());
+		for (const T &value : init)
+			new (data_ + size_++) T(value);
+	}
+
+	vector(const vector &other)
+	{
+		reserve(other.size_);
+		for (const T &value : other)
+			new (data_ + size_++) T(value);
+	}
+
+	vector(vector &&other) noexcept
+	{
+		swap(other);
+	}
+
+	vector &operator=(vector other) noexcept
+	{
+		swap(other);
+		return *this;
+	}
+
+	~vector()
+	{
+		clear();
+		os_free(data_);
+	}
+
+	void swap(vector &other) noexcept
+	{
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		std::swap(capacity_, other.capacity_);
+	}
+
+	T *data() noexcept { return data_; }
+	const T *data() const noexcept { return data_; }
+	size_type size() const noexcept { return size_; }
+	size_type capacity() const noexcept { return capacity_; }
+	bool empty() const noexcept { return !size_; }
+
+	iterator begin() noexcept { return data_; }
+	iterator end() noexcept { return data_ + size_; }
+	const_iterator begin() const noexcept { return data_; }
+	const_iterator end() const noexcept { return data_ + size_; }
+
+	reference operator[](size_type i) { return data_[i]; }
+	const_reference operator[](size_type i) const { return data_[i]; }
+	reference front() { return data_[0]; }
+	reference back() { return data_[size_ - 1]; }
+
+	void reserve(size_type n)
+	{
+		if (n > capacity_)
+			reallocate(n);
+	}
+
+	template <class... Args>
+	reference emplace_back(Args &&...args)
+	{
+		if (size_ < capacity_)
+			return *new (data_ + size_++) T(std::forward<Args>(args)...);
+
+		/* The arguments may refer to an element of the storage about to move */
+		T value(std::forward<Args>(args)...);
+
+		grow(size_ + 1);
+		return *new (data_ + size_++) T(std::move(value));
+	}
+
+	void push_back(const T &value) { emplace_back(value); }
+	void push_back(T &&value) { emplace_back(std::move(value)); }
+
+	void pop_back()
+	{
+		data_[--size_].~T();
+	}
+
+	void resize(size_type n)
+	{
+		reserve(n);
+		while (size_ < n)
+			new (data_ + size_++) T();
+		while (size_ > n)
+			pop_back();
+	}
+
+	void resize(size_type n, const T &value)
+	{
+		if (n > capacity_) {
+			T copy(value);
+
+			reserve(n);
+			while (size_ < n)
+				new (data_ + size_++) T(copy);
+		}
+		while (size_ < n)
+			new (data_ + size_++) T(value);
+		while (size_ > n)
+			pop_back();
+	}
+
+	void clear() noexcept
+	{
+		while (size_)
+			pop_back();
+	}
+
+private:
+	/* Geometric growth, so that the moves that expansion cannot avoid stay amortized */
+	void grow(size_type n)
+	{
+		reallocate((n < 2 * capacity_) ? 2 * capacity_ : n);
+	}
+
+	void reallocate(size_type n)
+	{
+		if (n > static_cast<size_type>(-1) / sizeof(T))
+			throw std::bad_array_new_length();
+
+		size_type bytes = n * sizeof(T);
+		size_type usable = data_ ? os_expand(data_, bytes) : 0;
+
+		if (!usable) {
+			void *ptr = data_ ? os_realloc(data_, bytes) : os_malloc(bytes);
+
+			if (!ptr)
+				throw std::bad_alloc();
+			data_ = static_cast<T *>(ptr);
+			usable = os_malloc_usable_size(ptr);
+		}
+		capacity_ = usable / sizeof(T);
+	}
+
+	T *data_ = nullptr;
+	size_type size_ = 0;
+	size_type capacity_ = 0;
+};
+
+} /* namespace osmem */
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Free block placement policies */
+#define FIT_BEST  0
+#define FIT_FIRST 1
+#define FIT_NEXT  2
+
+/* Maximum number of thread cache size classes */
+#define OSMEM_MAX_CLASSES 32
+
+/* Maximum length of the trace file path */
+#define OSMEM_PATH_MAX 256
+
+/* Runtime tunables; the defaults reproduce the compile-time behaviour */
+struct osmem_conf {
+	size_t mmap_threshold;		/* smallest os_malloc size served by mmap */
+	size_t span_max;		/* mapped blocks below this size are spans of shared chunks, 0 disables spans */
+	size_t realloc_remap;		/* blocks this large move by remapping their pages, 0 always copies */
+	size_t calloc_threshold;	/* smallest os_calloc size served by mmap (capped to a page) */
+	int calloc_heap;		/* os_calloc maps at mmap_threshold and skips clearing known zero memory */
+	size_t prealloc_size;		/* size of the first heap extension */
+	size_t grow_step;		/* heap growth granularity, 0 grows by the exact amount */
+	size_t top_chunk;		/* heap space after the last block carved directly, grown by this much; 0 disables */
+	int fit_policy;			/* one of the FIT_* values */
+	unsigned int grow_ratio;	/* heap extensions cover at least this percentage of the heap */
+	size_t trim_threshold;		/* free heap top returned to the system once this large, 0 never trims */
+	size_t top_pad;			/* free heap top kept by a trim */
+	int lazy_coalesce;		/* merge free blocks only when no block fits */
+	int prefault;			/* touch new heap memory and populate mappings when obtained */
+	int deferred_free;		/* frees finding the heap lock taken are queued for its holder */
+	int pool_mesh;			/* pools created take meshable slabs from a memfd */
+	int pinned_memlock;		/* pinned pools may raise the RLIMIT_MEMLOCK soft limit to the hard one */
+	int site_groups;		/* small os_malloc requests are grouped by call site */
+	int heap_memfd;			/* heap mapped from a memfd, allows os_heap_snapshot() */
+	size_t heap_reserve;		/* address space reserved for a memfd heap, or each area of the fixed window */
+	unsigned long fixed_base;	/* heap and mappings placed in a window at this address, 0 lets the kernel place them */
+	int nr_classes;			/* number of size classes, 0 disables the thread cache */
+	size_t classes[OSMEM_MAX_CLASSES];	/* ascending, 8-byte aligned class sizes */
+	unsigned int tcache_depth[OSMEM_MAX_CLASSES];	/* cached blocks per thread and class */
+	unsigned int tcache_idle_ms;	/* caches unused for this long are emptied into the heap, 0 never */
+	size_t tcache_budget;		/* bytes all the thread caches may hold, sized by use; 0 uses the depths */
+	int stats;			/* collect the counters reported by os_stats_get() */
+	int print_stats;		/* print the counters to stderr at exit */
+	int print_conf;			/* print the effective configuration to stderr at start */
+	char trace[OSMEM_PATH_MAX];	/* file recording every call in the osmem-sim trace format */
+};
+
+extern struct osmem_conf osmem_conf;
+
+/*
+ * Applies "key:value,key:value" pairs(the OSMEM_CONF syntax) on top of the
+ * current configuration. Invalid pairs are reported on stderr and skipped;
+ * returns the number of rejected pairs. The options choosing where the memory
+ * lives(heap_memfd, heap_reserve, fixed_base) are rejected once the heap is set
+ * up, by the first allocation that does not fit in a mapping, or the fixed_base
+ * window is reserved, by the first allocation.
+ */
+int osmem_conf_parse(const char *conf);
+
+/*
+ * Named groups of settings, applied with the "profile" option:
+ *   footprint	 small preallocation, aggressive trimming, no thread cache
+ *   throughput	 large thread caches, geometric growth, lazy coalescing
+ *   latency	 prefaulted heap, deferred frees, no syscalls for common sizes
+ * A profile only sets the options it lists, later options override it.
+ */
+int osmem_conf_profile(const char *name);
+void osmem_conf_print(int fd);
+
+#ifdef __cplusplus
+}
+#endif
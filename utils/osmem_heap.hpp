@@ -0,0 +1,355 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "block_meta.h"
+#include "osmem.h"
+
+/*
+ * The allocator's building blocks as compile-time policies: a heap of blocks
+ * with the library's metadata layout, split on allocation and merged with
+ * their free neighbours on release, whose placement, locking, accounting and
+ * memory source are template parameters.
+ *
+ *	osmem::heap<> local;	// best fit, no lock, no stats, mmap'd chunks
+ *	osmem::heap<osmem::first_fit, osmem::mutex_lock, osmem::counting_stats> shared;
+ *
+ * Every policy call is resolved at compile time and the empty policies
+ * compile to nothing. A heap releases its memory when destroyed.
+ *
+ * This is a standalone implementation: only the block layout(block_meta.h) is
+ * shared with src/osmem.c, none of its code. The library heap's thread cache,
+ * top chunk, lazy coalescing and trimming are not part of it, and a fix to one
+ * of the two fit/split/merge paths does not reach the other.
+ */
+
+namespace osmem {
+
+namespace detail {
+
+constexpr std::size_t heap_align = 8;
+constexpr std::size_t heap_meta = (sizeof(block_meta) + heap_align - 1) & ~(heap_align - 1);
+
+constexpr std::size_t heap_round(std::size_t size)
+{
+	return (size + heap_align - 1) & ~(heap_align - 1);
+}
+
+} /* namespace detail */
+
+/*
+ * Fit policies: find(head, size) returns a free block of the list (head),
+ * address ordered within each backend region, holding (size) bytes, or
+ * nullptr; forget(cell, into) is called when (cell) is merged into (into).
+ */
+
+/* Smallest free block that fits */
+struct best_fit {
+	block_meta *find(block_meta *head, std::size_t size)
+	{
+		block_meta *best = nullptr;
+
+		for (block_meta *cell = head->next; cell != head; cell = cell->next) {
+			if ((cell->status != STATUS_FREE) || (cell->size < size))
+				continue;
+			if (cell->size == size)
+				return cell;
+			if (!best || (cell->size < best->size))
+				best = cell;
+		}
+		return best;
+	}
+
+	void forget(block_meta *, block_meta *) {}
+};
+
+/* First free block that fits */
+struct first_fit {
+	block_meta *find(block_meta *head, std::size_t size)
+	{
+		for (block_meta *cell = head->next; cell != head; cell = cell->next)
+			if ((cell->status == STATUS_FREE) && (cell->size >= size))
+				return cell;
+		return nullptr;
+	}
+
+	void forget(block_meta *, block_meta *) {}
+};
+
+/* First free block that fits, starting after the last placement */
+struct next_fit {
+	block_meta *rover = nullptr;
+
+	block_meta *find(block_meta *head, std::size_t size)
+	{
+		block_meta *start = rover ? rover : head->next;
+		block_meta *cell = start;
+
+		if (start == head)
+			return nullptr;
+		do {
+			if ((cell != head) && (cell->status == STATUS_FREE) && (cell->size >= size))
+				return rover = cell;
+			cell = cell->next;
+		} while (cell != start);
+		return nullptr;
+	}
+
+	void forget(block_meta *cell, block_meta *into)
+	{
+		if (rover == cell)
+			rover = into;
+	}
+};
+
+/* Lock policies */
+
+struct no_lock {
+	void lock() {}
+	void unlock() {}
+};
+
+struct mutex_lock {
+	std::mutex mutex;
+
+	void lock() { mutex.lock(); }
+	void unlock() { mutex.unlock(); }
+};
+
+struct spin_lock {
+	std::atomic_flag flag = ATOMIC_FLAG_INIT;
+
+	void lock()
+	{
+		while (flag.test_and_set(std::memory_order_acquire))
+			;
+	}
+
+	void unlock() { flag.clear(std::memory_order_release); }
+};
+
+/* Stats policies, called with the heap locked */
+
+struct no_stats {
+	void on_alloc(std::size_t) {}
+	void on_free(std::size_t) {}
+	void on_grow(std::size_t) {}
+};
+
+struct heap_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long grows;
+	std::size_t in_use;	/* payload bytes of the allocated blocks */
+	std::size_t peak_in_use;
+	std::size_t size;	/* bytes obtained from the backend */
+};
+
+struct counting_stats {
+	heap_stats counters = {};
+
+	void on_alloc(std::size_t size)
+	{
+		counters.allocs++;
+		counters.in_use += size;
+		if (counters.in_use > counters.peak_in_use)
+			counters.peak_in_use = counters.in_use;
+	}
+
+	void on_free(std::size_t size)
+	{
+		counters.frees++;
+		counters.in_use -= size;
+	}
+
+	void on_grow(std::size_t size)
+	{
+		counters.grows++;
+		counters.size += size;
+	}
+
+	const heap_stats &stats() const { return counters; }
+};
+
+/*
+ * Backends: acquire(size) returns a region of at least (size) bytes, 8-byte
+ * aligned, and updates (size) to its real length; release() gives it back.
+ */
+
+/* Private anonymous mappings of at least (Chunk) bytes */
+template <std::size_t Chunk = 1 << 20>
+struct mmap_backend {
+	void *acquire(std::size_t &size)
+	{
+		std::size_t page_size = static_cast<std::size_t>(getpagesize());
+
+		size = ((size < Chunk ? Chunk : size) + page_size - 1) & ~(page_size - 1);
+
+		void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		return (addr == MAP_FAILED) ? nullptr : addr;
+	}
+
+	void release(void *addr, std::size_t size) { munmap(addr, size); }
+};
+
+/* Blocks of at least (Chunk) bytes from os_malloc() */
+template <std::size_t Chunk = 64 * 1024>
+struct osmem_backend {
+	void *acquire(std::size_t &size)
+	{
+		size = detail::heap_round(size < Chunk ? Chunk : size);
+		return os_malloc(size);
+	}
+
+	void release(void *addr, std::size_t) { os_free(addr); }
+};
+
+template <class Fit = best_fit, class Lock = no_lock, class Stats = no_stats, class Backend = mmap_backend<>>
+class heap : public Stats, private Fit, private Lock, private Backend {
+public:
+	heap()
+	{
+		head.size = 0;
+		head.status = -1;
+		head.prev = &head;
+		head.next = &head;
+	}
+
+	heap(const heap &) = delete;
+	heap &operator=(const heap &) = delete;
+
+	~heap()
+	{
+		while (regions) {
+			region *next = regions->next;
+
+			Backend::release(regions, regions->size);
+			regions = next;
+		}
+	}
+
+	/* Returns an 8-byte aligned block of (size) bytes, or nullptr */
+	void *allocate(std::size_t size)
+	{
+		if (!size)
+			return nullptr;
+		size = detail::heap_round(size);
+
+		std::lock_guard<Lock> guard(*this);
+		block_meta *cell = Fit::find(&head, size);
+
+		if (!cell && !(cell = grow(size)))
+			return nullptr;
+		split(cell, size);
+		cell->status = STATUS_ALLOC;
+		Stats::on_alloc(cell->size);
+		return reinterpret_cast<char *>(cell) + detail::heap_meta;
+	}
+
+	void deallocate(void *ptr)
+	{
+		if (!ptr)
+			return;
+
+		block_meta *cell = meta(ptr);
+		std::lock_guard<Lock> guard(*this);
+
+		Stats::on_free(cell->size);
+		cell->status = STATUS_FREE;
+		merge_next(cell);
+		if ((cell->prev != &head) && (cell->prev->status == STATUS_FREE))
+			merge_next(cell->prev);
+	}
+
+	/* Bytes usable in the block of (ptr) */
+	static std::size_t usable_size(void *ptr) { return meta(ptr)->size; }
+
+private:
+	/* Header of a backend region, followed by its blocks */
+	struct region {
+		region *next;
+		std::size_t size;
+	};
+
+	static constexpr std::size_t region_meta = detail::heap_round(sizeof(region));
+
+	static block_meta *meta(void *ptr)
+	{
+		return reinterpret_cast<block_meta *>(static_cast<char *>(ptr) - detail::heap_meta);
+	}
+
+	static char *end(block_meta *cell)
+	{
+		return reinterpret_cast<char *>(cell) + detail::heap_meta + cell->size;
+	}
+
+	/* Adds a region holding one free block of at least (size) bytes */
+	block_meta *grow(std::size_t size)
+	{
+		std::size_t length = region_meta + detail::heap_meta + size;
+		region *r = static_cast<region *>(Backend::acquire(length));
+
+		if (!r)
+			return nullptr;
+		r->next = regions;
+		r->size = length;
+		regions = r;
+		Stats::on_grow(length);
+
+		block_meta *cell = reinterpret_cast<block_meta *>(reinterpret_cast<char *>(r) + region_meta);
+
+		cell->size = length - region_meta - detail::heap_meta;
+		cell->status = STATUS_FREE;
+		cell->prev = head.prev;
+		cell->next = &head;
+		head.prev->next = cell;
+		head.prev = cell;
+		return cell;
+	}
+
+	/* The rest of (cell) past (size) bytes becomes a free block if it can hold one */
+	void split(block_meta *cell, std::size_t size)
+	{
+		if (cell->size < size + detail::heap_meta + detail::heap_align)
+			return;
+
+		block_meta *rest = reinterpret_cast<block_meta *>(reinterpret_cast<char *>(cell) + detail::heap_meta + size);
+
+		rest->size = cell->size - size - detail::heap_meta;
+		rest->status = STATUS_FREE;
+		rest->prev = cell;
+		rest->next = cell->next;
+		cell->next->prev = rest;
+		cell->next = rest;
+		cell->size = size;
+	}
+
+	/* Merges (cell) with the next block if it is free and adjacent(same region) */
+	void merge_next(block_meta *cell)
+	{
+		block_meta *next = cell->next;
+
+		if ((next == &head) || (next->status != STATUS_FREE) || (end(cell) != reinterpret_cast<char *>(next)))
+			return;
+
+		Fit::forget(next, cell);
+		cell->size += detail::heap_meta + next->size;
+		cell->next = next->next;
+		next->next->prev = cell;
+	}
+
+	block_meta head;
+	region *regions = nullptr;
+};
+
+} /* namespace osmem */